@@ -0,0 +1,625 @@
+#include "acid_map.hpp"
+#include "concurrent_map.hpp"
+#include "sharded_acid_map.hpp"
+#include "wide_node_map.hpp"
+#include "node_pool.hpp"
+#include "bench_utils.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#ifdef ACID_MAP_BENCH_HAS_ABSL
+#include "absl/container/btree_map.h"
+#endif
+
+namespace bench {
+
+enum class operation {
+    find,
+    insert,
+    emplace,
+    try_emplace,
+    erase_key,
+    erase_iterator,
+    iterate,
+    iterate_reverse,
+    iterate_view,
+    clear,
+    bulk_build,
+    parallel_build,
+    find_batch
+};
+
+const std::vector<std::pair<operation, const char*>> all_operations = {
+    {operation::find, "find"},
+    {operation::insert, "insert"},
+    {operation::emplace, "emplace"},
+    {operation::try_emplace, "try_emplace"},
+    {operation::erase_key, "erase_key"},
+    {operation::erase_iterator, "erase_iterator"},
+    {operation::iterate, "iterate"},
+    {operation::iterate_reverse, "iterate_reverse"},
+    {operation::iterate_view, "iterate_view"},
+    {operation::clear, "clear"},
+    {operation::bulk_build, "bulk_build"},
+    {operation::parallel_build, "parallel_build"},
+    {operation::find_batch, "find_batch"},
+};
+
+const std::vector<key_order> all_orders = {key_order::sequential, key_order::random, key_order::zipfian};
+
+struct bench_config {
+    std::vector<std::size_t> sizes = {1000, 10000, 100000, 1000000, 10000000, 100000000};
+    std::size_t max_size = 1000000;
+    std::size_t min_ops = 1000000;
+    std::vector<std::string> containers;
+    std::vector<std::string> keys;
+    std::vector<std::string> orders;
+    std::vector<std::string> ops;
+    std::vector<std::size_t> threads;
+    static bool wants(const std::vector<std::string>& filter, const std::string& name) {
+        return filter.empty() || std::find(filter.begin(), filter.end(), name) != filter.end();
+    }
+};
+
+struct bench_result {
+    double ns_per_op = 0;
+    double bytes_per_element = 0;
+    double misses_per_op = 0;
+};
+
+volatile std::size_t sink = 0;
+
+template <class Map, class = void>
+struct uses_node_pool : std::false_type {};
+
+template <class Map>
+struct uses_node_pool<Map, std::void_t<decltype(std::declval<const Map&>().get_allocator().pool())>>
+    : std::true_type {};
+
+template <class Map, class = void>
+struct has_sorted_unique_insert : std::false_type {};
+
+template <class Map>
+struct has_sorted_unique_insert<Map, std::void_t<decltype(std::declval<Map&>().insert(polyndrom::sorted_unique,
+    std::declval<const typename Map::value_type*>(), std::declval<const typename Map::value_type*>()))>>
+    : std::true_type {};
+
+template <class Map, class = void>
+struct has_parallel_insert : std::false_type {};
+
+template <class Map>
+struct has_parallel_insert<Map, std::void_t<decltype(std::declval<Map&>().parallel_insert(
+    std::declval<polyndrom::work_stealing_executor&>(), std::declval<const typename Map::value_type*>(),
+    std::declval<const typename Map::value_type*>()))>> : std::true_type {};
+
+// One executor for the whole run, so its threads are started only once.
+polyndrom::work_stealing_executor& parallel_executor() {
+    static polyndrom::work_stealing_executor executor;
+    return executor;
+}
+
+template <class Map, class = void>
+struct has_view : std::false_type {};
+
+template <class Map>
+struct has_view<Map, std::void_t<decltype(std::declval<Map&>().view())>> : std::true_type {};
+
+template <class Map, class = void>
+struct has_contains_batch : std::false_type {};
+
+template <class Map>
+struct has_contains_batch<Map, std::void_t<decltype(std::declval<const Map&>().contains_batch(
+    std::declval<const typename Map::key_type*>(), std::declval<const typename Map::key_type*>(),
+    std::declval<bool*>()))>> : std::true_type {};
+
+template <class Map>
+double bytes_per_element(const Map& map) {
+    if constexpr (uses_node_pool<Map>::value) {
+        return static_cast<double>(map.get_allocator().pool()->reserved_bytes()) / static_cast<double>(map.size());
+    } else {
+        return static_cast<double>(live_bytes()) / static_cast<double>(map.size());
+    }
+}
+
+template <class Map>
+class map_benchmark {
+public:
+    using key_type = typename Map::key_type;
+    map_benchmark(const std::vector<key_type>& keys, cache_miss_counter& counter) : keys_(keys), counter_(counter) {
+        std::vector<uint32_t> indices = make_order(keys_.size(), key_order::sequential, 0);
+        std::sort(indices.begin(), indices.end(), [&](uint32_t lhs, uint32_t rhs) {
+            return keys_[lhs] < keys_[rhs];
+        });
+        sorted_values_.reserve(indices.size());
+        for (uint32_t index : indices) {
+            sorted_values_.emplace_back(keys_[index], static_cast<int>(index));
+        }
+        unsorted_values_.reserve(indices.size());
+        for (uint32_t index : make_order(keys_.size(), key_order::random, 3)) {
+            unsorted_values_.emplace_back(keys_[index], static_cast<int>(index));
+        }
+    }
+    bench_result run(operation op, key_order order) {
+        std::size_t n = keys_.size();
+        std::vector<uint32_t> fill_order = make_order(n, order == key_order::sequential ? key_order::sequential
+                                                                                          : key_order::random, 1);
+        std::vector<uint32_t> visits = make_order(n, order, 2);
+        std::size_t rounds = std::max<std::size_t>(1, min_ops_ / n);
+        double total_ns = 0;
+        uint64_t total_misses = 0;
+        std::size_t total_ops = 0;
+        double bytes = 0;
+        for (std::size_t round = 0; round < rounds; round++) {
+            auto map = std::make_unique<Map>();
+            if (op != operation::insert && op != operation::emplace && op != operation::try_emplace &&
+                op != operation::bulk_build && op != operation::parallel_build) {
+                fill(*map, fill_order);
+                bytes = bytes_per_element(*map);
+            }
+            stopwatch watch;
+            counter_.start();
+            watch.start();
+            total_ops += execute(*map, op, visits);
+            total_ns += watch.stop_ns();
+            total_misses += counter_.stop();
+            if (map->size() != 0 && bytes == 0) {
+                bytes = bytes_per_element(*map);
+            }
+        }
+        bench_result result;
+        result.ns_per_op = total_ns / static_cast<double>(total_ops);
+        result.bytes_per_element = bytes;
+        result.misses_per_op = static_cast<double>(total_misses) / static_cast<double>(total_ops);
+        return result;
+    }
+    void set_min_ops(std::size_t min_ops) {
+        min_ops_ = min_ops;
+    }
+private:
+    void fill(Map& map, const std::vector<uint32_t>& order) {
+        for (uint32_t index : order) {
+            map.emplace(keys_[index], static_cast<int>(index));
+        }
+    }
+    std::size_t execute(Map& map, operation op, const std::vector<uint32_t>& visits) {
+        std::size_t checksum = 0;
+        std::size_t ops = visits.size();
+        switch (op) {
+            case operation::find:
+                for (uint32_t index : visits) {
+                    checksum += map.find(keys_[index]) != map.end();
+                }
+                break;
+            case operation::insert:
+                for (uint32_t index : visits) {
+                    checksum += map.insert(typename Map::value_type(keys_[index], static_cast<int>(index))).second;
+                }
+                break;
+            case operation::emplace:
+                for (uint32_t index : visits) {
+                    checksum += map.emplace(keys_[index], static_cast<int>(index)).second;
+                }
+                break;
+            case operation::try_emplace:
+                for (uint32_t index : visits) {
+                    checksum += map.try_emplace(keys_[index], static_cast<int>(index)).second;
+                }
+                break;
+            case operation::erase_key:
+                for (uint32_t index : visits) {
+                    checksum += map.erase(keys_[index]);
+                }
+                break;
+            case operation::erase_iterator:
+                for (uint32_t index : visits) {
+                    auto it = map.find(keys_[index]);
+                    if (it != map.end()) {
+                        map.erase(it);
+                        checksum += 1;
+                    }
+                }
+                break;
+            case operation::iterate:
+                ops = map.size();
+                for (auto& [key, value] : map) {
+                    checksum += static_cast<std::size_t>(value);
+                }
+                break;
+            case operation::iterate_reverse:
+                ops = map.size();
+                for (auto it = map.rbegin(); it != map.rend(); ++it) {
+                    checksum += static_cast<std::size_t>(it->second);
+                }
+                break;
+            case operation::iterate_view:
+                // Cursors where the map has them, plain iterators otherwise.
+                ops = map.size();
+                if constexpr (has_view<Map>::value) {
+                    for (auto& [key, value] : map.view()) {
+                        checksum += static_cast<std::size_t>(value);
+                    }
+                } else {
+                    for (auto& [key, value] : map) {
+                        checksum += static_cast<std::size_t>(value);
+                    }
+                }
+                break;
+            case operation::clear:
+                ops = map.size();
+                map.clear();
+                break;
+            case operation::find_batch: {
+                // Requests of 256 keys, looked up in one call where the map
+                // supports it.
+                constexpr std::size_t batch = 256;
+                std::vector<key_type> requested;
+                bool results[batch];
+                requested.reserve(batch);
+                for (std::size_t start = 0; start < visits.size(); start += batch) {
+                    requested.clear();
+                    for (std::size_t i = start; i < std::min(visits.size(), start + batch); i++) {
+                        requested.push_back(keys_[visits[i]]);
+                    }
+                    if constexpr (has_contains_batch<Map>::value) {
+                        map.contains_batch(requested.data(), requested.data() + requested.size(), results);
+                    } else {
+                        for (std::size_t i = 0; i < requested.size(); i++) {
+                            results[i] = map.find(requested[i]) != map.end();
+                        }
+                    }
+                    for (std::size_t i = 0; i < requested.size(); i++) {
+                        checksum += results[i];
+                    }
+                }
+                break;
+            }
+            case operation::bulk_build:
+                ops = sorted_values_.size();
+                if constexpr (has_sorted_unique_insert<Map>::value) {
+                    map.insert(polyndrom::sorted_unique, sorted_values_.begin(), sorted_values_.end());
+                } else {
+                    map.insert(sorted_values_.begin(), sorted_values_.end());
+                }
+                checksum += map.size();
+                break;
+            case operation::parallel_build:
+                // From unsorted values on all cores where the map supports
+                // it, the same as insert(first, last) otherwise.
+                ops = unsorted_values_.size();
+                if constexpr (has_parallel_insert<Map>::value) {
+                    map.parallel_insert(parallel_executor(), unsorted_values_.begin(), unsorted_values_.end());
+                } else {
+                    map.insert(unsorted_values_.begin(), unsorted_values_.end());
+                }
+                checksum += map.size();
+                break;
+        }
+        sink = sink + checksum;
+        return ops;
+    }
+    const std::vector<key_type>& keys_;
+    std::vector<typename Map::value_type> sorted_values_;
+    std::vector<typename Map::value_type> unsorted_values_;
+    cache_miss_counter& counter_;
+    std::size_t min_ops_ = 1000000;
+};
+
+void print_header(bool has_misses) {
+    std::printf("%-16s %-16s %-12s %12s %-16s %12s %12s %12s\n", "container", "key", "order", "size", "op",
+                "ns/op", "bytes/elem", has_misses ? "misses/op" : "misses/op*");
+}
+
+void print_row(const std::string& container, const char* key, key_order order, std::size_t size,
+               const char* op, const bench_result& result, bool has_misses) {
+    std::printf("%-16s %-16s %-12s %12zu %-16s %12.2f %12.2f ", container.c_str(), key, to_string(order), size, op,
+                result.ns_per_op, result.bytes_per_element);
+    if (has_misses) {
+        std::printf("%12.3f\n", result.misses_per_op);
+    } else {
+        std::printf("%12s\n", "n/a");
+    }
+}
+
+template <class Map>
+void run_container(const std::string& name, const std::vector<typename Map::key_type>& keys,
+                   const bench_config& config, cache_miss_counter& counter) {
+    if (!bench_config::wants(config.containers, name)) {
+        return;
+    }
+    using key_type = typename Map::key_type;
+    map_benchmark<Map> benchmark(keys, counter);
+    benchmark.set_min_ops(config.min_ops);
+    for (key_order order : all_orders) {
+        if (!bench_config::wants(config.orders, to_string(order))) {
+            continue;
+        }
+        for (auto& [op, op_name] : all_operations) {
+            if (!bench_config::wants(config.ops, op_name)) {
+                continue;
+            }
+            bench_result result = benchmark.run(op, order);
+            print_row(name, key_maker<key_type>::name(), order, keys.size(), op_name, result, counter.available());
+            std::fflush(stdout);
+        }
+    }
+}
+
+// Orders keys as std::less does without being std::less, which keeps the
+// map on its generic path: the baseline of the branch-free descent for
+// trivial keys.
+template <class Key>
+struct opaque_less {
+    bool operator()(const Key& lhs, const Key& rhs) const {
+        return lhs < rhs;
+    }
+};
+
+template <class Key>
+void run_key(const bench_config& config, cache_miss_counter& counter) {
+    if (!bench_config::wants(config.keys, key_maker<Key>::name())) {
+        return;
+    }
+    using value_type = std::pair<const Key, int>;
+    using allocator = counting_allocator<value_type>;
+    for (std::size_t size : config.sizes) {
+        if (size > config.max_size) {
+            continue;
+        }
+        std::vector<Key> keys;
+        keys.reserve(size);
+        for (std::size_t i = 0; i < size; i++) {
+            keys.push_back(key_maker<Key>::make(static_cast<uint32_t>(i)));
+        }
+        run_container<polyndrom::acid_map<Key, int, std::less<Key>, allocator>>("acid_map", keys, config, counter);
+        if constexpr (std::is_arithmetic_v<Key>) {
+            run_container<polyndrom::acid_map<Key, int, opaque_less<Key>, allocator>>("acid_map+generic", keys, config,
+                                                                                     counter);
+        }
+        run_container<polyndrom::acid_map<Key, int, std::less<Key>, polyndrom::pool_allocator<value_type>>>(
+            "acid_map+pool", keys, config, counter);
+        run_container<polyndrom::acid_map<Key, int, std::less<Key>, allocator, polyndrom::wide_node_traits<32>>>(
+            "acid_map+wide", keys, config, counter);
+        run_container<std::map<Key, int, std::less<Key>, allocator>>("std::map", keys, config, counter);
+#ifdef ACID_MAP_BENCH_HAS_ABSL
+        run_container<absl::btree_map<Key, int, std::less<Key>, allocator>>("absl::btree_map", keys, config,
+                                                                            counter);
+#endif
+    }
+}
+
+enum class workload {
+    disjoint_insert,
+    read_mostly
+};
+
+const std::vector<std::pair<workload, const char*>> all_workloads = {
+    {workload::disjoint_insert, "disjoint_insert"},
+    {workload::read_mostly, "read_mostly"},
+};
+
+// An acid_map shared between threads, every call holds one lock.
+class locked_acid_map {
+public:
+    explicit locked_acid_map(std::size_t) {}
+    bool insert(int key, int value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return map_.emplace(key, value).second;
+    }
+    bool find(int key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return map_.find(key) != map_.end();
+    }
+    void assign(int key, int value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        map_[key] = value;
+    }
+private:
+    std::mutex mutex_;
+    polyndrom::acid_map<int, int> map_;
+};
+
+class shared_concurrent_map {
+public:
+    explicit shared_concurrent_map(std::size_t) {}
+    bool insert(int key, int value) {
+        return map_.emplace(key, value);
+    }
+    bool find(int key) {
+        return map_.contains(key);
+    }
+    void assign(int key, int value) {
+        map_.insert_or_assign(key, value);
+    }
+private:
+    polyndrom::concurrent_map<int, int> map_;
+};
+
+// Splits the key universe into 64 equal ranges up front.
+class range_sharded_map {
+public:
+    explicit range_sharded_map(std::size_t universe) : map_(boundaries(universe)) {}
+    bool insert(int key, int value) {
+        return map_.try_emplace(key, value);
+    }
+    bool find(int key) {
+        return map_.contains(key);
+    }
+    void assign(int key, int value) {
+        map_.insert_or_assign(key, value);
+    }
+private:
+    static std::vector<int> boundaries(std::size_t universe) {
+        std::vector<int> result;
+        for (std::size_t shard = 1; shard < 64; shard++) {
+            result.push_back(static_cast<int>(universe * shard / 64));
+        }
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+    polyndrom::sharded_acid_map<int, int> map_;
+};
+
+// Each thread inserts its own contiguous key range into an empty map, or
+// runs 90% finds and 10% assignments on random keys of a filled one.
+// Returns millions of operations per second over all threads.
+template <class Map>
+double run_scaling(workload kind, std::size_t thread_count, std::size_t total_ops) {
+    std::size_t per_thread = std::max<std::size_t>(1, total_ops / thread_count);
+    std::size_t universe = per_thread * thread_count;
+    Map map(universe);
+    if (kind == workload::read_mostly) {
+        for (uint32_t index : make_order(universe, key_order::random, 0)) {
+            map.insert(static_cast<int>(index), 0);
+        }
+    }
+    std::atomic<std::size_t> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < thread_count; t++) {
+        threads.emplace_back([&, t] {
+            std::mt19937_64 engine(t + 1);
+            std::size_t checksum = 0;
+            ready++;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (std::size_t i = 0; i < per_thread; i++) {
+                if (kind == workload::disjoint_insert) {
+                    checksum += map.insert(static_cast<int>(t * per_thread + i), static_cast<int>(i));
+                    continue;
+                }
+                int key = static_cast<int>(engine() % universe);
+                if (i % 10 == 0) {
+                    map.assign(key, static_cast<int>(i));
+                } else {
+                    checksum += map.find(key);
+                }
+            }
+            sink = sink + checksum;
+        });
+    }
+    while (ready.load() != thread_count) {
+        std::this_thread::yield();
+    }
+    stopwatch watch;
+    watch.start();
+    go.store(true, std::memory_order_release);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return static_cast<double>(universe) * 1e3 / watch.stop_ns();
+}
+
+template <class Map>
+void run_scaling_container(const std::string& name, const bench_config& config) {
+    if (!bench_config::wants(config.containers, name)) {
+        return;
+    }
+    for (auto& [kind, kind_name] : all_workloads) {
+        if (!bench_config::wants(config.ops, kind_name)) {
+            continue;
+        }
+        for (std::size_t thread_count : config.threads) {
+            double mops = run_scaling<Map>(kind, thread_count, config.min_ops);
+            std::printf("%-16s %-16s %8zu %12zu %12.2f\n", name.c_str(), kind_name, thread_count, config.min_ops,
+                        mops);
+            std::fflush(stdout);
+        }
+    }
+}
+
+void run_scaling_curve(const bench_config& config) {
+    std::printf("%-16s %-16s %8s %12s %12s\n", "container", "workload", "threads", "ops", "Mops/s");
+    run_scaling_container<locked_acid_map>("acid_map+mutex", config);
+    run_scaling_container<shared_concurrent_map>("concurrent_map", config);
+    run_scaling_container<range_sharded_map>("sharded_acid_map", config);
+}
+
+std::vector<std::string> split_list(const std::string& value) {
+    std::vector<std::string> result;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            result.push_back(item);
+        }
+    }
+    return result;
+}
+
+void print_usage(const char* program) {
+    std::printf("usage: %s [--sizes=N,...] [--max-size=N] [--min-ops=N] [--containers=NAME,...]\n"
+                "          [--keys=int,complex_object] [--orders=sequential,random,zipfian] [--ops=OP,...]\n"
+                "ops: find insert emplace try_emplace erase_key erase_iterator iterate iterate_reverse iterate_view clear bulk_build\n"
+                "     parallel_build find_batch\n"
+                "sizes above --max-size (default 1000000) are skipped\n"
+                "       %s --threads[=N,...] [--min-ops=N] [--containers=NAME,...] [--ops=WORKLOAD,...]\n"
+                "workloads: disjoint_insert read_mostly, threads default to 1,2,4,8,16,32,64\n", program, program);
+}
+
+bool parse_args(int argc, char** argv, bench_config& config) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto eq = arg.find('=');
+        std::string name = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (name == "--sizes") {
+            config.sizes.clear();
+            for (auto& item : split_list(value)) {
+                config.sizes.push_back(static_cast<std::size_t>(std::stod(item)));
+                config.max_size = std::max(config.max_size, config.sizes.back());
+            }
+        } else if (name == "--max-size") {
+            config.max_size = static_cast<std::size_t>(std::stod(value));
+        } else if (name == "--min-ops") {
+            config.min_ops = static_cast<std::size_t>(std::stod(value));
+        } else if (name == "--containers") {
+            config.containers = split_list(value);
+        } else if (name == "--keys") {
+            config.keys = split_list(value);
+        } else if (name == "--orders") {
+            config.orders = split_list(value);
+        } else if (name == "--ops") {
+            config.ops = split_list(value);
+        } else if (name == "--threads") {
+            config.threads = {1, 2, 4, 8, 16, 32, 64};
+            if (!value.empty()) {
+                config.threads.clear();
+                for (auto& item : split_list(value)) {
+                    config.threads.push_back(std::max<std::size_t>(1, std::stoul(item)));
+                }
+            }
+        } else {
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+} // bench
+
+int main(int argc, char** argv) {
+    bench::bench_config config;
+    if (!bench::parse_args(argc, argv, config)) {
+        return EXIT_FAILURE;
+    }
+    if (!config.threads.empty()) {
+        bench::run_scaling_curve(config);
+        return EXIT_SUCCESS;
+    }
+    bench::cache_miss_counter counter;
+    bench::print_header(counter.available());
+    bench::run_key<int>(config, counter);
+    bench::run_key<complex_object>(config, counter);
+    if (!counter.available()) {
+        std::printf("* cache-miss counters are unavailable (perf_event_open failed)\n");
+    }
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
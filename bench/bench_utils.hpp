@@ -0,0 +1,223 @@
+#pragma once
+
+#include "utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bench {
+
+inline std::size_t& live_bytes() {
+    static std::size_t bytes = 0;
+    return bytes;
+}
+
+template <class T>
+class counting_allocator {
+public:
+    using value_type = T;
+    counting_allocator() = default;
+    template <class U>
+    counting_allocator(const counting_allocator<U>&) {}
+    T* allocate(std::size_t n) {
+        live_bytes() += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* ptr, std::size_t n) {
+        live_bytes() -= n * sizeof(T);
+        std::allocator<T>().deallocate(ptr, n);
+    }
+    template <class U>
+    bool operator==(const counting_allocator<U>&) const {
+        return true;
+    }
+    template <class U>
+    bool operator!=(const counting_allocator<U>&) const {
+        return false;
+    }
+};
+
+class cache_miss_counter {
+public:
+    cache_miss_counter() {
+#ifdef __linux__
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+    cache_miss_counter(const cache_miss_counter&) = delete;
+    cache_miss_counter& operator=(const cache_miss_counter&) = delete;
+    ~cache_miss_counter() {
+#ifdef __linux__
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+#endif
+    }
+    bool available() const {
+        return fd_ >= 0;
+    }
+    void start() {
+#ifdef __linux__
+        if (fd_ >= 0) {
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+    uint64_t stop() {
+        uint64_t count = 0;
+#ifdef __linux__
+        if (fd_ >= 0) {
+            ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd_, &count, sizeof(count)) != sizeof(count)) {
+                count = 0;
+            }
+        }
+#endif
+        return count;
+    }
+private:
+    int fd_ = -1;
+};
+
+class stopwatch {
+public:
+    void start() {
+        start_ = std::chrono::steady_clock::now();
+    }
+    double stop_ns() const {
+        auto duration = std::chrono::steady_clock::now() - start_;
+        return std::chrono::duration<double, std::nano>(duration).count();
+    }
+private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Gray et al. "Quickly generating billion-record synthetic databases", the
+// same generator YCSB uses. Returns ranks in [0, n), rank 0 being the hottest.
+class zipfian_generator {
+public:
+    zipfian_generator(std::size_t n, double theta, uint64_t seed) : n_(n), theta_(theta), engine_(seed) {
+        zetan_ = zeta(n_, theta_);
+        double zeta2 = zeta(2, theta_);
+        alpha_ = 1.0 / (1.0 - theta_);
+        eta_ = (1.0 - std::pow(2.0 / static_cast<double>(n_), 1.0 - theta_)) / (1.0 - zeta2 / zetan_);
+    }
+    std::size_t next_value() {
+        double u = distribution_(engine_);
+        double uz = u * zetan_;
+        if (uz < 1.0) {
+            return 0;
+        }
+        if (uz < 1.0 + std::pow(0.5, theta_)) {
+            return n_ > 1 ? 1 : 0;
+        }
+        auto rank = static_cast<std::size_t>(static_cast<double>(n_) * std::pow(eta_ * u - eta_ + 1.0, alpha_));
+        return rank < n_ ? rank : n_ - 1;
+    }
+private:
+    static double zeta(std::size_t n, double theta) {
+        double sum = 0;
+        for (std::size_t i = 1; i <= n; i++) {
+            sum += 1.0 / std::pow(static_cast<double>(i), theta);
+        }
+        return sum;
+    }
+    std::size_t n_;
+    double theta_;
+    double zetan_;
+    double alpha_;
+    double eta_;
+    std::mt19937_64 engine_;
+    std::uniform_real_distribution<double> distribution_;
+};
+
+enum class key_order {
+    sequential,
+    random,
+    zipfian
+};
+
+inline const char* to_string(key_order order) {
+    switch (order) {
+        case key_order::sequential:
+            return "sequential";
+        case key_order::random:
+            return "random";
+        case key_order::zipfian:
+            return "zipfian";
+    }
+    return "unknown";
+}
+
+// Indices into the key universe [0, n) in the order the operations visit them.
+// Zipfian order draws with repetition, hot ranks are scattered over the universe.
+inline std::vector<uint32_t> make_order(std::size_t n, key_order order, uint64_t seed) {
+    std::vector<uint32_t> indices(n);
+    for (std::size_t i = 0; i < n; i++) {
+        indices[i] = static_cast<uint32_t>(i);
+    }
+    if (order == key_order::sequential) {
+        return indices;
+    }
+    std::mt19937_64 engine(seed);
+    std::shuffle(indices.begin(), indices.end(), engine);
+    if (order == key_order::random) {
+        return indices;
+    }
+    zipfian_generator generator(n, 0.99, seed + 1);
+    std::vector<uint32_t> draws(n);
+    for (std::size_t i = 0; i < n; i++) {
+        draws[i] = indices[generator.next_value()];
+    }
+    return draws;
+}
+
+template <class Key>
+struct key_maker;
+
+template <>
+struct key_maker<int> {
+    static const char* name() {
+        return "int";
+    }
+    static int make(uint32_t index) {
+        return static_cast<int>(index);
+    }
+};
+
+template <>
+struct key_maker<complex_object> {
+    static const char* name() {
+        return "complex_object";
+    }
+    static complex_object make(uint32_t index) {
+        std::string digits = std::to_string(index);
+        std::string str = "complex-object-key-" + std::string(12 - digits.size(), '0') + digits;
+        complex_object object(0, std::move(str));
+        object.clear_flags();
+        return object;
+    }
+};
+
+} // bench
\ No newline at end of file
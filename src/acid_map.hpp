@@ -2,23 +2,59 @@
 
 #include "map_node.hpp"
 #include "map_iterator.hpp"
+#include "key_compare.hpp"
+#include "map_traits.hpp"
+#include "map_stats.hpp"
+#include "node_handle.hpp"
+#include "background_reclaimer.hpp"
+#include "work_stealing_executor.hpp"
 
+#include <array>
+#include <atomic>
 #include <tuple>
+#include <utility>
 #include <ostream>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 namespace polyndrom {
 
-template <class Key, class T, class Compare = std::less<Key>, class Allocator = std::allocator<std::pair<const Key, T>>>
+template <class Alloc, class = void>
+struct allocator_has_reserve : std::false_type {};
+
+template <class Alloc>
+struct allocator_has_reserve<Alloc, std::void_t<decltype(std::declval<Alloc&>().reserve(std::size_t()))>>
+    : std::true_type {};
+
+// Tags a range whose keys are sorted by the map's comparator and unique.
+struct sorted_unique_t {
+    explicit sorted_unique_t() = default;
+};
+
+inline constexpr sorted_unique_t sorted_unique{};
+
+template <class Key, class T, class Compare = std::less<Key>>
+class mapped_acid_map;
+
+template <class Key, class T, class Compare = std::less<Key>, class Allocator = std::allocator<std::pair<const Key, T>>,
+          class Traits = default_map_traits>
 class acid_map {
 private:
-    friend map_iterator<acid_map<Key, T, Compare, Allocator>>;
-    template <class Map>
-    friend class map_iterator;
+    static_assert(!has_node_width<Traits>::value, "acid_map with wide_node_traits needs wide_node_map.hpp");
+    template <class Map, bool Const>
+    friend class ::map_iterator;
+    template <class Map, bool Const>
+    friend class ::map_cursor;
     template <class Tree>
     friend class tree_verifier;
-    using self_type = acid_map<Key, T, Compare, Allocator>;
-    using node_ptr = node_pointer<std::pair<const Key, T>, Allocator>;
+    friend map_node_handle<acid_map>;
+    using self_type = acid_map<Key, T, Compare, Allocator, Traits>;
+    using node_ptr = node_pointer<std::pair<const Key, T>, Allocator, Traits::order_statistics>;
+    using tree_node = typename node_ptr::node_type;
     using node_allocator_type = typename node_ptr::allocator_type;
 public:
     using key_type = Key;
@@ -28,30 +64,155 @@ public:
     using difference_type = std::ptrdiff_t;
     using key_compare = Compare;
     using allocator_type = Allocator;
+    using traits_type = Traits;
     using reference = value_type&;
     using const_reference = const value_type&;
     using pointer = typename std::allocator_traits<Allocator>::pointer;
     using const_pointer = typename std::allocator_traits<Allocator>::const_pointer;
     using iterator = map_iterator<self_type>;
+    using const_iterator = map_iterator<self_type, true>;
+    using reverse_iterator = map_reverse_iterator<iterator>;
+    using const_reverse_iterator = map_reverse_iterator<const_iterator>;
+    using cursor = map_cursor<self_type>;
+    using const_cursor = map_cursor<self_type, true>;
+    using node_type = map_node_handle<self_type>;
+    using insert_return_type = map_insert_return<iterator, node_type>;
+private:
+    using extracted_node = tree_node;
+    using extracted_allocator = node_allocator_type;
+    // Iterators go to the positional overloads of erase() and extract().
+    template <class K>
+    static constexpr bool is_position = std::is_convertible_v<const K&, const_iterator>;
+    struct retired_nodes {
+        tree_node* head = nullptr;
+        size_type count = 0;
+    };
+    struct no_retired_nodes {};
+    // Iterators reach the map through the owner of its tree, which swap()
+    // and moves hand over together with the tree, so that they keep
+    // stepping and unpinning through whichever map holds their element.
+    // Letting go of the last pin on an erased element frees it or queues it
+    // for reclaim(), so the owner also holds a copy of the allocator and the
+    // queue, which stay writable when the map itself is const. That release
+    // counts as a change to the map: it must not race with other users of
+    // it, while pins on linked elements never drop the last reference.
+    struct tree_owner {
+        acid_map* map;
+        node_allocator_type allocator;
+        std::conditional_t<Traits::deferred_reclamation, retired_nodes, no_retired_nodes> retired;
+    };
+    struct search_result {
+        tree_node* parent;
+        tree_node* node;
+        bool is_left;
+    };
+public:
     acid_map(const allocator_type& allocator = allocator_type()) : node_allocator(allocator) {}
+    template <class InputIt>
+    acid_map(InputIt first, InputIt last, const allocator_type& allocator = allocator_type())
+        : node_allocator(allocator) {
+        insert(first, last);
+    }
+    // Builds a perfectly balanced tree in linear time, allocating the nodes
+    // one after another in key order.
+    template <class InputIt>
+    acid_map(sorted_unique_t, InputIt first, InputIt last, const allocator_type& allocator = allocator_type())
+        : node_allocator(allocator) {
+        insert(sorted_unique, first, last);
+    }
+    // Copies the shape of the tree node by node in O(n) without comparing
+    // a single key.
+    acid_map(const acid_map& other)
+        : acid_map(other, std::allocator_traits<allocator_type>::select_on_container_copy_construction(
+                              other.get_allocator())) {}
+    acid_map(const acid_map& other, const allocator_type& allocator)
+        : map_size(other.map_size), comparator(other.comparator), node_allocator(allocator) {
+        root = clone(other.root);
+    }
+    // Takes the tree over in O(1). Iterators, end() included, follow the
+    // tree into this map; other is left without one until it gets elements
+    // again.
+    acid_map(acid_map&& other) noexcept
+        : root(std::exchange(other.root, nullptr)), map_size(std::exchange(other.map_size, 0)),
+          comparator(other.comparator), node_allocator(other.node_allocator), owner(std::move(other.owner)) {
+        if (owner != nullptr) {
+            owner->map = this;
+        }
+    }
+    acid_map& operator=(const acid_map& other) {
+        if (this != &other) {
+            using propagate = typename std::allocator_traits<allocator_type>::propagate_on_container_copy_assignment;
+            acid_map copy(other, propagate::value ? other.get_allocator() : get_allocator());
+            swap(copy);
+        }
+        return *this;
+    }
+    // Nodes only change hands when they can be freed through this map's
+    // allocator afterwards, otherwise the elements are moved one by one.
+    acid_map& operator=(acid_map&& other) noexcept(
+        std::allocator_traits<allocator_type>::propagate_on_container_move_assignment::value ||
+        std::allocator_traits<allocator_type>::is_always_equal::value) {
+        if (this == &other) {
+            return *this;
+        }
+        using propagate = typename std::allocator_traits<allocator_type>::propagate_on_container_move_assignment;
+        if (propagate::value || node_allocator == other.node_allocator) {
+            acid_map taken(std::move(other));
+            swap(taken);
+        } else {
+            clear();
+            comparator = other.comparator;
+            insert(sorted_unique, std::make_move_iterator(other.begin()), std::make_move_iterator(other.end()));
+            other.clear();
+        }
+        return *this;
+    }
+    // Swaps the trees together with the allocators that own their nodes and
+    // the owners their iterators go through.
+    void swap(acid_map& other) noexcept {
+        using std::swap;
+        swap(root, other.root);
+        swap(map_size, other.map_size);
+        swap(comparator, other.comparator);
+        swap(node_allocator, other.node_allocator);
+        swap(owner, other.owner);
+        for (acid_map* map : {this, &other}) {
+            if (map->owner != nullptr) {
+                map->owner->map = map;
+            }
+        }
+    }
     template <class K>
     iterator find(const K& key) {
-        auto [parent, node] = find_node(root, key);
-        if (node == nullptr) {
-            return end();
-        }
-        return iterator(node);
+        auto [parent, node, is_left] = find_node(root, key);
+        return make_iterator(node);
+    }
+    // The const overloads only read the tree. A const_iterator still pins
+    // its node, but atomically, so threads may look up and iterate a const
+    // map together as long as nobody modifies it meanwhile. Statistic traits
+    // count pins in plain counters and are for single-threaded use.
+    template <class K>
+    const_iterator find(const K& key) const {
+        auto [parent, node, is_left] = find_node(root, key);
+        return make_const_iterator(node);
     }
     template <typename K>
     mapped_type& operator[](K&& key) {
         return try_emplace(std::forward<K>(key)).first->second;
     }
     mapped_type& at(const key_type& key) {
-        auto [parent, node] = find_node(root, key);
-        if (node == nullptr) {
-            throw std::out_of_range("Key does not exists");
-        }
-        return node->value.second;
+        return at_node(key)->value.second;
+    }
+    const mapped_type& at(const key_type& key) const {
+        return at_node(key)->value.second;
+    }
+    template <class K, class = std::enable_if_t<is_lookup_key<Compare, Key, K>>>
+    mapped_type& at(const K& key) {
+        return at_node(key)->value.second;
+    }
+    template <class K, class = std::enable_if_t<is_lookup_key<Compare, Key, K>>>
+    const mapped_type& at(const K& key) const {
+        return at_node(key)->value.second;
     }
     template <class K>
     bool contains(const K& key) const {
@@ -59,63 +220,318 @@ public:
     }
     template <class K>
     size_type count(const K& key) const {
-        auto [parent, node] = find_node(root, key);
+        auto [parent, node, is_left] = find_node(root, key);
         return static_cast<size_type>(node != nullptr);
     }
+    template <class K>
+    iterator lower_bound(const K& key) {
+        return make_iterator(lower_bound_node(key));
+    }
+    template <class K>
+    const_iterator lower_bound(const K& key) const {
+        return make_const_iterator(lower_bound_node(key));
+    }
+    template <class K>
+    iterator upper_bound(const K& key) {
+        return make_iterator(upper_bound_node(key));
+    }
+    template <class K>
+    const_iterator upper_bound(const K& key) const {
+        return make_const_iterator(upper_bound_node(key));
+    }
+    template <class K>
+    std::pair<iterator, iterator> equal_range(const K& key) {
+        auto [first, last] = equal_range_nodes(key);
+        return std::make_pair(make_iterator(first), make_iterator(last));
+    }
+    template <class K>
+    std::pair<const_iterator, const_iterator> equal_range(const K& key) const {
+        auto [first, last] = equal_range_nodes(key);
+        return std::make_pair(make_const_iterator(first), make_const_iterator(last));
+    }
+    // The k-th element in key order, end() if k >= size(). Needs traits with
+    // order_statistics, as does rank().
+    iterator nth(size_type k) {
+        static_assert(Traits::order_statistics, "nth() requires order_statistic_traits");
+        return make_iterator(tree_node::select(root, k));
+    }
+    const_iterator nth(size_type k) const {
+        static_assert(Traits::order_statistics, "nth() requires order_statistic_traits");
+        return make_const_iterator(tree_node::select(root, k));
+    }
+    // Number of elements with a key less than the given one.
+    template <class K>
+    size_type rank(const K& requested) const {
+        static_assert(Traits::order_statistics, "rank() requires order_statistic_traits");
+        const auto& key = lookup_key(requested);
+        size_type index = 0;
+        for (tree_node* node = root; node != nullptr;) {
+            if (is_less(node->key(), key)) {
+                index += tree_node::size(node->left) + 1;
+                node = node->right;
+            } else {
+                node = node->left;
+            }
+        }
+        return index;
+    }
+    // Writes find(key) for every key of [first, last) to out, in order. Up to
+    // batch_lanes descents run interleaved, one level at a time, and every
+    // step prefetches the child it moves to, so the cache misses of different
+    // keys overlap instead of following one another.
+    template <class ForwardIt, class OutputIt>
+    OutputIt find_batch(ForwardIt first, ForwardIt last, OutputIt out) {
+        descend_batch(first, last, [&](tree_node* node) {
+            *out++ = make_iterator(node);
+        });
+        return out;
+    }
+    template <class ForwardIt, class OutputIt>
+    OutputIt find_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+        descend_batch(first, last, [&](tree_node* node) {
+            *out++ = make_const_iterator(node);
+        });
+        return out;
+    }
+    // Same as find_batch, writing contains(key) without pinning anything.
+    template <class ForwardIt, class OutputIt>
+    OutputIt contains_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+        descend_batch(first, last, [&](tree_node* node) {
+            *out++ = node != nullptr;
+        });
+        return out;
+    }
+    // Calls fn on every element with a key in [from, to) in order. The walk
+    // does a single descent and follows raw links without pinning, so fn
+    // must not insert or erase elements of this map.
+    template <class K1, class K2, class Fn>
+    void for_each_in_range(const K1& from, const K2& requested_to, Fn fn) {
+        const auto& to = lookup_key(requested_to);
+        for (tree_node* node = lower_bound_node(from); node != nullptr && is_less(node->key(), to);
+             node = node->next()) {
+            fn(node->value);
+        }
+    }
+    template <class K1, class K2, class Fn>
+    void for_each_in_range(const K1& from, const K2& requested_to, Fn fn) const {
+        const auto& to = lookup_key(requested_to);
+        for (tree_node* node = lower_bound_node(from); node != nullptr && is_less(node->key(), to);
+             node = node->next()) {
+            fn(std::as_const(node->value));
+        }
+    }
     template <class V>
     std::pair<iterator, bool> insert(V&& value) {
-        const key_type& key = value.first;
-        auto [parent, existing_node] = find_node(root, key);
+        auto [parent, existing_node, is_left] = find_node(root, value.first);
         if (existing_node != nullptr) {
-            return std::make_pair(iterator(existing_node), false);
+            return std::make_pair(make_iterator(existing_node), false);
         }
-        node_ptr node = node_ptr(node_allocator, std::forward<V>(value));
-        insert_node(parent, node);
-        return std::make_pair(iterator(node), true);
+        tree_node* node = create_node(std::forward<V>(value));
+        insert_node(parent, is_left, node);
+        return std::make_pair(make_iterator(node), true);
     }
     template <class ...Args>
     std::pair<iterator, bool> emplace(Args&& ...args) {
-        node_ptr node(node_allocator, std::forward<Args>(args)...);
-        auto [parent, existing_node] = find_node(root, node->key());
+        tree_node* node = create_node(std::forward<Args>(args)...);
+        auto [parent, existing_node, is_left] = find_node(root, node->key());
         if (existing_node != nullptr) {
-            return std::make_pair(iterator(existing_node), false);
+            node_ptr::destroy(node, node_allocator);
+            return std::make_pair(make_iterator(existing_node), false);
         }
-        insert_node(parent, node);
-        return std::make_pair(iterator(node), true);
+        insert_node(parent, is_left, node);
+        return std::make_pair(make_iterator(node), true);
     }
     template <class K, class ...Args>
     std::pair<iterator, bool> try_emplace(K&& key, Args&& ...args) {
-        auto [parent, existing_node] = find_node(root, key);
+        if constexpr (!is_lookup_key<Compare, Key, std::decay_t<K>>) {
+            return try_emplace(key_type(std::forward<K>(key)), std::forward<Args>(args)...);
+        } else {
+            auto [parent, existing_node, is_left] = find_node(root, key);
+            if (existing_node != nullptr) {
+                return std::make_pair(make_iterator(existing_node), false);
+            }
+            tree_node* node = create_node(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+                                          std::forward_as_tuple(std::forward<Args>(args)...));
+            insert_node(parent, is_left, node);
+            return std::make_pair(make_iterator(node), true);
+        }
+    }
+    // The hinted overloads take the position just after the new element, or
+    // any neighbouring one, and only compare against the hint and its
+    // neighbour when it is right. A hint at an erased element is moved to
+    // its nearest live ancestor; a wrong hint costs a regular descent.
+    template <class V, class = std::enable_if_t<std::is_constructible_v<value_type, V&&>>>
+    iterator insert(const_iterator hint, V&& value) {
+        auto [parent, existing_node, is_left] = find_hinted(hint.node, value.first);
+        if (existing_node != nullptr) {
+            return make_iterator(existing_node);
+        }
+        tree_node* node = create_node(std::forward<V>(value));
+        insert_node(parent, is_left, node);
+        return make_iterator(node);
+    }
+    template <class ...Args>
+    iterator emplace_hint(const_iterator hint, Args&& ...args) {
+        tree_node* node = create_node(std::forward<Args>(args)...);
+        auto [parent, existing_node, is_left] = find_hinted(hint.node, node->key());
         if (existing_node != nullptr) {
-            return std::make_pair(iterator(existing_node), false);
+            node_ptr::destroy(node, node_allocator);
+            return make_iterator(existing_node);
+        }
+        insert_node(parent, is_left, node);
+        return make_iterator(node);
+    }
+    template <class InputIt>
+    void insert(InputIt first, InputIt last) {
+        for (; first != last; ++first) {
+            emplace(*first);
+        }
+    }
+    // Inserts a range sorted by key_compare without duplicate keys. An empty
+    // map is built directly in O(n); otherwise the existing nodes are merged
+    // with the new ones and relinked in O(n + m), unless the range is small
+    // enough for plain insertions to be cheaper. Keys already present keep
+    // their element, and existing nodes and iterators stay valid.
+    template <class InputIt>
+    void insert(sorted_unique_t, InputIt first, InputIt last) {
+        constexpr bool is_forward = std::is_base_of_v<std::forward_iterator_tag,
+            typename std::iterator_traits<InputIt>::iterator_category>;
+        if constexpr (is_forward) {
+            size_type count = static_cast<size_type>(std::distance(first, last));
+            if (root == nullptr) {
+                reserve(count);
+                auto next_node = [&] {
+                    tree_node* node = create_node(*first);
+                    node->ref_count.store(1, std::memory_order_relaxed);
+                    ++first;
+                    return node;
+                };
+                root = build_balanced(count, next_node);
+                map_size = count;
+                return;
+            }
+            if (count * static_cast<size_type>(root->height) >= map_size + count) {
+                merge_sorted(first, last, count);
+                return;
+            }
         }
-        node_ptr node = node_ptr(node_allocator, std::piecewise_construct,
-                                                 std::forward_as_tuple(std::forward<K>(key)),
-                                                 std::forward_as_tuple(std::forward<Args>(args)...));
-        insert_node(parent, node);
-        return std::make_pair(iterator(node), true);
+        insert(first, last);
     }
     size_type erase(const key_type& key) {
-        auto [parent, node] = find_node(root, key);
-        if (node == nullptr) {
-            return 0;
+        return erase_key(key);
+    }
+    template <class K, class = std::enable_if_t<is_lookup_key<Compare, Key, K> && !is_position<K>>>
+    size_type erase(const K& key) {
+        return erase_key(key);
+    }
+    // An element that is already erased is left alone, and the result is
+    // where incrementing pos would lead.
+    iterator erase(const_iterator pos) {
+        if (pos.node->is_deleted) {
+            return make_iterator(pos.node->is_detached ? nullptr : live_neighbour<true>(pos.node->key()));
         }
-        erase_node(node);
-        return 1;
+        tree_node* next = pos.node->next();
+        erase_node(pos.node);
+        return make_iterator(next);
     }
     iterator erase(iterator pos) {
-        node_ptr next = pos.node.next();
-        erase_node(pos.node);
-        return iterator(next);
+        return erase(const_iterator(pos));
     }
-    iterator begin() {
-        if (root == nullptr) {
+    // Unlinks the element and hands the node itself over, without moving or
+    // copying the value. Iterators on other elements stay valid, ones that
+    // still pin this element see it as erased.
+    node_type extract(const_iterator pos) {
+        if (pos.node->is_deleted) {
+            return node_type();
+        }
+        return extract_node(pos.node);
+    }
+    node_type extract(const key_type& key) {
+        return extract_key(key);
+    }
+    template <class K, class = std::enable_if_t<is_lookup_key<Compare, Key, K> && !is_position<K>>>
+    node_type extract(const K& key) {
+        return extract_key(key);
+    }
+    // Links the extracted node back in, unless the key is taken, in which
+    // case the handle is returned untouched. A node from a map with an
+    // unequal allocator cannot be freed through this one and has its value
+    // moved into a new node instead.
+    insert_return_type insert(node_type&& handle) {
+        if (handle.empty()) {
+            return {end(), false, node_type()};
+        }
+        auto [parent, existing_node, is_left] = find_node(root, handle.key());
+        if (existing_node != nullptr) {
+            return {make_iterator(existing_node), false, std::move(handle)};
+        }
+        return {make_iterator(link_extracted(parent, is_left, handle)), true, node_type()};
+    }
+    iterator insert(const_iterator hint, node_type&& handle) {
+        if (handle.empty()) {
             return end();
         }
-        return iterator(root.min());
+        auto [parent, existing_node, is_left] = find_hinted(hint.node, handle.key());
+        if (existing_node != nullptr) {
+            return make_iterator(existing_node);
+        }
+        return make_iterator(link_extracted(parent, is_left, handle));
+    }
+    iterator begin() {
+        return make_iterator(first_node());
+    }
+    const_iterator begin() const {
+        return make_const_iterator(first_node());
+    }
+    const_iterator cbegin() const {
+        return begin();
     }
     iterator end() {
-        return iterator();
+        return make_iterator(nullptr);
+    }
+    const_iterator end() const {
+        return make_const_iterator(nullptr);
+    }
+    const_iterator cend() const {
+        return end();
+    }
+    reverse_iterator rbegin() {
+        return reverse_iterator(end());
+    }
+    const_reverse_iterator rbegin() const {
+        return const_reverse_iterator(end());
+    }
+    const_reverse_iterator crbegin() const {
+        return rbegin();
+    }
+    reverse_iterator rend() {
+        return reverse_iterator(begin());
+    }
+    const_reverse_iterator rend() const {
+        return const_reverse_iterator(begin());
+    }
+    const_reverse_iterator crend() const {
+        return rend();
+    }
+    // Cursors for scans during which nothing erases from the map, see
+    // map_cursor.
+    cursor begin_cursor() {
+        return cursor(first_node(), owner.get());
+    }
+    const_cursor begin_cursor() const {
+        return const_cursor(first_node(), owner.get());
+    }
+    cursor end_cursor() {
+        return cursor(nullptr, owner.get());
+    }
+    const_cursor end_cursor() const {
+        return const_cursor(nullptr, owner.get());
+    }
+    map_cursor_range<cursor> view() {
+        return {begin_cursor(), end_cursor()};
+    }
+    map_cursor_range<const_cursor> view() const {
+        return {begin_cursor(), end_cursor()};
     }
     size_type size() const {
         return map_size;
@@ -123,60 +539,682 @@ public:
     bool empty() const {
         return map_size == 0;
     }
+    allocator_type get_allocator() const {
+        return allocator_type(node_allocator);
+    }
+    // Lets an allocator that supports it, such as pool_allocator, prepare
+    // memory for n elements up front. A no-op for other allocators.
+    void reserve(size_type n) {
+        if constexpr (allocator_has_reserve<node_allocator_type>::value) {
+            if (n > map_size) {
+                node_allocator.reserve(n - map_size);
+            }
+        }
+    }
     void clear() {
-        auto it1 = begin();
-        while (it1 != end()) {
-            auto it2 = it1++;
-            erase(it2);
+        teardown(std::exchange(root, nullptr), node_allocator);
+        map_size = 0;
+        reclaim_some();
+    }
+    // Frees up to budget queued nodes with deferred_reclamation traits and
+    // returns how many it freed. A freed node may queue its erased parent,
+    // which counts against the budget when it gets its turn.
+    size_type reclaim(size_type budget = std::numeric_limits<size_type>::max()) {
+        size_type freed = 0;
+        if constexpr (Traits::deferred_reclamation) {
+            for (; owner != nullptr && freed < budget && owner->retired.head != nullptr; freed++) {
+                tree_node* node = std::exchange(owner->retired.head, owner->retired.head->left);
+                owner->retired.count--;
+                tree_node* parent = node->parent;
+                node_ptr::destroy(node, node_allocator);
+                if (parent != nullptr && parent->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    retire(*owner, parent);
+                }
+            }
+        }
+        return freed;
+    }
+    // Writes the elements to a file that open_mmap() maps back in without
+    // building a tree, see mapped_map.hpp, which has to be included to use
+    // them.
+    template <class Mapped = mapped_acid_map<Key, T, Compare>>
+    void save(const std::string& path) const {
+        Mapped::save(*this, path);
+    }
+    template <class Mapped = mapped_acid_map<Key, T, Compare>>
+    static Mapped open_mmap(const std::string& path, bool copy_on_write = false) {
+        return Mapped(path, copy_on_write);
+    }
+    map_stats stats() const {
+        map_stats result;
+        if constexpr (Traits::statistics) {
+            result = counters;
+        }
+        result.pending_reclamation = pending_reclamation();
+        return result;
+    }
+    // Pinned iterators are a gauge and survive the reset.
+    void reset_stats() {
+        if constexpr (Traits::statistics) {
+            uint64_t pinned = counters.pinned_iterators;
+            counters = map_stats();
+            counters.pinned_iterators = pinned;
+        }
+    }
+    // Walks the whole tree, with or without statistic traits.
+    map_shape inspect() const {
+        map_shape shape;
+        std::vector<std::pair<tree_node*, size_type>> pending;
+        if (root != nullptr) {
+            pending.emplace_back(root, 0);
+        }
+        while (!pending.empty()) {
+            auto [node, depth] = pending.back();
+            pending.pop_back();
+            if (shape.depth_histogram.size() <= depth) {
+                shape.depth_histogram.resize(depth + 1);
+            }
+            shape.depth_histogram[depth]++;
+            if (node->left != nullptr) {
+                pending.emplace_back(node->left, depth + 1);
+            }
+            if (node->right != nullptr) {
+                pending.emplace_back(node->right, depth + 1);
+            }
+        }
+        shape.height = shape.depth_histogram.size();
+        return shape;
+    }
+    // Nodes queued for reclaim(), always zero without deferred_reclamation.
+    size_type pending_reclamation() const {
+        if constexpr (Traits::deferred_reclamation) {
+            return owner == nullptr ? 0 : owner->retired.count;
+        } else {
+            return 0;
+        }
+    }
+    // Detaches all elements in O(1) and frees them on the reclaimer's thread.
+    // No iterator into the map may be alive, and the allocator must be safe
+    // to use from the reclaimer's thread.
+    void clear(background_reclaimer& reclaimer) {
+        tree_node* detached = std::exchange(root, nullptr);
+        map_size = 0;
+        if (detached != nullptr) {
+            reclaimer.submit([detached, allocator = node_allocator]() mutable {
+                teardown(detached, allocator);
+            });
+        }
+    }
+    // Moves the elements with keys not less than key into the returned map,
+    // which shares this map's allocator. The tree is cut along one path and
+    // rejoined in O(log n). With order statistics the new sizes are known
+    // right away; otherwise they cost a walk over the smaller of the halves.
+    // Iterators stay on their elements, but like those on elements moved by
+    // join() and merge() they keep unpinning, through an equal allocator,
+    // and stepping off erased elements in the map they were created on,
+    // which therefore has to outlive them.
+    template <class K>
+    acid_map split(const K& key) {
+        acid_map upper(get_allocator());
+        upper.comparator = comparator;
+        auto [less, rest] = split_tree(root, lookup_key(key));
+        root = less;
+        upper.root = rest;
+        size_type upper_size = 0;
+        if constexpr (Traits::order_statistics) {
+            upper_size = tree_node::size(rest);
+        } else {
+            tree_node* lower_node = first_node();
+            tree_node* upper_node = upper.first_node();
+            size_type steps = 0;
+            for (; lower_node != nullptr && upper_node != nullptr; steps++) {
+                lower_node = lower_node->next();
+                upper_node = upper_node->next();
+            }
+            upper_size = upper_node == nullptr ? steps : map_size - steps;
+        }
+        upper.map_size = upper_size;
+        map_size -= upper_size;
+        return upper;
+    }
+    // Takes over all elements of other, whose keys must all be less or all be
+    // greater than the keys of this map, in O(log n). Throws
+    // std::invalid_argument if the key ranges overlap. Maps with unequal
+    // allocators cannot share nodes and move the elements one by one.
+    void join(acid_map& other) {
+        if (this == &other || other.root == nullptr) {
+            return;
+        }
+        if (root != nullptr && !before(*this, other) && !before(other, *this)) {
+            throw std::invalid_argument("Key ranges of joined maps overlap");
+        }
+        if (!(node_allocator == other.node_allocator)) {
+            take_elements(other);
+            return;
         }
-        root = nullptr;
+        if (root == nullptr) {
+            swap(other);
+            return;
+        }
+        if (before(*this, other)) {
+            tree_node* middle = detach_min(other.root);
+            root = join_trees(root, middle, other.root);
+        } else {
+            tree_node* middle = detach_min(root);
+            root = join_trees(other.root, middle, root);
+        }
+        map_size += std::exchange(other.map_size, 0);
+        other.root = nullptr;
+    }
+    // Moves the elements of other whose keys are not in this map yet, as
+    // std::map::merge does, leaving the others in other. Disjoint key ranges
+    // are joined in O(log n). Otherwise both trees are rebuilt from their
+    // existing nodes in O(n + m) without allocating a node.
+    void merge(acid_map& other) {
+        if (this == &other || other.root == nullptr) {
+            return;
+        }
+        if (root == nullptr || before(*this, other) || before(other, *this)) {
+            join(other);
+            return;
+        }
+        if (!(node_allocator == other.node_allocator)) {
+            take_elements(other);
+            return;
+        }
+        std::vector<tree_node*> merged;
+        std::vector<tree_node*> kept;
+        merged.reserve(map_size + other.map_size);
+        tree_node* node = first_node();
+        tree_node* other_node = other.first_node();
+        while (node != nullptr && other_node != nullptr) {
+            if (is_less(node->key(), other_node->key())) {
+                merged.push_back(node);
+                node = node->next();
+            } else if (is_less(other_node->key(), node->key())) {
+                merged.push_back(other_node);
+                other_node = other_node->next();
+            } else {
+                merged.push_back(node);
+                kept.push_back(other_node);
+                node = node->next();
+                other_node = other_node->next();
+            }
+        }
+        for (; node != nullptr; node = node->next()) {
+            merged.push_back(node);
+        }
+        for (; other_node != nullptr; other_node = other_node->next()) {
+            merged.push_back(other_node);
+        }
+        root = rebuild(merged);
+        map_size = merged.size();
+        other.root = other.rebuild(kept);
+        other.map_size = kept.size();
+    }
+    // The parallel operations below run through an executor such as
+    // work_stealing_executor, see work_stealing_executor.hpp, and split the
+    // work along subtrees. Besides the executor's threads they only touch the
+    // maps they are called on, which nothing else may use in the meantime.
+
+    // Calls fn on every element, on the subtrees of the map in parallel.
+    // Elements are visited in no particular order, so fn has to be safe to
+    // call concurrently on different elements.
+    template <class Executor, class Fn>
+    void parallel_for_each(Executor& executor, Fn fn) {
+        static_assert(!Traits::statistics, "parallel operations need a map without statistics");
+        visit_parallel(executor, root, fn);
+    }
+    template <class Executor, class Fn>
+    void parallel_for_each(Executor& executor, Fn fn) const {
+        static_assert(!Traits::statistics, "parallel operations need a map without statistics");
+        auto visit = [&fn](value_type& value) {
+            fn(static_cast<const value_type&>(value));
+        };
+        visit_parallel(executor, root, visit);
+    }
+    // Inserts an unsorted range as insert(first, last) does, the first of
+    // equal keys winning and keys already present keeping their element. The
+    // range is sorted in parallel, the nodes are allocated one by one, as the
+    // allocator need not be thread-safe, but constructed in parallel, and the
+    // balanced tree is linked subtree by subtree. A non-empty map is merged
+    // with the map built from the range.
+    template <class Executor, class ForwardIt>
+    void parallel_insert(Executor& executor, ForwardIt first, ForwardIt last) {
+        static_assert(!Traits::statistics, "parallel operations need a map without statistics");
+        if (root != nullptr) {
+            acid_map built(get_allocator());
+            built.comparator = comparator;
+            built.parallel_insert(executor, first, last);
+            parallel_merge(executor, built);
+            return;
+        }
+        std::vector<ForwardIt> sources;
+        for (; first != last; ++first) {
+            sources.push_back(first);
+        }
+        parallel_stable_sort(executor, sources, [this](const ForwardIt& lhs, const ForwardIt& rhs) {
+            return is_less((*lhs).first, (*rhs).first);
+        });
+        sources.erase(std::unique(sources.begin(), sources.end(), [this](const ForwardIt& lhs, const ForwardIt& rhs) {
+            return !is_less((*lhs).first, (*rhs).first);
+        }), sources.end());
+        size_type count = sources.size();
+        reserve(count);
+        ensure_owner();
+        std::vector<tree_node*> nodes;
+        nodes.reserve(count);
+        std::vector<char> constructed(count, false);
+        try {
+            for (size_type i = 0; i < count; i++) {
+                nodes.push_back(std::allocator_traits<node_allocator_type>::allocate(node_allocator, 1));
+            }
+            auto construct = [&](size_type from, size_type to) {
+                for (size_type i = from; i < to; i++) {
+                    std::allocator_traits<node_allocator_type>::construct(node_allocator, nodes[i], *sources[i]);
+                    nodes[i]->ref_count.store(1, std::memory_order_relaxed);
+                    constructed[i] = true;
+                }
+            };
+            for_each_chunk(executor, 0, count, construct);
+        } catch (...) {
+            for (size_type i = 0; i < nodes.size(); i++) {
+                if (constructed[i]) {
+                    std::allocator_traits<node_allocator_type>::destroy(node_allocator, nodes[i]);
+                }
+                std::allocator_traits<node_allocator_type>::deallocate(node_allocator, nodes[i], 1);
+            }
+            throw;
+        }
+        root = link_parallel(executor, nodes.data(), count);
+        map_size = count;
+    }
+    // merge() on the subtrees in parallel: the root of this tree splits the
+    // other one, both sides are merged independently and joined back around
+    // the root, in O(m log(n / m + 1)) for m elements in the smaller map.
+    // Elements whose keys are in both maps stay in other. No node is
+    // allocated and iterators stay on their elements, except with unequal
+    // allocators, which move the elements one by one as merge() does.
+    template <class Executor>
+    void parallel_merge(Executor& executor, acid_map& other) {
+        static_assert(!Traits::statistics, "parallel operations need a map without statistics");
+        if (this == &other || other.root == nullptr) {
+            return;
+        }
+        if (root == nullptr || before(*this, other) || before(other, *this)) {
+            join(other);
+            return;
+        }
+        if (!(node_allocator == other.node_allocator)) {
+            take_elements(other);
+            return;
+        }
+        merged_trees result = merge_trees(executor, root, other.root);
+        root = result.merged;
+        map_size += other.map_size - result.kept_count;
+        other.root = result.kept;
+        other.map_size = result.kept_count;
     }
     ~acid_map() {
-        root.force_destroy();
+        teardown(root, node_allocator);
+        reclaim();
     }
 private:
+    iterator make_iterator(tree_node* node) {
+        return iterator(node, owner.get());
+    }
+    const_iterator make_const_iterator(tree_node* node) const {
+        return const_iterator(node, owner.get());
+    }
+    // A map only lacks an owner after being moved from, and then it has no
+    // elements either; it needs one again before taking any.
+    void ensure_owner() {
+        if (owner == nullptr) {
+            owner.reset(new tree_owner{this, node_allocator});
+        }
+    }
+    // Pins change reference counts only, never what the map holds, so const
+    // iterators release them as well. The counts are atomic so that threads
+    // may look up and iterate one const map together: a linked node never
+    // loses its last reference to a reader.
+    void pin(tree_node* node) const {
+        node->ref_count.fetch_add(1, std::memory_order_relaxed);
+        record(&map_stats::pinned_iterators);
+    }
+    void unpin(tree_node* node) const {
+        if constexpr (Traits::statistics) {
+            counters.pinned_iterators--;
+        }
+        drop(*owner, node);
+    }
+    void record([[maybe_unused]] uint64_t map_stats::*counter, [[maybe_unused]] uint64_t amount = 1) const {
+        if constexpr (Traits::statistics) {
+            counters.*counter += amount;
+        }
+    }
+    template <class... Args>
+    tree_node* create_node(Args&&... args) {
+        ensure_owner();
+        record(&map_stats::allocations);
+        return node_ptr::create(node_allocator, std::forward<Args>(args)...);
+    }
+    static void drop(tree_owner& owner, tree_node* node) {
+        if constexpr (Traits::deferred_reclamation) {
+            if (node->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                retire(owner, node);
+            }
+        } else {
+            node_ptr::release(node, owner.allocator);
+        }
+    }
+    // Only unreferenced erased nodes are queued, and those have no children,
+    // so the left link chains the queue and the parent link stays in place
+    // for the reference the node holds on it.
+    static void retire(tree_owner& owner, tree_node* node) {
+        node->left = owner.retired.head;
+        owner.retired.head = node;
+        owner.retired.count++;
+    }
+    void reclaim_some() {
+        if constexpr (Traits::deferred_reclamation) {
+            reclaim(Traits::reclaim_batch);
+        }
+    }
+    // The key as the comparisons of a lookup take it, see is_lookup_key.
     template <class K>
-    std::pair<node_ptr, node_ptr> find_node(node_ptr where, const K& key) const {
-        node_ptr parent = nullptr;
-        node_ptr node = where;
-        while (true) {
-            if (node == nullptr) {
-                return std::make_pair(parent, node);
+    static decltype(auto) lookup_key(const K& key) {
+        if constexpr (is_lookup_key<Compare, Key, K>) {
+            return (key);
+        } else {
+            return key_type(key);
+        }
+    }
+    template <class K>
+    size_type erase_key(const K& key) {
+        auto [parent, node, is_left] = find_node(root, key);
+        if (node == nullptr) {
+            return 0;
+        }
+        erase_node(node);
+        return 1;
+    }
+    template <class K>
+    node_type extract_key(const K& key) {
+        auto [parent, node, is_left] = find_node(root, key);
+        if (node == nullptr) {
+            return node_type();
+        }
+        return extract_node(node);
+    }
+    template <class K>
+    tree_node* at_node(const K& key) const {
+        auto [parent, node, is_left] = find_node(root, key);
+        if (node == nullptr) {
+            throw std::out_of_range("Key does not exists");
+        }
+        return node;
+    }
+    template <class K>
+    std::pair<tree_node*, tree_node*> equal_range_nodes(const K& requested) const {
+        const auto& key = lookup_key(requested);
+        tree_node* first = lower_bound_node(key);
+        tree_node* last = first;
+        if (last != nullptr && !is_less(key, last->key())) {
+            last = last->next();
+        }
+        return {first, last};
+    }
+    tree_node* first_node() const {
+        return root == nullptr ? nullptr : root->min();
+    }
+    tree_node* last_node() const {
+        return root == nullptr ? nullptr : root->max();
+    }
+    // The linked node right after or right before the key.
+    template <bool Forward, class K>
+    tree_node* live_neighbour(const K& key) const {
+        if constexpr (Forward) {
+            return upper_bound_node(key);
+        } else {
+            tree_node* next = lower_bound_node(key);
+            return next == nullptr ? last_node() : next->prev();
+        }
+    }
+    // Descends with a single comparison per level. With a three-way comparator
+    // the search stops at the first equal key, otherwise equality is checked
+    // once against the last node whose key was not less than the searched one.
+    template <class K>
+    search_result find_node(tree_node* where, const K& requested) const {
+        const auto& key = lookup_key(requested);
+        tree_node* parent = nullptr;
+        tree_node* node = where;
+        bool is_left = false;
+        record(&map_stats::lookups);
+        if constexpr (use_three_way_compare<Compare, Key, std::decay_t<decltype(key)>>) {
+            while (node != nullptr) {
+                record(&map_stats::comparisons);
+                int order = three_way_compare(node->key(), key);
+                if (order == 0) {
+                    return {parent, node, is_left};
+                }
+                parent = node;
+                is_left = order > 0;
+                node = is_left ? node->left : node->right;
             }
-            if (is_equal(node->key(), key)) {
-                return std::make_pair(parent, node);
+            return {parent, node, is_left};
+        } else {
+            constexpr bool branchless = is_trivial_key<Compare, Key, std::decay_t<decltype(key)>>;
+            tree_node* candidate = nullptr;
+            while (node != nullptr) {
+                parent = node;
+                is_left = !is_less(node->key(), key);
+                candidate = pick<branchless>(is_left, node, candidate);
+                node = pick<branchless>(is_left, node->left, node->right);
             }
-            parent = node;
-            if (is_less(key, node->key())) {
-                node = node->left;
-            } else {
-                node = node->right;
+            if (candidate != nullptr && !is_less(key, candidate->key())) {
+                return {parent, candidate, is_left};
             }
+            return {parent, node, is_left};
         }
     }
-    void insert_node(node_ptr where, node_ptr node) {
-        ++map_size;
-        if (root == nullptr) {
-            root = node;
-            return;
+    // Chooses between two nodes during a descent. For trivial keys the
+    // choice is made by masking, so that the only branch left per level is
+    // the end of the descent; a comparison of random keys mispredicts half
+    // of the time and costs more than the masking.
+    template <bool Branchless>
+    static tree_node* pick(bool condition, tree_node* if_true, tree_node* if_false) {
+        if constexpr (Branchless) {
+            auto mask = std::uintptr_t(0) - static_cast<std::uintptr_t>(condition);
+            return reinterpret_cast<tree_node*>((reinterpret_cast<std::uintptr_t>(if_true) & mask) |
+                                                (reinterpret_cast<std::uintptr_t>(if_false) & ~mask));
+        } else {
+            return condition ? if_true : if_false;
+        }
+    }
+    static constexpr std::size_t batch_lanes = 16;
+    static void prefetch(const tree_node* node) {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(node);
+        __builtin_prefetch(&node->value);
+#endif
+    }
+    // Runs find_node's descent for a group of keys in lockstep and calls
+    // found with the node of each key, or nullptr, in the order of the keys.
+    template <class ForwardIt, class Fn>
+    void descend_batch(ForwardIt first, ForwardIt last, Fn found) const {
+        if constexpr (!is_lookup_key<Compare, Key, typename std::iterator_traits<ForwardIt>::value_type>) {
+            std::vector<key_type> converted(first, last);
+            descend_batch(converted.cbegin(), converted.cend(), found);
+        } else {
+            using key_pointer = decltype(&*first);
+            constexpr bool branchless = is_trivial_key<Compare, Key, std::decay_t<decltype(*first)>>;
+            std::array<key_pointer, batch_lanes> keys;
+            std::array<tree_node*, batch_lanes> nodes;
+            std::array<tree_node*, batch_lanes> candidates;
+            while (first != last) {
+                std::size_t count = 0;
+                for (; count < batch_lanes && first != last; ++first, ++count) {
+                    keys[count] = &*first;
+                    nodes[count] = root;
+                    candidates[count] = nullptr;
+                }
+                for (bool active = root != nullptr; active;) {
+                    active = false;
+                    for (std::size_t i = 0; i < count; i++) {
+                        tree_node* node = nodes[i];
+                        if (node == nullptr) {
+                            continue;
+                        }
+                        bool is_left = !is_less(node->key(), *keys[i]);
+                        candidates[i] = pick<branchless>(is_left, node, candidates[i]);
+                        node = pick<branchless>(is_left, node->left, node->right);
+                        if (node != nullptr) {
+                            prefetch(node);
+                            active = true;
+                        }
+                        nodes[i] = node;
+                    }
+                }
+                for (std::size_t i = 0; i < count; i++) {
+                    tree_node* candidate = candidates[i];
+                    found(candidate != nullptr && !is_less(*keys[i], candidate->key()) ? candidate : nullptr);
+                }
+            }
         }
-        auto [parent, _] = find_node(where, node->key());
+    }
+    // Checks that key falls between the hint's predecessor and the hint, or
+    // between the hint and its successor, and returns the free leaf slot
+    // there. In-order neighbours always have a free link towards each other.
+    template <class K>
+    search_result find_hinted(tree_node* hint, const K& requested) const {
+        const auto& key = lookup_key(requested);
+        if (hint != nullptr && hint->is_deleted) {
+            hint = hint->nearest_not_deleted();
+            if (hint == nullptr) {
+                return find_node(root, key);
+            }
+        }
+        if (hint == nullptr) {
+            if (root == nullptr) {
+                return {nullptr, nullptr, false};
+            }
+            tree_node* last = root->max();
+            if (is_less(last->key(), key)) {
+                return {last, nullptr, false};
+            }
+            return find_node(root, key);
+        }
+        if (is_less(key, hint->key())) {
+            tree_node* prev = hint->prev();
+            if (prev == nullptr || is_less(prev->key(), key)) {
+                if (hint->left == nullptr) {
+                    return {hint, nullptr, true};
+                }
+                return {prev, nullptr, false};
+            }
+            return find_node(root, key);
+        }
+        if (is_less(hint->key(), key)) {
+            tree_node* next = hint->next();
+            if (next == nullptr || is_less(key, next->key())) {
+                if (hint->right == nullptr) {
+                    return {hint, nullptr, false};
+                }
+                return {next, nullptr, true};
+            }
+            return find_node(root, key);
+        }
+        return {hint->parent, hint, false};
+    }
+    template <class K>
+    tree_node* lower_bound_node(const K& requested) const {
+        const auto& key = lookup_key(requested);
+        constexpr bool branchless = is_trivial_key<Compare, Key, std::decay_t<decltype(key)>>;
+        tree_node* candidate = nullptr;
+        for (tree_node* node = root; node != nullptr;) {
+            bool is_left = !is_less(node->key(), key);
+            candidate = pick<branchless>(is_left, node, candidate);
+            node = pick<branchless>(is_left, node->left, node->right);
+        }
+        return candidate;
+    }
+    template <class K>
+    tree_node* upper_bound_node(const K& requested) const {
+        const auto& key = lookup_key(requested);
+        constexpr bool branchless = is_trivial_key<Compare, Key, std::decay_t<decltype(key)>>;
+        tree_node* candidate = nullptr;
+        for (tree_node* node = root; node != nullptr;) {
+            bool is_left = is_less(key, node->key());
+            candidate = pick<branchless>(is_left, node, candidate);
+            node = pick<branchless>(is_left, node->left, node->right);
+        }
+        return candidate;
+    }
+    // Links a new leaf at the position found by find_node, no second descent.
+    void insert_node(tree_node* parent, bool is_left, tree_node* node) {
+        ++map_size;
+        node->ref_count.fetch_add(1, std::memory_order_relaxed);
         node->parent = parent;
-        if (is_less(node->key(), parent->key())) {
-            parent->left = node;
+        if (parent == nullptr) {
+            root = node;
         } else {
-            parent->right = node;
+            if (is_left) {
+                parent->left = node;
+            } else {
+                parent->right = node;
+            }
+            retrace(parent);
         }
-        update_height(node->parent);
-        rebalance_path(node->parent);
+        reclaim_some();
     }
-    void erase_node(node_ptr node) {
+    void erase_node(tree_node* node) {
         if (node == nullptr || node->is_deleted) {
             return;
         }
-        node_ptr parent = node->parent;
-        node_ptr replacement;
-        node_ptr for_rebalance;
+        unlink_node(node);
+        node->is_deleted = true;
+        if (node->parent != nullptr) {
+            node->parent->ref_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        drop(*owner, node);
+        reclaim_some();
+    }
+    // The node keeps the tree's reference, which the handle takes over. It
+    // holds none on its parent, so it does not remember one.
+    node_type extract_node(tree_node* node) {
+        unlink_node(node);
+        node->is_deleted = true;
+        node->parent = nullptr;
+        reclaim_some();
+        return node_type(node, node_allocator);
+    }
+    tree_node* link_extracted(tree_node* parent, bool is_left, node_type& handle) {
+        tree_node* node;
+        ensure_owner();
+        if (*handle.allocator == node_allocator) {
+            node = handle.release();
+            node->ref_count.fetch_sub(1, std::memory_order_relaxed);
+            node->height = 1;
+            if constexpr (Traits::order_statistics) {
+                node->subtree_size = 1;
+            }
+            node->is_deleted = false;
+        } else {
+            node = create_node(std::move(handle.node->value));
+            handle.reset();
+        }
+        insert_node(parent, is_left, node);
+        return node;
+    }
+    static void release_extracted(tree_node* node, node_allocator_type& allocator) {
+        node_ptr::release(node, allocator);
+    }
+    // Takes a linked node out of the tree and rebalances, leaving the links
+    // from the node to its old parent for the caller to keep or drop.
+    void unlink_node(tree_node* node) {
+        tree_node* parent = node->parent;
+        tree_node* replacement;
+        tree_node* for_rebalance;
         if (node->left == nullptr || node->right == nullptr) {
             if (node->left != nullptr) {
                 replacement = node->left;
@@ -189,8 +1227,9 @@ private:
             update_at_parent(parent, node, replacement);
             for_rebalance = parent;
         } else {
-            replacement = node->right.min();
-            node_ptr replacement_parent = replacement->parent;
+            replacement = node->right->min();
+            tree_node* replacement_parent = replacement->parent;
+            replacement->height = node->height;
             replacement->left = node->left;
             if (node->left != nullptr) {
                 node->left->parent = replacement;
@@ -210,15 +1249,13 @@ private:
         }
         node->left = nullptr;
         node->right = nullptr;
-        node->is_deleted = true;
         if (node == root) {
             root = replacement;
         }
         --map_size;
-        update_height(for_rebalance);
-        rebalance_path(for_rebalance);
+        retrace(for_rebalance);
     }
-    void update_at_parent(node_ptr parent, node_ptr old_node, node_ptr new_node) const {
+    void update_at_parent(tree_node* parent, tree_node* old_node, tree_node* new_node) const {
         if (parent == nullptr) {
             return;
         }
@@ -228,7 +1265,7 @@ private:
             parent->right = new_node;
         }
     }
-    node_ptr rebalance(node_ptr node) {
+    tree_node* rebalance(tree_node* node) {
         int bf = balance_factor(node);
         if (bf == 2) {
             if (balance_factor(node->left) == -1) {
@@ -244,25 +1281,49 @@ private:
         update_height(node);
         return node;
     }
-    node_ptr rebalance_path(node_ptr node) {
-        if (node == nullptr) {
-            return nullptr;
+    // Rebalances from node towards the root and stops at the first subtree
+    // whose height is unchanged, above it nothing can be out of balance. For
+    // an insertion that happens after at most one single or double rotation.
+    void retrace(tree_node* node) {
+        [[maybe_unused]] uint64_t steps = 0;
+        if constexpr (Traits::statistics) {
+            counters.retraces++;
         }
-        while (node != root) {
-            bool pos = node->parent->left == node;
-            node = rebalance(node);
-            if (pos) {
-                node->parent->left = node;
+        for (; node != nullptr; steps++) {
+            if constexpr (Traits::statistics) {
+                counters.retrace_steps++;
+                counters.longest_retrace = std::max(counters.longest_retrace, steps + 1);
+            }
+            int old_height = node->height;
+            tree_node* parent = node->parent;
+            bool is_left = parent != nullptr && parent->left == node;
+            tree_node* subtree = rebalance(node);
+            if (parent == nullptr) {
+                root = subtree;
+            } else if (is_left) {
+                parent->left = subtree;
             } else {
-                node->parent->right = node;
+                parent->right = subtree;
             }
-            node = node->parent;
+            if (subtree->height == old_height) {
+                if constexpr (Traits::order_statistics) {
+                    update_sizes(parent);
+                }
+                return;
+            }
+            node = parent;
         }
-        root = rebalance(root);
-        return node;
     }
-    node_ptr rotate_left(node_ptr node) {
-        node_ptr right_child = node->right;
+    // Above the point where retrace stops the shape is unchanged, but every
+    // subtree still gained or lost one element.
+    void update_sizes(tree_node* node) {
+        for (; node != nullptr; node = node->parent) {
+            node->subtree_size = static_cast<uint32_t>(tree_node::size(node->left) + tree_node::size(node->right) + 1);
+        }
+    }
+    tree_node* rotate_left(tree_node* node) {
+        record(&map_stats::rotations);
+        tree_node* right_child = node->right;
         if (node->right != nullptr) {
             node->right = right_child->left;
         }
@@ -276,8 +1337,9 @@ private:
         update_height(right_child);
         return right_child;
     }
-    node_ptr rotate_right(node_ptr node) {
-        node_ptr left_child = node->left;
+    tree_node* rotate_right(tree_node* node) {
+        record(&map_stats::rotations);
+        tree_node* left_child = node->left;
         if (node->left != nullptr) {
             node->left = left_child->right;
         }
@@ -291,35 +1353,413 @@ private:
         update_height(left_child);
         return left_child;
     }
-    int balance_factor(node_ptr node) const {
+    // Builds a balanced subtree from the next count nodes produced in key
+    // order. Subtree sizes differ by at most one, so heights do as well.
+    template <class NextNode>
+    tree_node* build_balanced(size_type count, NextNode& next_node) {
+        if (count == 0) {
+            return nullptr;
+        }
+        size_type left_count = (count - 1) / 2;
+        tree_node* left = build_balanced(left_count, next_node);
+        tree_node* node;
+        tree_node* right;
+        try {
+            node = next_node();
+        } catch (...) {
+            teardown(left, node_allocator);
+            throw;
+        }
+        try {
+            right = build_balanced(count - 1 - left_count, next_node);
+        } catch (...) {
+            teardown(left, node_allocator);
+            teardown(node, node_allocator);
+            throw;
+        }
+        link_balanced(node, left, right, count);
+        return node;
+    }
+    void link_balanced(tree_node* node, tree_node* left, tree_node* right, size_type count) {
+        node->parent = nullptr;
+        node->left = left;
+        node->right = right;
+        if (left != nullptr) {
+            left->parent = node;
+        }
+        if (right != nullptr) {
+            right->parent = node;
+        }
+        node->height = static_cast<int8_t>(std::max(height(left), height(right)) + 1);
+        if constexpr (Traits::order_statistics) {
+            node->subtree_size = static_cast<uint32_t>(count);
+        }
+    }
+    // Subtrees below these sizes are not worth handing to another thread.
+    static constexpr size_type parallel_grain = 4096;
+    static constexpr int parallel_height = 12;
+    template <class Executor, class Fn>
+    static void for_each_chunk(Executor& executor, size_type from, size_type to, Fn& fn) {
+        if (to - from <= parallel_grain) {
+            fn(from, to);
+            return;
+        }
+        size_type middle = from + (to - from) / 2;
+        executor.fork_join([&] { for_each_chunk(executor, from, middle, fn); },
+                           [&] { for_each_chunk(executor, middle, to, fn); });
+    }
+    template <class Executor, class Fn>
+    static void visit_parallel(Executor& executor, tree_node* node, Fn& fn) {
+        if (node == nullptr) {
+            return;
+        }
+        if (node->height <= parallel_height) {
+            visit_parallel(executor, node->left, fn);
+            fn(node->value);
+            visit_parallel(executor, node->right, fn);
+            return;
+        }
+        executor.fork_join([&] { visit_parallel(executor, node->left, fn); },
+                           [&] {
+                               fn(node->value);
+                               visit_parallel(executor, node->right, fn);
+                           });
+    }
+    // build_balanced() over nodes already in key order, with the subtrees
+    // linked in parallel.
+    template <class Executor>
+    tree_node* link_parallel(Executor& executor, tree_node** nodes, size_type count) {
+        if (count == 0) {
+            return nullptr;
+        }
+        size_type left_count = (count - 1) / 2;
+        tree_node* left = nullptr;
+        tree_node* right = nullptr;
+        auto link_left = [&] {
+            left = link_parallel(executor, nodes, left_count);
+        };
+        auto link_right = [&] {
+            right = link_parallel(executor, nodes + left_count + 1, count - 1 - left_count);
+        };
+        if (count > parallel_grain) {
+            executor.fork_join(link_left, link_right);
+        } else {
+            link_left();
+            link_right();
+        }
+        link_balanced(nodes[left_count], left, right, count);
+        return nodes[left_count];
+    }
+    struct merged_trees {
+        tree_node* merged = nullptr;
+        tree_node* kept = nullptr;
+        size_type kept_count = 0;
+    };
+    // Merges two detached trees; nodes of rhs whose keys are in lhs are
+    // joined into the kept tree instead.
+    template <class Executor>
+    merged_trees merge_trees(Executor& executor, tree_node* lhs, tree_node* rhs) {
+        if (lhs == nullptr || rhs == nullptr) {
+            return {lhs == nullptr ? rhs : lhs, nullptr, 0};
+        }
+        bool in_parallel = std::max(height(lhs), height(rhs)) > parallel_height;
+        tree_node* left = detach(lhs->left);
+        tree_node* right = detach(lhs->right);
+        auto [less, rest] = split_tree(rhs, lhs->key());
+        tree_node* duplicate = nullptr;
+        if (rest != nullptr && !is_less(lhs->key(), rest->min()->key())) {
+            duplicate = detach_min(rest);
+        }
+        merged_trees lower;
+        merged_trees upper;
+        auto merge_lower = [&, less = less] {
+            lower = merge_trees(executor, left, less);
+        };
+        auto merge_upper = [&, rest = rest] {
+            upper = merge_trees(executor, right, rest);
+        };
+        if (in_parallel) {
+            executor.fork_join(merge_lower, merge_upper);
+        } else {
+            merge_lower();
+            merge_upper();
+        }
+        merged_trees result;
+        result.merged = join_trees(lower.merged, lhs, upper.merged);
+        result.kept_count = lower.kept_count + upper.kept_count;
+        if (duplicate != nullptr) {
+            result.kept = join_trees(lower.kept, duplicate, upper.kept);
+            result.kept_count++;
+        } else if (upper.kept != nullptr) {
+            tree_node* middle = detach_min(upper.kept);
+            result.kept = join_trees(lower.kept, middle, upper.kept);
+        } else {
+            result.kept = lower.kept;
+        }
+        return result;
+    }
+    tree_node* clone(const tree_node* source) {
+        if (source == nullptr) {
+            return nullptr;
+        }
+        tree_node* node = create_node(source->value);
+        node->ref_count.store(1, std::memory_order_relaxed);
+        node->height = source->height;
+        if constexpr (Traits::order_statistics) {
+            node->subtree_size = source->subtree_size;
+        }
+        try {
+            node->left = clone(source->left);
+            if (node->left != nullptr) {
+                node->left->parent = node;
+            }
+            node->right = clone(source->right);
+            if (node->right != nullptr) {
+                node->right->parent = node;
+            }
+        } catch (...) {
+            teardown(node, node_allocator);
+            throw;
+        }
+        return node;
+    }
+    tree_node* rebuild(const std::vector<tree_node*>& nodes) {
+        size_type next = 0;
+        auto next_node = [&] {
+            return nodes[next++];
+        };
+        return build_balanced(nodes.size(), next_node);
+    }
+    // Whether every key of lhs is less than every key of rhs, both non-empty.
+    static bool before(const acid_map& lhs, const acid_map& rhs) {
+        return lhs.is_less(lhs.last_node()->key(), rhs.first_node()->key());
+    }
+    // Moves the elements of other whose keys are not in this map into new
+    // nodes and erases just those from other, as maps with unequal
+    // allocators cannot share nodes. Every element stays in one of the maps
+    // if an allocation throws.
+    void take_elements(acid_map& other) {
+        for (auto it = other.begin(); it != other.end();) {
+            if (try_emplace(it->first, std::move(it->second)).second) {
+                it = other.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    // Rebalances from node up to the top of its tree, which need not be the
+    // map's root, and returns the new top.
+    tree_node* rebalance_up(tree_node* node) {
+        while (true) {
+            tree_node* parent = node->parent;
+            bool is_left = parent != nullptr && parent->left == node;
+            tree_node* subtree = rebalance(node);
+            if (parent == nullptr) {
+                return subtree;
+            }
+            if (is_left) {
+                parent->left = subtree;
+            } else {
+                parent->right = subtree;
+            }
+            node = parent;
+        }
+    }
+    static tree_node* detach(tree_node* node) {
+        if (node != nullptr) {
+            node->parent = nullptr;
+        }
+        return node;
+    }
+    // Unlinks the smallest node of a detached tree and returns it.
+    tree_node* detach_min(tree_node*& tree) {
+        tree_node* node = tree->min();
+        tree_node* parent = node->parent;
+        if (node->right != nullptr) {
+            node->right->parent = parent;
+        }
+        if (parent == nullptr) {
+            tree = node->right;
+        } else {
+            parent->left = node->right;
+            tree = rebalance_up(parent);
+        }
+        node->right = nullptr;
+        node->parent = nullptr;
+        return node;
+    }
+    // Joins two detached trees and a middle node, with left < middle < right
+    // in key order, in O(|height(left) - height(right)|): the middle node goes
+    // down the spine of the taller tree to a subtree as high as the other
+    // tree, takes both as its children and the path above it is rebalanced.
+    tree_node* join_trees(tree_node* left, tree_node* middle, tree_node* right) {
+        int left_height = height(left);
+        int right_height = height(right);
+        tree_node* parent = nullptr;
+        if (left_height > right_height + 1) {
+            while (height(left) > right_height + 1) {
+                parent = left;
+                left = left->right;
+            }
+        } else if (right_height > left_height + 1) {
+            while (height(right) > left_height + 1) {
+                parent = right;
+                right = right->left;
+            }
+        }
+        middle->left = left;
+        middle->right = right;
+        middle->parent = parent;
+        if (left != nullptr) {
+            left->parent = middle;
+        }
+        if (right != nullptr) {
+            right->parent = middle;
+        }
+        if (parent == nullptr) {
+            update_height(middle);
+            return middle;
+        }
+        if (left_height > right_height) {
+            parent->right = middle;
+        } else {
+            parent->left = middle;
+        }
+        return rebalance_up(middle);
+    }
+    // Splits a detached tree into the nodes with keys less than key and the
+    // rest. Every level joins what it cut off to one side, and as the joined
+    // trees grow in height along the path the joins add up to O(log n).
+    template <class K>
+    std::pair<tree_node*, tree_node*> split_tree(tree_node* node, const K& key) {
+        if (node == nullptr) {
+            return {nullptr, nullptr};
+        }
+        tree_node* left = detach(node->left);
+        tree_node* right = detach(node->right);
+        if (is_less(node->key(), key)) {
+            auto [less, rest] = split_tree(right, key);
+            return {join_trees(left, node, less), rest};
+        }
+        auto [less, rest] = split_tree(left, key);
+        return {less, join_trees(rest, node, right)};
+    }
+    template <class ForwardIt>
+    void merge_sorted(ForwardIt first, ForwardIt last, size_type count) {
+        std::vector<tree_node*> nodes;
+        std::vector<tree_node*> created;
+        nodes.reserve(map_size + count);
+        created.reserve(count);
+        reserve(map_size + count);
+        auto create = [&] {
+            created.push_back(create_node(*first));
+            created.back()->ref_count.store(1, std::memory_order_relaxed);
+            nodes.push_back(created.back());
+        };
+        try {
+            for (tree_node* existing = root->min(); existing != nullptr; existing = existing->next()) {
+                for (; first != last && is_less((*first).first, existing->key()); ++first) {
+                    create();
+                }
+                if (first != last && !is_less(existing->key(), (*first).first)) {
+                    ++first;
+                }
+                nodes.push_back(existing);
+            }
+            for (; first != last; ++first) {
+                create();
+            }
+        } catch (...) {
+            for (tree_node* node : created) {
+                node_ptr::destroy(node, node_allocator);
+            }
+            throw;
+        }
+        auto next = nodes.begin();
+        auto next_node = [&] {
+            return *next++;
+        };
+        root = build_balanced(nodes.size(), next_node);
+        map_size = nodes.size();
+    }
+    // Unlinks a detached tree bottom-up in linear time without recursion.
+    // Nodes pinned by iterators become tombstones exactly as if they had
+    // been erased one by one, everything else is freed on the spot.
+    static void teardown(tree_node* node, node_allocator_type& allocator) {
+        while (node != nullptr) {
+            if (node->left != nullptr) {
+                node = node->left;
+                continue;
+            }
+            if (node->right != nullptr) {
+                node = node->right;
+                continue;
+            }
+            tree_node* parent = node->parent;
+            if (parent != nullptr) {
+                if (parent->left == node) {
+                    parent->left = nullptr;
+                } else {
+                    parent->right = nullptr;
+                }
+            }
+            if (node->ref_count.load(std::memory_order_acquire) == 1) {
+                node_ptr::destroy(node, allocator);
+            } else {
+                node->is_deleted = true;
+                node->is_detached = true;
+                node->ref_count.fetch_sub(1, std::memory_order_relaxed);
+                if (parent != nullptr) {
+                    parent->ref_count.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            node = parent;
+        }
+    }
+    int balance_factor(tree_node* node) const {
         if (node == nullptr) {
             return 0;
         }
         return height(node->left) - height(node->right);
     }
-    int height(node_ptr node) const {
+    int height(tree_node* node) const {
         if (node == nullptr) {
             return 0;
         }
         return node->height;
     }
-    void update_height(node_ptr node) {
+    void update_height(tree_node* node) {
         if (node != nullptr) {
             node->height = std::max(height(node->left), height(node->right)) + 1;
+            if constexpr (Traits::order_statistics) {
+                node->subtree_size = static_cast<uint32_t>(tree_node::size(node->left) +
+                                                           tree_node::size(node->right) + 1);
+            }
         }
     }
     template <class K1, class K2>
     inline bool is_less(const K1& lhs, const K2& rhs) const {
-        return comparator(lhs, rhs);
-    }
-    template <class K1, class K2>
-    inline bool is_equal(const K1& lhs, const K2& rhs) const {
-        return !is_less(lhs, rhs) && !is_less(rhs, lhs);
+        record(&map_stats::comparisons);
+        if constexpr (std::is_same_v<K1, Key> && !std::is_same_v<K2, Key> && use_three_way_compare<Compare, Key, K2>) {
+            return three_way_compare(lhs, rhs) < 0;
+        } else if constexpr (std::is_same_v<K2, Key> && !std::is_same_v<K1, Key> &&
+                             use_three_way_compare<Compare, Key, K1>) {
+            return three_way_compare(rhs, lhs) > 0;
+        } else {
+            return comparator(lhs, rhs);
+        }
     }
-    node_ptr root = nullptr;
+    tree_node* root = nullptr;
     size_type map_size = 0;
     key_compare comparator;
     node_allocator_type node_allocator;
+    mutable std::conditional_t<Traits::statistics, map_stats, no_map_stats> counters;
+    std::unique_ptr<tree_owner> owner{new tree_owner{this, node_allocator}};
 };
 
+template <class Key, class T, class Compare, class Allocator, class Traits>
+void swap(acid_map<Key, T, Compare, Allocator, Traits>& lhs, acid_map<Key, T, Compare, Allocator, Traits>& rhs) noexcept {
+    lhs.swap(rhs);
+}
+
 } // polyndrom
\ No newline at end of file
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace polyndrom {
+
+// A worker thread that runs teardown jobs handed over by containers, so that
+// freeing a large detached tree does not stall the thread that detached it.
+class background_reclaimer {
+public:
+    background_reclaimer() : worker([this] { run(); }) {}
+    background_reclaimer(const background_reclaimer&) = delete;
+    background_reclaimer& operator=(const background_reclaimer&) = delete;
+    ~background_reclaimer() {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+    void submit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            jobs.push_back(std::move(job));
+        }
+        wake.notify_all();
+    }
+    // Blocks until every job submitted so far has run.
+    void drain() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] {
+            return jobs.empty() && !busy;
+        });
+    }
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] {
+                return stopping || !jobs.empty();
+            });
+            if (jobs.empty()) {
+                return;
+            }
+            std::function<void()> job = std::move(jobs.front());
+            jobs.pop_front();
+            busy = true;
+            lock.unlock();
+            job();
+            lock.lock();
+            busy = false;
+            if (jobs.empty()) {
+                idle.notify_all();
+            }
+        }
+    }
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::deque<std::function<void()>> jobs;
+    bool busy = false;
+    bool stopping = false;
+    std::thread worker;
+};
+
+} // polyndrom
\ No newline at end of file
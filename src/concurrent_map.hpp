@@ -0,0 +1,1266 @@
+#pragma once
+
+#include "epoch.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace polyndrom {
+
+// Node of a persistent tree. Once reachable from a published root it is
+// never modified again, writers copy it instead. It is referenced once per
+// parent linking to it and once per version whose root it is.
+template <class V>
+class version_node {
+public:
+    template <class... Args>
+    version_node(uint64_t version, Args&&... args) : version(version), value(std::forward<Args>(args)...) {}
+    const auto& key() const {
+        return value.first;
+    }
+    static uint32_t size(const version_node* node) {
+        return node == nullptr ? 0 : node->subtree_size;
+    }
+    static int height(const version_node* node) {
+        return node == nullptr ? 0 : node->subtree_height;
+    }
+    version_node* left = nullptr;
+    version_node* right = nullptr;
+    // The write operation that created the node, which alone may update it
+    // in place before publishing.
+    uint64_t version;
+    std::atomic<uint32_t> ref_count{1};
+    uint32_t subtree_size = 1;
+    int8_t subtree_height = 1;
+    V value;
+};
+
+// Without parent links an iterator keeps the path from the root to its node.
+// An AVL tree of height 64 would need more than 10^13 nodes. A version is a
+// row of trees over consecutive key ranges, walked one after another.
+template <class Node>
+class version_iterator {
+public:
+    static constexpr int max_height = 64;
+    using iterator_category = std::bidirectional_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = std::remove_const_t<decltype(std::declval<Node&>().value)>;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+    version_iterator() = default;
+    version_iterator(const Node* const* roots, std::size_t tree, std::size_t tree_count)
+        : roots(roots), tree(tree), tree_count(tree_count) {}
+    version_iterator& operator++() {
+        const Node* node = path[depth - 1];
+        if (node->right != nullptr) {
+            push_min(node->right);
+            return *this;
+        }
+        const Node* child = path[--depth];
+        while (depth > 0 && path[depth - 1]->right == child) {
+            child = path[--depth];
+        }
+        if (depth == 0 && ++tree < tree_count) {
+            push_min(roots[tree]);
+        }
+        return *this;
+    }
+    version_iterator operator++(int) {
+        version_iterator other(*this);
+        ++*this;
+        return other;
+    }
+    version_iterator& operator--() {
+        if (depth == 0) {
+            push_max(roots[--tree]);
+            return *this;
+        }
+        const Node* node = path[depth - 1];
+        if (node->left != nullptr) {
+            push_max(node->left);
+            return *this;
+        }
+        const Node* child = path[--depth];
+        while (depth > 0 && path[depth - 1]->left == child) {
+            child = path[--depth];
+        }
+        if (depth == 0) {
+            push_max(roots[--tree]);
+        }
+        return *this;
+    }
+    version_iterator operator--(int) {
+        version_iterator other(*this);
+        --*this;
+        return other;
+    }
+    reference operator*() const {
+        return path[depth - 1]->value;
+    }
+    pointer operator->() const {
+        return &path[depth - 1]->value;
+    }
+    bool operator==(const version_iterator& other) const {
+        return depth == other.depth && (depth == 0 || path[depth - 1] == other.path[depth - 1]);
+    }
+    bool operator!=(const version_iterator& other) const {
+        return !(*this == other);
+    }
+    void push(const Node* node) {
+        path[depth++] = node;
+    }
+    void push_min(const Node* node) {
+        for (; node != nullptr; node = node->left) {
+            push(node);
+        }
+    }
+    void push_max(const Node* node) {
+        for (; node != nullptr; node = node->right) {
+            push(node);
+        }
+    }
+    void truncate(int new_depth) {
+        depth = new_depth;
+    }
+private:
+    const Node* const* roots = nullptr;
+    std::size_t tree = 0;
+    std::size_t tree_count = 0;
+    int depth = 0;
+    std::array<const Node*, max_height> path;
+};
+
+// Queries over one immutable version of the tree, shared by the views. The
+// version is given as its non-empty trees in key order.
+template <class Node, class Compare>
+class version_lookup {
+public:
+    using const_iterator = version_iterator<Node>;
+    using size_type = std::size_t;
+    using mapped_type = typename std::remove_const_t<decltype(std::declval<Node&>().value)>::second_type;
+    template <class K>
+    const_iterator find(const K& key) const {
+        const_iterator it = lower_bound(key);
+        if (it != end() && comparator(key, it->first)) {
+            return end();
+        }
+        return it;
+    }
+    template <class K>
+    const_iterator lower_bound(const K& key) const {
+        return bound([&](const Node* node) {
+            return !comparator(node->key(), key);
+        });
+    }
+    template <class K>
+    const_iterator upper_bound(const K& key) const {
+        return bound([&](const Node* node) {
+            return comparator(key, node->key());
+        });
+    }
+    template <class K>
+    bool contains(const K& key) const {
+        return search(key) != nullptr;
+    }
+    template <class K>
+    size_type count(const K& key) const {
+        return static_cast<size_type>(contains(key));
+    }
+    template <class K>
+    const mapped_type& at(const K& key) const {
+        const Node* node = search(key);
+        if (node == nullptr) {
+            throw std::out_of_range("Key does not exists");
+        }
+        return node->value.second;
+    }
+    const_iterator begin() const {
+        const_iterator it(roots, 0, tree_count);
+        if (tree_count > 0) {
+            it.push_min(roots[0]);
+        }
+        return it;
+    }
+    const_iterator end() const {
+        return const_iterator(roots, tree_count, tree_count);
+    }
+    size_type size() const {
+        return element_count;
+    }
+    bool empty() const {
+        return element_count == 0;
+    }
+    template <class K>
+    static const Node* lower_bound_node(const Node* node, const K& key, const Compare& comparator) {
+        const Node* candidate = nullptr;
+        while (node != nullptr) {
+            if (comparator(node->key(), key)) {
+                node = node->right;
+            } else {
+                candidate = node;
+                node = node->left;
+            }
+        }
+        return candidate;
+    }
+    template <class K>
+    static const Node* find_node(const Node* node, const K& key, const Compare& comparator) {
+        const Node* candidate = lower_bound_node(node, key, comparator);
+        if (candidate != nullptr && !comparator(key, candidate->key())) {
+            return candidate;
+        }
+        return nullptr;
+    }
+protected:
+    explicit version_lookup(const Compare& comparator) : comparator(comparator) {}
+    void assign(Node* const* trees, std::size_t count) {
+        roots = trees;
+        tree_count = count;
+        element_count = 0;
+        for (std::size_t tree = 0; tree < count; tree++) {
+            element_count += Node::size(trees[tree]);
+        }
+    }
+    // Trees before the first one whose root satisfies a bound hold smaller
+    // keys than the root before it, so only these two roots' trees can hold
+    // the first element that does.
+    template <class Pred>
+    std::size_t first_tree(Pred pred) const {
+        return static_cast<std::size_t>(std::partition_point(roots, roots + tree_count, [&](const Node* root) {
+            return !pred(root);
+        }) - roots);
+    }
+    template <class K>
+    const Node* search(const K& key) const {
+        std::size_t first = first_tree([&](const Node* root) {
+            return !comparator(root->key(), key);
+        });
+        for (std::size_t tree = first > 0 ? first - 1 : 0; tree <= first && tree < tree_count; tree++) {
+            if (const Node* node = find_node(roots[tree], key, comparator)) {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+    template <class Pred>
+    const_iterator bound(Pred goes_left) const {
+        std::size_t first = first_tree(goes_left);
+        if (first > 0) {
+            const_iterator it = bound_in(first - 1, goes_left);
+            if (it != end()) {
+                return it;
+            }
+        }
+        return first < tree_count ? bound_in(first, goes_left) : end();
+    }
+    // Records the whole descent and cuts it back to the last node that
+    // satisfied the bound.
+    template <class Pred>
+    const_iterator bound_in(std::size_t tree, Pred goes_left) const {
+        const_iterator it(roots, tree, tree_count);
+        int candidate_depth = 0;
+        int depth = 0;
+        for (const Node* node = roots[tree]; node != nullptr; depth++) {
+            it.push(node);
+            if (goes_left(node)) {
+                candidate_depth = depth + 1;
+                node = node->left;
+            } else {
+                node = node->right;
+            }
+        }
+        if (candidate_depth == 0) {
+            return end();
+        }
+        it.truncate(candidate_depth);
+        return it;
+    }
+    Node* const* roots = nullptr;
+    std::size_t tree_count = 0;
+    size_type element_count = 0;
+    Compare comparator;
+};
+
+// Ordered map for concurrent writers and any number of concurrent readers.
+// The keys are cut into stripes, each a persistent tree behind its own
+// writer lock, so writers of different ranges run in parallel. Writers never
+// touch a published node: they copy the path from the stripe's root to the
+// change, publish the new root with a single atomic store and hand the old
+// one to epoch based reclamation. A stripe grown past split_size is cut at
+// its root, up to max_stripes of them.
+// Every published version is stamped with a clock that each view advances,
+// and a view sees every stripe as of its own time, so it always sees one
+// complete version of the whole map. Readers never lock and write no shared
+// memory other than their thread's epoch record, the clock and the stamp of
+// a version published so recently that nobody has stamped it yet.
+template <class Key, class T, class Compare = std::less<Key>, class Allocator = std::allocator<std::pair<const Key, T>>>
+class concurrent_map {
+private:
+    template <class Map>
+    friend class version_tree_verifier;
+    using node_type = version_node<std::pair<const Key, T>>;
+    using node_allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<node_type>;
+    using node_traits = std::allocator_traits<node_allocator_type>;
+    using lookup_type = version_lookup<node_type, Compare>;
+    static constexpr int max_height = version_iterator<node_type>::max_height;
+    static constexpr std::size_t reclaim_batch = 64;
+    static constexpr std::size_t max_stripes = 64;
+    static constexpr uint32_t split_size = 2048;
+    struct stripe;
+    struct stripe_table;
+    using tree_array = std::array<node_type*, max_stripes>;
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<const Key, T>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using key_compare = Compare;
+    using allocator_type = Allocator;
+    using const_reference = const value_type&;
+    using const_iterator = version_iterator<node_type>;
+    class read_view;
+    class snapshot_view;
+    class transaction;
+    explicit concurrent_map(const allocator_type& allocator = allocator_type()) : node_allocator(allocator) {
+        std::unique_ptr<stripe_table> first(new stripe_table(nullptr));
+        first->stamp->value.store(0, std::memory_order_relaxed);
+        first->stripes.push_back(create_stripe(nullptr));
+        first->stripes.back()->head.load(std::memory_order_relaxed)->stamp->value.store(0, std::memory_order_relaxed);
+        table.store(first.release(), std::memory_order_release);
+    }
+    concurrent_map(const concurrent_map&) = delete;
+    concurrent_map& operator=(const concurrent_map&) = delete;
+    // No reader may be inside the map any more.
+    ~concurrent_map() {
+        stripe_table* current = table.load(std::memory_order_relaxed);
+        for (stripe* part : current->stripes) {
+            destroy_stripe(part);
+        }
+        delete current;
+        for (auto& [epoch, retired_stripe] : retired_stripes) {
+            destroy_stripe(retired_stripe);
+        }
+        for (auto& [epoch, retired_table] : retired_tables) {
+            delete retired_table;
+        }
+    }
+    // Pins the current version for as long as the view lives.
+    read_view read() const {
+        return read_view(*this);
+    }
+    // Takes a reference on the current root of every stripe in O(stripes).
+    // Later writes copy the paths they change, so the snapshot keeps its
+    // structure for as long as any copy of it lives, without holding back
+    // reclamation of anything else.
+    snapshot_view snapshot() const {
+        epoch_guard guard;
+        tree_array trees;
+        std::size_t count = collect(take_time(), trees);
+        return snapshot_view(trees.data(), count, comparator, node_allocator);
+    }
+    template <class K>
+    bool contains(const K& key) const {
+        epoch_guard guard;
+        return find_node(latest_root(key), key) != nullptr;
+    }
+    template <class K>
+    size_type count(const K& key) const {
+        return static_cast<size_type>(contains(key));
+    }
+    template <class K>
+    std::optional<mapped_type> get(const K& key) const {
+        epoch_guard guard;
+        const node_type* node = find_node(latest_root(key), key);
+        if (node == nullptr) {
+            return std::nullopt;
+        }
+        return node->value.second;
+    }
+    // Calls fn with the element while it is guaranteed to stay alive.
+    template <class K, class Fn>
+    bool visit(const K& key, Fn fn) const {
+        epoch_guard guard;
+        const node_type* node = find_node(latest_root(key), key);
+        if (node == nullptr) {
+            return false;
+        }
+        fn(node->value);
+        return true;
+    }
+    template <class K1, class K2, class Fn>
+    void for_each_in_range(const K1& from, const K2& to, Fn fn) const {
+        read_view view(*this);
+        for (auto it = view.lower_bound(from); it != view.end() && is_less(it->first, to); ++it) {
+            fn(*it);
+        }
+    }
+    size_type size() const {
+        epoch_guard guard;
+        tree_array trees;
+        std::size_t count = collect(take_time(), trees);
+        size_type result = 0;
+        for (std::size_t tree = 0; tree < count; tree++) {
+            result += node_type::size(trees[tree]);
+        }
+        return result;
+    }
+    bool empty() const {
+        return size() == 0;
+    }
+    // A write locks the stripe of its key only, so writes to different
+    // stripes proceed in parallel. Writes that turn out to be no-ops in the
+    // current version return without locking. If a write throws, nothing
+    // is published.
+    template <class V>
+    bool insert(V&& value) {
+        if (contains(value.first)) {
+            return false;
+        }
+        pending_write write{write_kind::insert};
+        write.value.emplace(std::forward<V>(value));
+        return submit(write);
+    }
+    template <class... Args>
+    bool emplace(Args&&... args) {
+        pending_write write{write_kind::insert};
+        write.value.emplace(std::forward<Args>(args)...);
+        if (contains(write.key())) {
+            return false;
+        }
+        return submit(write);
+    }
+    template <class K, class... Args>
+    bool try_emplace(K&& key, Args&&... args) {
+        if (contains(key)) {
+            return false;
+        }
+        pending_write write{write_kind::insert};
+        write.value.emplace(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+                            std::forward_as_tuple(std::forward<Args>(args)...));
+        return submit(write);
+    }
+    template <class M>
+    bool insert_or_assign(const key_type& key, M&& value) {
+        pending_write write{write_kind::assign};
+        write.value.emplace(key, std::forward<M>(value));
+        return submit(write);
+    }
+    template <class K>
+    size_type erase(const K& key) {
+        if (!contains(key)) {
+            return 0;
+        }
+        pending_write write{write_kind::erase};
+        write.erased_key.emplace(key);
+        return static_cast<size_type>(submit(write));
+    }
+    // Replaces all stripes by one empty stripe at once.
+    void clear() {
+        std::lock_guard<std::mutex> structure(structure_mutex);
+        stripe_table* current = table.load(std::memory_order_relaxed);
+        shared_stamp shared;
+        std::unique_ptr<stripe_table> next(new stripe_table(shared.cell));
+        next->stripes.push_back(create_stripe(shared.cell));
+        next->previous = current;
+        for (stripe* part : current->stripes) {
+            part->writer_mutex.lock();
+            part->retired = true;
+        }
+        {
+            std::lock_guard<std::mutex> lock(next->stripes[0]->writer_mutex);
+            replace_table(next.release(), shared);
+        }
+        uint64_t epoch = epoch_manager::instance().retire_epoch();
+        for (stripe* part : current->stripes) {
+            part->writer_mutex.unlock();
+            retired_stripes.emplace_back(epoch, part);
+        }
+        retired_tables.emplace_back(epoch, current);
+        reclaim_structure();
+    }
+    // Frees the versions replaced so far that no reader can see any more.
+    // Also done every few writes.
+    void reclaim() {
+        std::lock_guard<std::mutex> structure(structure_mutex);
+        for (stripe* part : table.load(std::memory_order_relaxed)->stripes) {
+            std::lock_guard<std::mutex> lock(part->writer_mutex);
+            reclaim_retired(*part);
+        }
+        reclaim_structure();
+    }
+    allocator_type get_allocator() const {
+        return allocator_type(node_allocator);
+    }
+private:
+    enum class write_kind {
+        insert,
+        assign,
+        erase
+    };
+    struct pending_write {
+        const key_type& key() const {
+            return value.has_value() ? value->first : *erased_key;
+        }
+        write_kind kind;
+        std::optional<value_type> value;
+        std::optional<key_type> erased_key;
+        // Position among the writes of a batch, which orders equal keys.
+        std::size_t sequence = 0;
+        // Inserted for insert and assign, erased for erase.
+        bool applied = false;
+    };
+    struct write_path {
+        std::array<node_type**, max_height> links;
+        int depth = 0;
+    };
+    // Stamps of a version that is not visible yet, and of one that is
+    // visible but not yet ordered against the views: whoever sees it first
+    // stamps it with the clock, which puts it after every view taken so far.
+    static constexpr uint64_t pending = std::numeric_limits<uint64_t>::max();
+    static constexpr uint64_t unstamped = pending - 1;
+    // The time of lookups that want the newest visible version.
+    static constexpr uint64_t latest = pending - 2;
+    struct stamp_cell {
+        explicit stamp_cell(uint64_t value) : value(value) {}
+        static void drop(stamp_cell* cell) {
+            if (cell->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete cell;
+            }
+        }
+        std::atomic<uint64_t> value;
+        std::atomic<uint32_t> ref_count{1};
+    };
+    // The creator's reference on a stamp shared by versions published
+    // together, which stays pending until all of them are in place.
+    struct shared_stamp {
+        shared_stamp() : cell(new stamp_cell(pending)) {}
+        shared_stamp(const shared_stamp&) = delete;
+        shared_stamp& operator=(const shared_stamp&) = delete;
+        ~shared_stamp() {
+            stamp_cell::drop(cell);
+        }
+        stamp_cell* cell;
+    };
+    struct version_link {
+        explicit version_link(stamp_cell* shared) : own(unstamped), stamp(shared != nullptr ? shared : &own) {
+            if (shared != nullptr) {
+                shared->ref_count.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        version_link(const version_link&) = delete;
+        version_link& operator=(const version_link&) = delete;
+        ~version_link() {
+            if (stamp != &own) {
+                stamp_cell::drop(stamp);
+            }
+        }
+        stamp_cell own;
+        stamp_cell* stamp;
+    };
+    // A published root of a stripe, linked to the one it replaced.
+    struct stripe_version : version_link {
+        stripe_version(node_type* root, stripe_version* previous, stamp_cell* shared)
+            : version_link(shared), root(root), previous(previous) {}
+        node_type* root;
+        stripe_version* previous;
+    };
+    // The stripes in key order. Changed only by splits and clear(), which
+    // publish a new table together with the stripes they create.
+    struct stripe_table : version_link {
+        using version_link::version_link;
+        template <class K>
+        std::size_t index_of(const K& key, const Compare& comparator) const {
+            return static_cast<std::size_t>(
+                std::upper_bound(bounds.begin(), bounds.end(), key, [&](const K& lhs, const key_type& rhs) {
+                    return comparator(lhs, rhs);
+                }) - bounds.begin());
+        }
+        // The least key of each stripe but the first.
+        std::vector<key_type> bounds;
+        std::vector<stripe*> stripes;
+        stripe_table* previous = nullptr;
+    };
+    // Writers of a stripe take turns on its lock. A stripe that a split or
+    // clear() replaced is retired: it keeps its last version for the views
+    // that still see it, and writers that lock it move on to the new table.
+    struct alignas(64) stripe {
+        explicit stripe(uint64_t serial) : version(serial << 40) {}
+        std::atomic<stripe_version*> head{nullptr};
+        std::mutex writer_mutex;
+        // The write operation in progress, which alone may update the nodes
+        // it created in place. The stripe's serial in the high bits keeps
+        // the nodes a split hands over from matching the new stripe's writes.
+        uint64_t version;
+        bool retired = false;
+        std::deque<std::pair<uint64_t, stripe_version*>> retired_versions;
+    };
+    template <class K>
+    const node_type* find_node(const node_type* node, const K& key) const {
+        return lookup_type::find_node(node, key, comparator);
+    }
+    // The time a version became visible. One that is visible but unstamped
+    // gets the current time, whoever of the racing threads stamps it.
+    uint64_t stamp_of(const version_link& link) const {
+        uint64_t value = link.stamp->value.load();
+        if (value == unstamped) {
+            uint64_t time = clock.load();
+            if (link.stamp->value.compare_exchange_strong(value, time)) {
+                return time;
+            }
+        }
+        return value;
+    }
+    // The newest of a list of versions that is visible at time. The oldest
+    // version a reader can reach is stamped before the reader's time, see
+    // take_time().
+    template <class Version>
+    const Version* visible(const Version* version, uint64_t time) const {
+        while (stamp_of(*version) > time) {
+            version = version->previous;
+        }
+        return version;
+    }
+    // Everything stamped by now is visible at the returned time, everything
+    // stamped later is not. The caller must already be in an epoch, so the
+    // versions it may need are not reclaimed before it is done.
+    uint64_t take_time() const {
+        return clock.fetch_add(1);
+    }
+    template <class K>
+    const node_type* latest_root(const K& key) const {
+        const stripe_table* current = visible(table.load(std::memory_order_acquire), latest);
+        const stripe* part = current->stripes[current->index_of(key, comparator)];
+        return visible(part->head.load(std::memory_order_acquire), latest)->root;
+    }
+    // Fills trees with the non-empty stripe roots of the version visible at
+    // time, in key order, and returns their number.
+    std::size_t collect(uint64_t time, tree_array& trees) const {
+        const stripe_table* current = visible(table.load(std::memory_order_acquire), time);
+        std::size_t count = 0;
+        for (const stripe* part : current->stripes) {
+            node_type* root = visible(part->head.load(std::memory_order_acquire), time)->root;
+            if (root != nullptr) {
+                trees[count++] = root;
+            }
+        }
+        return count;
+    }
+    template <class... Args>
+    node_type* create(uint64_t version, Args&&... args) {
+        node_type* node = node_traits::allocate(node_allocator, 1);
+        try {
+            node_traits::construct(node_allocator, node, version, std::forward<Args>(args)...);
+        } catch (...) {
+            node_traits::deallocate(node_allocator, node, 1);
+            throw;
+        }
+        return node;
+    }
+    static void destroy(node_type* node, node_allocator_type& allocator) {
+        node_traits::destroy(allocator, node);
+        node_traits::deallocate(allocator, node, 1);
+    }
+    static node_type* acquire(node_type* node) {
+        if (node != nullptr) {
+            node->ref_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        return node;
+    }
+    // Drops one reference and frees whatever becomes unreachable, using the
+    // links of dead nodes as the stack of right subtrees still to visit.
+    void release(node_type* node) {
+        release(node, node_allocator);
+    }
+    static void release(node_type* node, node_allocator_type& allocator) {
+        node_type* pending = nullptr;
+        while (true) {
+            if (node != nullptr && node->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                node_type* left = node->left;
+                node->left = pending;
+                pending = node;
+                node = left;
+                continue;
+            }
+            if (pending == nullptr) {
+                return;
+            }
+            node_type* dead = pending;
+            pending = dead->left;
+            node = dead->right;
+            destroy(dead, allocator);
+        }
+    }
+    // An empty stripe, stamped together with the table that introduces it.
+    stripe* create_stripe(stamp_cell* shared) {
+        std::unique_ptr<stripe> created(new stripe(stripe_serial++));
+        created->head.store(new stripe_version(nullptr, nullptr, shared), std::memory_order_relaxed);
+        return created.release();
+    }
+    void destroy_version(stripe_version* version) {
+        release(version->root);
+        delete version;
+    }
+    void destroy_stripe(stripe* part) {
+        for (auto& [epoch, version] : part->retired_versions) {
+            destroy_version(version);
+        }
+        destroy_version(part->head.load(std::memory_order_relaxed));
+        delete part;
+    }
+    // Makes the node behind link private to the current write, copying it if
+    // it may be visible to readers. The copy shares the children.
+    node_type* own(node_type*& link, uint64_t version) {
+        node_type* node = link;
+        if (node->version == version) {
+            return node;
+        }
+        node_type* copy = create(version, node->value);
+        copy->left = acquire(node->left);
+        copy->right = acquire(node->right);
+        copy->subtree_size = node->subtree_size;
+        copy->subtree_height = node->subtree_height;
+        link = copy;
+        release(node);
+        return copy;
+    }
+    // Owns every node above key's position and returns the link to it.
+    template <class K>
+    node_type*& descend(node_type*& working, const K& key, write_path& path, uint64_t version) {
+        node_type** link = &working;
+        while (*link != nullptr) {
+            node_type* node = *link;
+            if (is_less(key, node->key())) {
+                node = own(*link, version);
+                path.links[path.depth++] = link;
+                link = &node->left;
+            } else if (is_less(node->key(), key)) {
+                node = own(*link, version);
+                path.links[path.depth++] = link;
+                link = &node->right;
+            } else {
+                break;
+            }
+        }
+        return *link;
+    }
+    // Unlinks the node behind link, which itself stays untouched for the
+    // versions still sharing it. A node with two children is replaced by
+    // its successor, whose path gets appended to the write path.
+    void erase_node(node_type*& link, write_path& path, uint64_t version) {
+        node_type* node = link;
+        if (node->left == nullptr || node->right == nullptr) {
+            link = acquire(node->left != nullptr ? node->left : node->right);
+            release(node);
+            return;
+        }
+        int node_depth = path.depth;
+        path.links[path.depth++] = &link;
+        node_type* right = acquire(node->right);
+        node_type** successor_link = &right;
+        while (own(*successor_link, version)->left != nullptr) {
+            path.links[path.depth++] = successor_link;
+            successor_link = &(*successor_link)->left;
+        }
+        node_type* successor = *successor_link;
+        *successor_link = successor->right;
+        successor->left = acquire(node->left);
+        successor->right = right;
+        link = successor;
+        if (path.depth > node_depth + 1) {
+            path.links[node_depth + 1] = &successor->right;
+        }
+        release(node);
+    }
+    bool submit(pending_write& write) {
+        epoch_guard guard;
+        stripe& target = lock_stripe(write.key());
+        std::lock_guard<std::mutex> lock(target.writer_mutex, std::adopt_lock);
+        pending_write* writes[] = {&write};
+        node_type* working = acquire(target.head.load(std::memory_order_relaxed)->root);
+        if (apply(target, writes, writes + 1, working)) {
+            std::pair<stripe*, node_type*> change(&target, working);
+            try {
+                publish(&change, &change + 1);
+            } catch (...) {
+                release(working);
+                throw;
+            }
+        }
+        return write.applied;
+    }
+    // Locks the stripe that holds key in the current table, splitting it
+    // first if it has grown too large. The caller stays in an epoch until it
+    // unlocks, as a split retires the stripe it was called on.
+    template <class K>
+    stripe& lock_stripe(const K& key) {
+        while (true) {
+            stripe_table* current = table.load(std::memory_order_acquire);
+            stripe* target = current->stripes[current->index_of(key, comparator)];
+            std::unique_lock<std::mutex> lock(target->writer_mutex);
+            if (!target->retired && !split(*target)) {
+                lock.release();
+                return *target;
+            }
+        }
+    }
+    // Locks the stripes a batch sorted by key falls into, in key order,
+    // which every thread holding several stripe locks follows. Each part
+    // ends at the index of the first write past its stripe.
+    void lock_stripes(const std::vector<pending_write*>& writes, std::vector<std::pair<stripe*, std::size_t>>& parts) {
+        parts.reserve(max_stripes);
+        while (true) {
+            stripe_table* current = table.load(std::memory_order_acquire);
+            bool moved = false;
+            try {
+                for (std::size_t i = 0; i < writes.size() && !moved; i++) {
+                    stripe* target = current->stripes[current->index_of(writes[i]->key(), comparator)];
+                    if (!parts.empty() && parts.back().first == target) {
+                        parts.back().second = i + 1;
+                        continue;
+                    }
+                    target->writer_mutex.lock();
+                    parts.emplace_back(target, i + 1);
+                    moved = target->retired || split(*target);
+                }
+            } catch (...) {
+                unlock(parts);
+                throw;
+            }
+            if (!moved) {
+                return;
+            }
+            unlock(parts);
+        }
+    }
+    static void unlock(std::vector<std::pair<stripe*, std::size_t>>& parts) {
+        for (auto& [part, end] : parts) {
+            part->writer_mutex.unlock();
+        }
+        parts.clear();
+    }
+    // Applies a batch sorted by key, each part under its stripe's lock, and
+    // publishes the changed stripes together.
+    void apply_batch(const std::vector<pending_write*>& writes) {
+        if (writes.empty()) {
+            return;
+        }
+        epoch_guard guard;
+        std::vector<std::pair<stripe*, std::size_t>> parts;
+        lock_stripes(writes, parts);
+        std::array<std::pair<stripe*, node_type*>, max_stripes> changes;
+        std::size_t changed = 0;
+        try {
+            std::size_t begin = 0;
+            for (auto& [part, end] : parts) {
+                node_type* working = acquire(part->head.load(std::memory_order_relaxed)->root);
+                if (apply(*part, writes.data() + begin, writes.data() + end, working)) {
+                    changes[changed++] = {part, working};
+                }
+                begin = end;
+            }
+            publish(changes.data(), changes.data() + changed);
+        } catch (...) {
+            for (std::size_t i = 0; i < changed; i++) {
+                release(changes[i].second);
+            }
+            unlock(parts);
+            throw;
+        }
+        unlock(parts);
+    }
+    // Sorts a batch by key, keeping writes to one key in the order they were
+    // made.
+    void order(std::vector<pending_write*>& writes) const {
+        for (std::size_t i = 0; i < writes.size(); i++) {
+            writes[i]->sequence = i;
+        }
+        std::sort(writes.begin(), writes.end(), [&](const pending_write* lhs, const pending_write* rhs) {
+            if (is_less(lhs->key(), rhs->key())) {
+                return true;
+            }
+            return !is_less(rhs->key(), lhs->key()) && lhs->sequence < rhs->sequence;
+        });
+    }
+    // Applies writes sorted by key to a locked stripe, starting from the
+    // working root the caller acquired. All of them share one version, so
+    // each node is copied at most once and later writes update the fresh
+    // path in place. Writes without effect copy nothing. Returns whether
+    // anything changed, working then holds the root to publish; otherwise,
+    // or if a write throws, working has been released.
+    bool apply(stripe& target, pending_write* const* first, pending_write* const* last, node_type*& working) {
+        uint64_t version = ++target.version;
+        bool changed = false;
+        try {
+            for (; first != last; ++first) {
+                pending_write* write = *first;
+                write->applied = false;
+                bool exists = find_node(working, write->key()) != nullptr;
+                if (write->kind == write_kind::erase ? !exists : (exists && write->kind == write_kind::insert)) {
+                    continue;
+                }
+                write_path path;
+                node_type*& link = descend(working, write->key(), path, version);
+                changed = true;
+                if (write->kind == write_kind::erase) {
+                    erase_node(link, path, version);
+                    write->applied = true;
+                } else if (exists) {
+                    own(link, version)->value.second = std::move(write->value->second);
+                } else {
+                    link = create(version, std::move(*write->value));
+                    write->applied = true;
+                }
+                rebalance_path(path, version);
+            }
+        } catch (...) {
+            release(working);
+            throw;
+        }
+        if (!changed) {
+            release(working);
+        }
+        return changed;
+    }
+    void rebalance_path(write_path& path, uint64_t version) {
+        while (path.depth > 0) {
+            balance(*path.links[--path.depth], version);
+        }
+    }
+    static void update(node_type* node) {
+        node->subtree_height = static_cast<int8_t>(
+            std::max(node_type::height(node->left), node_type::height(node->right)) + 1);
+        node->subtree_size = node_type::size(node->left) + node_type::size(node->right) + 1;
+    }
+    // The node behind link is owned, its children are owned on demand
+    // before a rotation moves them.
+    void balance(node_type*& link, uint64_t version) {
+        node_type* node = link;
+        update(node);
+        int bf = node_type::height(node->left) - node_type::height(node->right);
+        if (bf > 1) {
+            node_type* left = own(node->left, version);
+            if (node_type::height(left->left) < node_type::height(left->right)) {
+                own(left->right, version);
+                node->left = rotate_left(left);
+            }
+            link = rotate_right(node);
+        } else if (bf < -1) {
+            node_type* right = own(node->right, version);
+            if (node_type::height(right->right) < node_type::height(right->left)) {
+                own(right->left, version);
+                node->right = rotate_right(right);
+            }
+            link = rotate_left(node);
+        }
+    }
+    static node_type* rotate_left(node_type* node) {
+        node_type* right = node->right;
+        node->right = right->left;
+        right->left = node;
+        update(node);
+        update(right);
+        return right;
+    }
+    static node_type* rotate_right(node_type* node) {
+        node_type* left = node->left;
+        node->left = left->right;
+        left->right = node;
+        update(node);
+        update(left);
+        return left;
+    }
+    // Installs new roots of locked stripes. The stores release the new nodes
+    // to readers; several roots share a stamp that stays pending until all
+    // of them are in place, so views see all of them or none. The replaced
+    // versions are freed once no reader can see them. If an allocation
+    // throws, nothing is installed and the roots stay with the caller.
+    void publish(std::pair<stripe*, node_type*>* first, std::pair<stripe*, node_type*>* last) {
+        std::size_t count = static_cast<std::size_t>(last - first);
+        if (count == 0) {
+            return;
+        }
+        std::optional<shared_stamp> shared;
+        if (count > 1) {
+            shared.emplace();
+        }
+        std::array<stripe_version*, max_stripes> versions;
+        std::size_t created = 0;
+        try {
+            for (; created < count; created++) {
+                versions[created] = new stripe_version(first[created].second,
+                                                       first[created].first->head.load(std::memory_order_relaxed),
+                                                       shared.has_value() ? shared->cell : nullptr);
+            }
+        } catch (...) {
+            for (std::size_t i = 0; i < created; i++) {
+                delete versions[i];
+            }
+            throw;
+        }
+        for (std::size_t i = 0; i < count; i++) {
+            first[i].first->head.store(versions[i], std::memory_order_release);
+        }
+        if (shared.has_value()) {
+            shared->cell->value.store(unstamped);
+        }
+        stamp_of(*versions[0]);
+        for (std::size_t i = 0; i < count; i++) {
+            retire(*first[i].first, versions[i]->previous);
+        }
+    }
+    void retire(stripe& part, stripe_version* version) {
+        part.retired_versions.emplace_back(epoch_manager::instance().retire_epoch(), version);
+        if (part.retired_versions.size() >= reclaim_batch) {
+            reclaim_retired(part);
+        }
+    }
+    // Cuts a locked stripe grown past split_size at its root, so the halves
+    // take separate writer locks, and retires it. Skipped while another
+    // thread changes the table. Returns whether the stripe was split.
+    bool split(stripe& target) {
+        node_type* root = target.head.load(std::memory_order_relaxed)->root;
+        if (node_type::size(root) <= split_size ||
+            table.load(std::memory_order_acquire)->stripes.size() >= max_stripes) {
+            return false;
+        }
+        std::unique_lock<std::mutex> structure(structure_mutex, std::try_to_lock);
+        if (!structure.owns_lock()) {
+            return false;
+        }
+        stripe_table* current = table.load(std::memory_order_relaxed);
+        std::size_t index = static_cast<std::size_t>(
+            std::find(current->stripes.begin(), current->stripes.end(), &target) - current->stripes.begin());
+        shared_stamp shared;
+        auto destroy_created = [this](stripe* part) {
+            destroy_stripe(part);
+        };
+        std::unique_ptr<stripe, decltype(destroy_created)> lower(create_stripe(shared.cell), destroy_created);
+        std::unique_ptr<stripe, decltype(destroy_created)> upper(create_stripe(shared.cell), destroy_created);
+        lower->head.load(std::memory_order_relaxed)->root = acquire(root->left);
+        pending_write write{write_kind::insert};
+        write.value.emplace(root->value);
+        pending_write* writes[] = {&write};
+        node_type* working = acquire(root->right);
+        apply(*upper, writes, writes + 1, working);
+        upper->head.load(std::memory_order_relaxed)->root = working;
+        std::unique_ptr<stripe_table> next(new stripe_table(shared.cell));
+        next->bounds = current->bounds;
+        next->bounds.insert(next->bounds.begin() + index, root->key());
+        next->stripes = current->stripes;
+        next->stripes[index] = lower.get();
+        next->stripes.insert(next->stripes.begin() + index + 1, upper.get());
+        next->previous = current;
+        std::lock_guard<std::mutex> lower_lock(lower->writer_mutex);
+        std::lock_guard<std::mutex> upper_lock(upper->writer_mutex);
+        target.retired = true;
+        lower.release();
+        upper.release();
+        replace_table(next.release(), shared);
+        uint64_t epoch = epoch_manager::instance().retire_epoch();
+        retired_stripes.emplace_back(epoch, &target);
+        retired_tables.emplace_back(epoch, current);
+        reclaim_structure();
+        return true;
+    }
+    // Writers may reach the stripes of the new table before it is stamped,
+    // so the caller holds their locks until this returns.
+    void replace_table(stripe_table* next, shared_stamp& shared) {
+        table.store(next, std::memory_order_release);
+        shared.cell->value.store(unstamped);
+        stamp_of(*next);
+    }
+    void reclaim_retired(stripe& part) {
+        if (part.retired_versions.empty()) {
+            return;
+        }
+        uint64_t safe = epoch_manager::instance().safe_epoch();
+        while (!part.retired_versions.empty() && part.retired_versions.front().first < safe) {
+            destroy_version(part.retired_versions.front().second);
+            part.retired_versions.pop_front();
+        }
+    }
+    // Frees the stripes and tables splits and clear() replaced, under the
+    // structure lock.
+    void reclaim_structure() {
+        if (retired_stripes.empty() && retired_tables.empty()) {
+            return;
+        }
+        uint64_t safe = epoch_manager::instance().safe_epoch();
+        while (!retired_stripes.empty() && retired_stripes.front().first < safe) {
+            destroy_stripe(retired_stripes.front().second);
+            retired_stripes.pop_front();
+        }
+        while (!retired_tables.empty() && retired_tables.front().first < safe) {
+            delete retired_tables.front().second;
+            retired_tables.pop_front();
+        }
+    }
+    template <class K1, class K2>
+    bool is_less(const K1& lhs, const K2& rhs) const {
+        return comparator(lhs, rhs);
+    }
+    std::atomic<stripe_table*> table{nullptr};
+    // Advanced by every view, so that whatever gets stamped afterwards is
+    // invisible to it.
+    mutable std::atomic<uint64_t> clock{0};
+    // Held by splits and clear(), which change the table, and by reclaim().
+    std::mutex structure_mutex;
+    uint64_t stripe_serial = 0;
+    std::deque<std::pair<uint64_t, stripe*>> retired_stripes;
+    std::deque<std::pair<uint64_t, stripe_table*>> retired_tables;
+    key_compare comparator;
+    node_allocator_type node_allocator;
+};
+
+// A consistent version of the map. Lookups and iteration see exactly the
+// elements present when the view was taken, whatever the writers do in the
+// meantime. Reclamation waits for the view, so it should be short-lived and
+// stay on its thread.
+template <class Key, class T, class Compare, class Allocator>
+class concurrent_map<Key, T, Compare, Allocator>::read_view : private epoch_guard, public lookup_type {
+public:
+    read_view(const read_view& other) : epoch_guard(other), lookup_type(other), trees(other.trees) {
+        this->roots = trees.data();
+    }
+    read_view& operator=(const read_view& other) {
+        lookup_type::operator=(other);
+        trees = other.trees;
+        this->roots = trees.data();
+        return *this;
+    }
+private:
+    friend concurrent_map;
+    explicit read_view(const concurrent_map& map) : lookup_type(map.comparator) {
+        this->assign(trees.data(), map.collect(map.take_time(), trees));
+    }
+    tree_array trees;
+};
+
+// An immutable version that owns a reference on the root of every stripe.
+// Copies share them, it may outlive the map and move between threads. The
+// last copy frees the nodes no other version uses, so the allocator has to
+// be usable from the thread that drops it.
+template <class Key, class T, class Compare, class Allocator>
+class concurrent_map<Key, T, Compare, Allocator>::snapshot_view : public lookup_type {
+public:
+    snapshot_view() : lookup_type(Compare()) {}
+    snapshot_view(const snapshot_view& other) : lookup_type(other), trees(other.trees), allocator(other.allocator) {
+        for (node_type* root : trees) {
+            acquire(root);
+        }
+        this->roots = trees.data();
+    }
+    snapshot_view(snapshot_view&& other) noexcept
+        : lookup_type(other), trees(std::move(other.trees)), allocator(other.allocator) {
+        this->roots = trees.data();
+        other.assign(nullptr, 0);
+    }
+    snapshot_view& operator=(snapshot_view other) noexcept {
+        std::swap(static_cast<lookup_type&>(*this), static_cast<lookup_type&>(other));
+        trees.swap(other.trees);
+        std::swap(allocator, other.allocator);
+        return *this;
+    }
+    ~snapshot_view() {
+        for (node_type* root : trees) {
+            release(root, allocator);
+        }
+    }
+private:
+    friend concurrent_map;
+    snapshot_view(node_type* const* roots, std::size_t count, const Compare& comparator,
+                  const node_allocator_type& allocator)
+        : lookup_type(comparator), trees(roots, roots + count), allocator(allocator) {
+        for (node_type* root : trees) {
+            acquire(root);
+        }
+        this->assign(trees.data(), trees.size());
+    }
+    std::vector<node_type*> trees;
+    node_allocator_type allocator;
+};
+
+// Collects writes and publishes them as one version on commit(), so readers
+// see either all of them or none. Nothing is applied before commit() and
+// the stripe locks are only held while applying. Writes are applied in key
+// order, so neighbouring keys share the path copied for the first of them.
+// Writes to the same key take effect in the order they were made. Values
+// are constructed when a write is recorded, try_emplace included.
+template <class Key, class T, class Compare, class Allocator>
+class concurrent_map<Key, T, Compare, Allocator>::transaction {
+public:
+    explicit transaction(concurrent_map& map) : map(&map) {}
+    template <class V>
+    void insert(V&& value) {
+        emplace(std::forward<V>(value));
+    }
+    template <class... Args>
+    void emplace(Args&&... args) {
+        record(write_kind::insert, &pending_write::value, std::forward<Args>(args)...);
+    }
+    template <class K, class... Args>
+    void try_emplace(K&& key, Args&&... args) {
+        record(write_kind::insert, &pending_write::value, std::piecewise_construct,
+               std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+    template <class M>
+    void insert_or_assign(const key_type& key, M&& value) {
+        record(write_kind::assign, &pending_write::value, key, std::forward<M>(value));
+    }
+    template <class K>
+    void erase(const K& key) {
+        record(write_kind::erase, &pending_write::erased_key, key);
+    }
+    // Either every write is published or, if applying them throws, none is.
+    // The transaction is empty afterwards in both cases.
+    void commit() {
+        try {
+            std::vector<pending_write*> batch;
+            batch.reserve(writes.size());
+            for (pending_write& write : writes) {
+                batch.push_back(&write);
+            }
+            map->order(batch);
+            map->apply_batch(batch);
+        } catch (...) {
+            writes.clear();
+            throw;
+        }
+        writes.clear();
+    }
+    void abort() {
+        writes.clear();
+    }
+    size_type size() const {
+        return writes.size();
+    }
+private:
+    template <class Field, class... Args>
+    void record(write_kind kind, Field pending_write::*field, Args&&... args) {
+        writes.push_back(pending_write{kind, std::nullopt, std::nullopt});
+        try {
+            (writes.back().*field).emplace(std::forward<Args>(args)...);
+        } catch (...) {
+            writes.pop_back();
+            throw;
+        }
+    }
+    concurrent_map* map;
+    std::vector<pending_write> writes;
+};
+
+} // polyndrom
\ No newline at end of file
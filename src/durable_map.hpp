@@ -0,0 +1,423 @@
+#pragma once
+
+#include "acid_map.hpp"
+#include "mapped_map.hpp"
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace polyndrom {
+
+// acid_map whose writes survive a crash. Every insert, erase and transaction
+// is appended to a write-ahead log in the directory and only returns once the
+// log is synced, but writers do not sync one by one: whoever finds the log
+// unsynced writes and syncs everything logged so far, while the writers that
+// arrive in the meantime log into the next batch. One sync then covers all
+// writers that were waiting, which is what bounds the throughput by the
+// drive's sync latency instead of by the number of writes.
+//
+// checkpoint() saves the map in the mapped format of mapped_map.hpp and
+// empties the log; opening the directory loads the last checkpoint and
+// replays the log, dropping a torn record at its end. Replaying writes that
+// the checkpoint already holds leaves it unchanged, so a crash between
+// saving the checkpoint and emptying the log is harmless.
+//
+// Keys and values are stored through map_codec, as in mapped files. Reads see
+// writes as soon as they are applied, which may be shortly before the writer
+// returns. All member functions can be called concurrently.
+template <class Key, class T, class Compare = std::less<Key>, class Allocator = std::allocator<std::pair<const Key, T>>>
+class durable_acid_map {
+private:
+    using key_codec = map_codec<Key>;
+    using mapped_codec = map_codec<T>;
+    using stored_key = typename key_codec::stored_type;
+    using stored_mapped = typename mapped_codec::stored_type;
+    enum class log_kind : uint8_t {
+        insert,
+        assign,
+        erase
+    };
+public:
+    using map_type = acid_map<Key, T, Compare, Allocator>;
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<const Key, T>;
+    using size_type = std::size_t;
+    using key_compare = Compare;
+    class transaction;
+    static_assert(std::is_default_constructible_v<stored_key> && std::is_default_constructible_v<stored_mapped>,
+                  "logged keys and values need a default constructible stored type");
+    // Without sync the log is written but not synced, which survives the
+    // process crashing but not the machine.
+    explicit durable_acid_map(const std::string& directory, bool sync = true)
+        : checkpoint_path((std::filesystem::path(directory) / "checkpoint").string()),
+          log_path((std::filesystem::path(directory) / "log").string()), sync(sync) {
+        std::filesystem::create_directories(directory);
+        if (std::filesystem::exists(checkpoint_path)) {
+            mapped_acid_map<Key, T, Compare> checkpoint(checkpoint_path);
+            for (const auto& [key, mapped] : checkpoint) {
+                map.emplace_hint(map.cend(), key_codec::decode(key), mapped_codec::decode(mapped));
+            }
+        }
+        log_file = ::open(log_path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (log_file < 0) {
+            throw std::runtime_error("Cannot open " + log_path);
+        }
+        try {
+            replay();
+        } catch (...) {
+            ::close(log_file);
+            throw;
+        }
+    }
+    durable_acid_map(const durable_acid_map&) = delete;
+    durable_acid_map& operator=(const durable_acid_map&) = delete;
+    // Writers must have returned, which means everything they wrote is
+    // already synced.
+    ~durable_acid_map() {
+        ::close(log_file);
+    }
+    bool insert(const value_type& value) {
+        return try_emplace(value.first, value.second);
+    }
+    bool try_emplace(const key_type& key, const mapped_type& mapped) {
+        std::vector<char> record(sizeof(record_header));
+        append_op(record, log_kind::insert, key, &mapped);
+        bool inserted;
+        write(std::move(record), [&] {
+            inserted = map.try_emplace(key, mapped).second;
+        });
+        return inserted;
+    }
+    bool insert_or_assign(const key_type& key, const mapped_type& mapped) {
+        std::vector<char> record(sizeof(record_header));
+        append_op(record, log_kind::assign, key, &mapped);
+        bool inserted;
+        write(std::move(record), [&] {
+            inserted = assign(key, mapped);
+        });
+        return inserted;
+    }
+    size_type erase(const key_type& key) {
+        std::vector<char> record(sizeof(record_header));
+        append_op(record, log_kind::erase, key, nullptr);
+        size_type erased;
+        write(std::move(record), [&] {
+            erased = map.erase(key);
+        });
+        return erased;
+    }
+    template <class K>
+    std::optional<mapped_type> get(const K& key) const {
+        std::shared_lock<std::shared_mutex> lock(map_mutex);
+        auto it = map.find(key);
+        if (it == map.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+    template <class K>
+    bool contains(const K& key) const {
+        std::shared_lock<std::shared_mutex> lock(map_mutex);
+        return map.contains(key);
+    }
+    size_type size() const {
+        std::shared_lock<std::shared_mutex> lock(map_mutex);
+        return map.size();
+    }
+    bool empty() const {
+        return size() == 0;
+    }
+    // Calls fn on every element in order while writers are held off.
+    template <class Fn>
+    void for_each(Fn fn) const {
+        std::shared_lock<std::shared_mutex> lock(map_mutex);
+        for (const value_type& value : map) {
+            fn(value);
+        }
+    }
+    // Saves the map as the new checkpoint and empties the log. Writers wait
+    // for it, readers do not.
+    void checkpoint() {
+        std::shared_lock<std::shared_mutex> state(map_mutex);
+        std::unique_lock<std::mutex> lock(log_mutex);
+        // Holding the log lock keeps writers from logging anything the
+        // checkpoint would miss; waiting for the batch in flight keeps it
+        // from landing in the emptied log.
+        synced.wait(lock, [&] { return !flushing; });
+        check_log();
+        std::string saved_path = checkpoint_path + ".new";
+        mapped_acid_map<Key, T, Compare>::save(map, saved_path);
+        sync_path(saved_path);
+        std::filesystem::rename(saved_path, checkpoint_path);
+        sync_path(std::filesystem::path(checkpoint_path).parent_path().string());
+        if (::ftruncate(log_file, 0) != 0) {
+            log_failed = true;
+            throw std::runtime_error("Cannot truncate " + log_path);
+        }
+        pending.clear();
+        commit_count += logged_sequence - synced_sequence;
+        synced_sequence = logged_sequence;
+        synced.notify_all();
+    }
+    // Writes made durable and syncs it took, the ratio is the batch size of
+    // the group commit.
+    uint64_t commits() const {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        return commit_count;
+    }
+    uint64_t syncs() const {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        return sync_count;
+    }
+private:
+    // Log records are a size, a checksum and the operations they hold, so a
+    // record torn by a crash fails the check and everything from it on is
+    // dropped.
+    struct record_header {
+        uint32_t size;
+        uint32_t checksum;
+    };
+    static constexpr std::size_t op_size = 1 + sizeof(stored_key) + sizeof(stored_mapped);
+    static uint32_t checksum(const char* data, std::size_t size) {
+        uint32_t hash = 2166136261u;
+        for (std::size_t i = 0; i < size; i++) {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+        }
+        return hash;
+    }
+    static void append_op(std::vector<char>& record, log_kind kind, const key_type& key, const mapped_type* mapped) {
+        std::size_t offset = record.size();
+        record.resize(offset + op_size);
+        record[offset] = static_cast<char>(kind);
+        stored_key stored = key_codec::encode(key);
+        std::memcpy(record.data() + offset + 1, &stored, sizeof(stored));
+        if (mapped != nullptr) {
+            stored_mapped stored_value = mapped_codec::encode(*mapped);
+            std::memcpy(record.data() + offset + 1 + sizeof(stored), &stored_value, sizeof(stored_value));
+        }
+    }
+    bool assign(const key_type& key, const mapped_type& mapped) {
+        auto [it, inserted] = map.try_emplace(key, mapped);
+        if (!inserted) {
+            it->second = mapped;
+        }
+        return inserted;
+    }
+    void apply_op(const char* op) {
+        stored_key key;
+        stored_mapped mapped;
+        std::memcpy(&key, op + 1, sizeof(key));
+        std::memcpy(&mapped, op + 1 + sizeof(key), sizeof(mapped));
+        switch (static_cast<log_kind>(op[0])) {
+            case log_kind::insert:
+                map.try_emplace(key_codec::decode(key), mapped_codec::decode(mapped));
+                break;
+            case log_kind::assign:
+                assign(key_codec::decode(key), mapped_codec::decode(mapped));
+                break;
+            case log_kind::erase:
+                map.erase(key_codec::decode(key));
+                break;
+        }
+    }
+    // Logs a record and applies its operations under the same lock, so the
+    // log holds the writes in the order the map saw them, then waits until a
+    // sync covers the record. If applying throws, the exception is passed on
+    // without waiting and recovery redoes the write.
+    template <class Fn>
+    void write(std::vector<char> record, Fn apply) {
+        uint64_t sequence;
+        {
+            std::unique_lock<std::shared_mutex> state(map_mutex);
+            log(std::move(record), sequence);
+            apply();
+        }
+        wait_synced(sequence);
+    }
+    void log(std::vector<char> record, uint64_t& sequence) {
+        record_header header{static_cast<uint32_t>(record.size() - sizeof(record_header)),
+                             checksum(record.data() + sizeof(record_header), record.size() - sizeof(record_header))};
+        std::memcpy(record.data(), &header, sizeof(header));
+        std::lock_guard<std::mutex> lock(log_mutex);
+        check_log();
+        pending.insert(pending.end(), record.begin(), record.end());
+        sequence = ++logged_sequence;
+    }
+    void wait_synced(uint64_t sequence) {
+        std::unique_lock<std::mutex> lock(log_mutex);
+        while (synced_sequence < sequence) {
+            check_log();
+            if (flushing) {
+                synced.wait(lock);
+                continue;
+            }
+            flushing = true;
+            std::vector<char> batch;
+            batch.swap(pending);
+            uint64_t batch_sequence = logged_sequence;
+            lock.unlock();
+            bool written = write_all(batch.data(), batch.size()) && (!sync || ::fdatasync(log_file) == 0);
+            lock.lock();
+            flushing = false;
+            if (!written) {
+                log_failed = true;
+                synced.notify_all();
+                check_log();
+            }
+            commit_count += batch_sequence - synced_sequence;
+            sync_count++;
+            synced_sequence = batch_sequence;
+            synced.notify_all();
+        }
+    }
+    // A failed write leaves the map ahead of the log, later writes would
+    // only widen the gap.
+    void check_log() const {
+        if (log_failed) {
+            throw std::runtime_error("Cannot write " + log_path);
+        }
+    }
+    bool write_all(const char* data, std::size_t size) {
+        while (size > 0) {
+            ssize_t written = ::write(log_file, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            data += written;
+            size -= static_cast<std::size_t>(written);
+        }
+        return true;
+    }
+    void replay() {
+        std::vector<char> contents;
+        char buffer[1 << 16];
+        ssize_t got;
+        while ((got = ::pread(log_file, buffer, sizeof(buffer), static_cast<off_t>(contents.size()))) > 0) {
+            contents.insert(contents.end(), buffer, buffer + got);
+        }
+        if (got < 0) {
+            throw std::runtime_error("Cannot read " + log_path);
+        }
+        std::size_t offset = 0;
+        while (contents.size() - offset >= sizeof(record_header)) {
+            record_header header;
+            std::memcpy(&header, contents.data() + offset, sizeof(header));
+            const char* ops = contents.data() + offset + sizeof(header);
+            if (contents.size() - offset - sizeof(header) < header.size || header.size % op_size != 0 ||
+                checksum(ops, header.size) != header.checksum) {
+                break;
+            }
+            for (std::size_t op = 0; op < header.size; op += op_size) {
+                apply_op(ops + op);
+            }
+            offset += sizeof(header) + header.size;
+        }
+        if (offset != contents.size() && ::ftruncate(log_file, static_cast<off_t>(offset)) != 0) {
+            throw std::runtime_error("Cannot truncate " + log_path);
+        }
+    }
+    static void sync_path(const std::string& path) {
+        int file = ::open(path.c_str(), O_RDONLY);
+        if (file < 0 || ::fsync(file) != 0) {
+            if (file >= 0) {
+                ::close(file);
+            }
+            throw std::runtime_error("Cannot sync " + path);
+        }
+        ::close(file);
+    }
+    std::string checkpoint_path;
+    std::string log_path;
+    bool sync;
+    int log_file = -1;
+    mutable std::shared_mutex map_mutex;
+    map_type map;
+    mutable std::mutex log_mutex;
+    std::condition_variable synced;
+    std::vector<char> pending;
+    uint64_t logged_sequence = 0;
+    uint64_t synced_sequence = 0;
+    bool flushing = false;
+    bool log_failed = false;
+    uint64_t commit_count = 0;
+    uint64_t sync_count = 0;
+};
+
+// Collects writes and logs them as one record on commit(), so after a crash
+// either all of them are recovered or none. Writes take effect in the order
+// they were made.
+template <class Key, class T, class Compare, class Allocator>
+class durable_acid_map<Key, T, Compare, Allocator>::transaction {
+public:
+    explicit transaction(durable_acid_map& map) : map(&map) {}
+    void insert(const value_type& value) {
+        try_emplace(value.first, value.second);
+    }
+    void try_emplace(const key_type& key, const mapped_type& mapped) {
+        writes.push_back({log_kind::insert, key, mapped});
+    }
+    void insert_or_assign(const key_type& key, const mapped_type& mapped) {
+        writes.push_back({log_kind::assign, key, mapped});
+    }
+    void erase(const key_type& key) {
+        writes.push_back({log_kind::erase, key, std::nullopt});
+    }
+    // Returns once the writes are durable. The transaction is empty
+    // afterwards.
+    void commit() {
+        std::vector<pending_write> committed;
+        committed.swap(writes);
+        std::vector<char> record(sizeof(record_header));
+        for (pending_write& write : committed) {
+            append_op(record, write.kind, write.key, write.mapped.has_value() ? &*write.mapped : nullptr);
+        }
+        map->write(std::move(record), [&] {
+            for (pending_write& write : committed) {
+                switch (write.kind) {
+                    case log_kind::insert:
+                        map->map.try_emplace(write.key, *write.mapped);
+                        break;
+                    case log_kind::assign:
+                        map->assign(write.key, *write.mapped);
+                        break;
+                    case log_kind::erase:
+                        map->map.erase(write.key);
+                        break;
+                }
+            }
+        });
+    }
+    void abort() {
+        writes.clear();
+    }
+    size_type size() const {
+        return writes.size();
+    }
+private:
+    struct pending_write {
+        log_kind kind;
+        key_type key;
+        std::optional<mapped_type> mapped;
+    };
+    durable_acid_map* map;
+    std::vector<pending_write> writes;
+};
+
+} // polyndrom
\ No newline at end of file
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+namespace polyndrom {
+
+// Epoch based reclamation shared by all concurrent containers. A reader
+// announces the global epoch it entered with in a per-thread record for as
+// long as it holds an epoch_guard. Whatever a writer unlinked and tagged with
+// retire_epoch() may be freed once safe_epoch() has moved past that tag, as
+// no reader that could still see it remains.
+class epoch_manager {
+public:
+    static constexpr uint64_t idle = std::numeric_limits<uint64_t>::max();
+    // Never destroyed: thread records are released by thread_local
+    // destructors that may run after static destruction.
+    static epoch_manager& instance() {
+        static epoch_manager* manager = new epoch_manager();
+        return *manager;
+    }
+    void enter() {
+        record* rec = local_record();
+        if (rec->nesting++ == 0) {
+            rec->epoch.store(epoch_.load(std::memory_order_acquire), std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+    void leave() {
+        record* rec = local_record();
+        if (--rec->nesting == 0) {
+            rec->epoch.store(idle, std::memory_order_release);
+        }
+    }
+    // Called after unlinking, returns the tag for what was unlinked.
+    uint64_t retire_epoch() {
+        return epoch_.fetch_add(1, std::memory_order_acq_rel);
+    }
+    // Everything retired with a tag below the result can be freed.
+    uint64_t safe_epoch() const {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t safe = epoch_.load(std::memory_order_acquire);
+        for (record* rec = head_.load(std::memory_order_acquire); rec != nullptr; rec = rec->next) {
+            safe = std::min(safe, rec->epoch.load(std::memory_order_acquire));
+        }
+        return safe;
+    }
+private:
+    struct alignas(64) record {
+        std::atomic<uint64_t> epoch{idle};
+        std::atomic<bool> in_use{true};
+        uint32_t nesting = 0;
+        record* next = nullptr;
+    };
+    struct record_holder {
+        ~record_holder() {
+            if (rec != nullptr) {
+                rec->in_use.store(false, std::memory_order_release);
+            }
+        }
+        record* rec = nullptr;
+    };
+    epoch_manager() = default;
+    // Records of exited threads are reused, so their number is bounded by the
+    // peak number of threads that ever read at the same time.
+    record* local_record() {
+        static thread_local record_holder holder;
+        if (holder.rec == nullptr) {
+            holder.rec = acquire_record();
+        }
+        return holder.rec;
+    }
+    record* acquire_record() {
+        for (record* rec = head_.load(std::memory_order_acquire); rec != nullptr; rec = rec->next) {
+            bool expected = false;
+            if (!rec->in_use.load(std::memory_order_relaxed) &&
+                rec->in_use.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+                return rec;
+            }
+        }
+        record* rec = new record();
+        rec->next = head_.load(std::memory_order_relaxed);
+        while (!head_.compare_exchange_weak(rec->next, rec, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+        return rec;
+    }
+    std::atomic<uint64_t> epoch_{1};
+    std::atomic<record*> head_{nullptr};
+};
+
+// Keeps everything reachable from a published root alive while it lives. A
+// guard belongs to the thread that created it.
+class epoch_guard {
+public:
+    epoch_guard() {
+        epoch_manager::instance().enter();
+    }
+    epoch_guard(const epoch_guard&) {
+        epoch_manager::instance().enter();
+    }
+    epoch_guard& operator=(const epoch_guard&) = default;
+    ~epoch_guard() {
+        epoch_manager::instance().leave();
+    }
+};
+
+} // polyndrom
\ No newline at end of file
@@ -6,11 +6,17 @@
 template <class Tree>
 class tree_verifier;
 
-template <class Key, class T, class Compare, class Allocator>
+template <class Key, class T, class Compare, class Allocator, class Traits>
 class acid_map;
 
-template <class V, class Allocator>
+template <class V, bool OrderStatistics = false>
+class map_node;
+
+template <class V, class Allocator, bool OrderStatistics = false>
 class node_pointer;
 
-template <class Map>
-class map_iterator;
\ No newline at end of file
+template <class Map, bool Const = false>
+class map_iterator;
+
+template <class Map, bool Const = false>
+class map_cursor;
\ No newline at end of file
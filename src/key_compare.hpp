@@ -0,0 +1,75 @@
+#pragma once
+
+#include "fwd.hpp"
+
+#include <type_traits>
+#include <utility>
+
+#if defined(__cpp_impl_three_way_comparison) && defined(__cpp_lib_three_way_comparison)
+#include <compare>
+#endif
+
+namespace polyndrom {
+
+// Three-way comparison is only picked up when the map orders keys by operator<,
+// i.e. with std::less, so that the result is guaranteed to agree with Compare.
+template <class Compare, class Key>
+struct is_default_less : std::bool_constant<std::is_same_v<Compare, std::less<Key>> ||
+                                            std::is_same_v<Compare, std::less<>>> {};
+
+template <class Key, class K, class = void>
+struct has_compare_member : std::false_type {};
+
+template <class Key, class K>
+struct has_compare_member<Key, K, std::void_t<decltype(static_cast<int>(
+    std::declval<const Key&>().compare(std::declval<const K&>())))>> : std::true_type {};
+
+template <class Key, class K, class = void>
+struct has_three_way_operator : std::false_type {};
+
+#if defined(__cpp_impl_three_way_comparison) && defined(__cpp_lib_three_way_comparison)
+template <class Key, class K>
+struct has_three_way_operator<Key, K, std::void_t<decltype(std::declval<const Key&>() <=> std::declval<const K&>())>>
+    : std::true_type {};
+#endif
+
+template <class Compare, class Key, class K>
+inline constexpr bool use_three_way_compare = is_default_less<Compare, Key>::value &&
+    (has_compare_member<Key, K>::value || has_three_way_operator<Key, K>::value);
+
+// Arithmetic and enumeration keys ordered by the built-in operator< are
+// compared without a branch, which lets the map descend its trees with
+// conditional moves instead of unpredictable jumps, see acid_map::pick.
+template <class Compare, class Key, class K>
+inline constexpr bool is_trivial_key = is_default_less<Compare, Key>::value &&
+    (std::is_arithmetic_v<Key> || std::is_enum_v<Key>) && (std::is_arithmetic_v<K> || std::is_enum_v<K>);
+
+template <class Compare, class = void>
+struct is_transparent_compare : std::false_type {};
+
+template <class Compare>
+struct is_transparent_compare<Compare, std::void_t<typename Compare::is_transparent>> : std::true_type {};
+
+// Keys of another type are looked up as they are when the comparator is
+// transparent or three-way comparison takes them. Any other key is converted
+// to Key once by the map, instead of by the comparator on every comparison.
+template <class Compare, class Key, class K>
+inline constexpr bool is_lookup_key = std::is_same_v<K, Key> || is_transparent_compare<Compare>::value ||
+    use_three_way_compare<Compare, Key, K>;
+
+template <class Key, class K>
+inline int three_way_compare(const Key& lhs, const K& rhs) {
+    if constexpr (has_compare_member<Key, K>::value) {
+        return static_cast<int>(lhs.compare(rhs));
+    } else {
+#if defined(__cpp_impl_three_way_comparison) && defined(__cpp_lib_three_way_comparison)
+        auto order = lhs <=> rhs;
+        return order < 0 ? -1 : (order > 0 ? 1 : 0);
+#else
+        static_assert(has_compare_member<Key, K>::value, "three-way comparison is not available");
+        return 0;
+#endif
+    }
+}
+
+} // polyndrom
\ No newline at end of file
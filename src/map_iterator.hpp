@@ -3,54 +3,333 @@
 #include "fwd.hpp"
 #include "map_node.hpp"
 
-template <class Map>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+// Holds the node it pins and the owner of its tree, through which it reaches
+// the map now holding the tree, also after swap() or a move. That lets end()
+// step back to the last element and an iterator on an erased node continue
+// at the nearest live key after or before it, found by looking the key up
+// again. A node dropped by clear() steps to end(). Only the node reached is
+// pinned, the walk itself follows raw links.
+template <class Map, bool Const>
 class map_iterator {
 private:
     friend Map;
-    using node_ptr = typename Map::node_ptr;
+    template <class, bool>
+    friend class map_iterator;
+    template <class, bool>
+    friend class map_cursor;
+    using node_type = typename Map::tree_node;
+    using tree_owner = typename Map::tree_owner;
 public:
-    using iterator_category = std::bidirectional_iterator_tag;
-    using difference_type = size_t;
+    // With order statistics the iterator finds its index and the root by
+    // climbing the parent links and jumps in O(log n).
+    using iterator_category = std::conditional_t<node_type::order_statistics, std::random_access_iterator_tag,
+                                                 std::bidirectional_iterator_tag>;
+    using difference_type = std::ptrdiff_t;
     using value_type = typename Map::value_type;
-    using pointer = value_type*;
-    using reference = value_type&;
+    using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+    using reference = std::conditional_t<Const, const value_type&, value_type&>;
     map_iterator() = default;
-    map_iterator(const map_iterator& other) : node(other.node) {}
+    map_iterator(const map_iterator& other) : map_iterator(other.node, other.owner) {}
+    map_iterator(map_iterator&& other) noexcept : node(std::exchange(other.node, nullptr)), owner(other.owner) {}
+    template <bool OtherConst, class = std::enable_if_t<Const && !OtherConst>>
+    map_iterator(const map_iterator<Map, OtherConst>& other) : map_iterator(other.node, other.owner) {}
     map_iterator& operator=(const map_iterator& other) {
+        if (other.node != nullptr) {
+            other.owner->map->pin(other.node);
+        }
+        reset(nullptr);
         node = other.node;
+        owner = other.owner;
         return *this;
     }
+    map_iterator& operator=(map_iterator&& other) noexcept {
+        if (this != &other) {
+            reset(nullptr);
+            node = std::exchange(other.node, nullptr);
+            owner = other.owner;
+        }
+        return *this;
+    }
+    ~map_iterator() {
+        reset(nullptr);
+    }
+    // Incrementing end() wraps around to the first element and decrementing
+    // it gives the last one, which is what reverse iterators rely on.
     map_iterator& operator++() {
-        node = node.next();
+        reset(node != nullptr ? step<true>(node) : owner != nullptr ? owner->map->first_node() : nullptr);
         return *this;
     }
     map_iterator operator++(int) {
-        map_iterator other(node);
+        map_iterator other(*this);
         ++*this;
         return other;
     }
     map_iterator& operator--() {
-        node = node.prev();
+        reset(node != nullptr ? step<false>(node) : owner != nullptr ? owner->map->last_node() : nullptr);
         return *this;
     }
     map_iterator operator--(int) {
-        map_iterator other(node);
+        map_iterator other(*this);
         --*this;
         return other;
     }
-    value_type& operator*() {
+    map_iterator& operator+=(difference_type n) {
+        static_assert(node_type::order_statistics, "random access requires order_statistic_traits");
+        if (n < 0 && node == nullptr) {
+            --*this;
+            ++n;
+        }
+        if (n != 0 && node != nullptr && node->is_deleted) {
+            if (n > 0) {
+                ++*this;
+                --n;
+            } else {
+                --*this;
+                ++n;
+            }
+        }
+        if (n == 0 || node == nullptr) {
+            return *this;
+        }
+        auto [index, root] = node->position();
+        reset(node_type::select(root, index + static_cast<size_t>(n)));
+        return *this;
+    }
+    map_iterator& operator-=(difference_type n) {
+        return *this += -n;
+    }
+    map_iterator operator+(difference_type n) const {
+        map_iterator other(*this);
+        other += n;
+        return other;
+    }
+    friend map_iterator operator+(difference_type n, const map_iterator& it) {
+        return it + n;
+    }
+    map_iterator operator-(difference_type n) const {
+        map_iterator other(*this);
+        other -= n;
+        return other;
+    }
+    // end() is placed relative to the other iterator, which must not be
+    // end() as well unless both are.
+    difference_type operator-(const map_iterator& other) const {
+        static_assert(node_type::order_statistics, "random access requires order_statistic_traits");
+        node_type* lhs = node == nullptr ? nullptr : node->nearest_not_deleted();
+        node_type* rhs = other.node == nullptr ? nullptr : other.node->nearest_not_deleted();
+        if (lhs == rhs) {
+            return 0;
+        }
+        if (lhs == nullptr) {
+            auto [index, root] = rhs->position();
+            return static_cast<difference_type>(root->subtree_size - index);
+        }
+        auto [lhs_index, root] = lhs->position();
+        if (rhs == nullptr) {
+            return static_cast<difference_type>(lhs_index) - static_cast<difference_type>(root->subtree_size);
+        }
+        return static_cast<difference_type>(lhs_index) - static_cast<difference_type>(rhs->position().first);
+    }
+    reference operator[](difference_type n) const {
+        return *(*this + n);
+    }
+    bool operator<(const map_iterator& other) const {
+        return *this - other < 0;
+    }
+    bool operator>(const map_iterator& other) const {
+        return other < *this;
+    }
+    bool operator<=(const map_iterator& other) const {
+        return !(other < *this);
+    }
+    bool operator>=(const map_iterator& other) const {
+        return !(*this < other);
+    }
+    reference operator*() const {
         return node->value;
     }
-    value_type* operator->() {
+    pointer operator->() const {
         return &node->value;
     }
-    bool operator==(map_iterator other) const {
+    template <bool OtherConst>
+    bool operator==(const map_iterator<Map, OtherConst>& other) const {
         return node == other.node;
     }
-    bool operator!=(map_iterator other) const {
+    template <bool OtherConst>
+    bool operator!=(const map_iterator<Map, OtherConst>& other) const {
         return node != other.node;
     }
 private:
-    map_iterator(node_ptr node) : node(node) {}
-    node_ptr node = nullptr;
+    map_iterator(node_type* node, tree_owner* owner) : owner(owner) {
+        reset(node);
+    }
+    template <bool Forward>
+    node_type* step(node_type* from) const {
+        if (!from->is_deleted) {
+            return Forward ? from->next() : from->prev();
+        }
+        if (from->is_detached) {
+            return nullptr;
+        }
+        return owner->map->template live_neighbour<Forward>(from->key());
+    }
+    // Pins the new node before letting go of the current one.
+    void reset(node_type* next) {
+        if (next != nullptr) {
+            owner->map->pin(next);
+        }
+        if (node != nullptr) {
+            owner->map->unpin(node);
+        }
+        node = next;
+    }
+    node_type* node = nullptr;
+    tree_owner* owner = nullptr;
 };
+
+// Walks a map like map_iterator but pins nothing, so copying and stepping
+// it never touch a reference count. The map must not be changed while a
+// cursor is in use; where the element has to outlive an erasure, convert
+// the cursor to an iterator, which pins it again.
+template <class Map, bool Const>
+class map_cursor {
+private:
+    friend Map;
+    template <class, bool>
+    friend class map_cursor;
+    using node_type = typename Map::tree_node;
+    using tree_owner = typename Map::tree_owner;
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = typename Map::value_type;
+    using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+    using reference = std::conditional_t<Const, const value_type&, value_type&>;
+    map_cursor() = default;
+    template <bool OtherConst, class = std::enable_if_t<Const && !OtherConst>>
+    map_cursor(const map_cursor<Map, OtherConst>& other) : node(other.node), owner(other.owner) {}
+    // Starts at the element an iterator points at, which must not be erased.
+    template <bool OtherConst, class = std::enable_if_t<Const || !OtherConst>>
+    explicit map_cursor(const map_iterator<Map, OtherConst>& it) : node(it.node), owner(it.owner) {}
+    template <bool OtherConst, class = std::enable_if_t<OtherConst || !Const>>
+    operator map_iterator<Map, OtherConst>() const {
+        return map_iterator<Map, OtherConst>(node, owner);
+    }
+    reference operator*() const {
+        return node->value;
+    }
+    pointer operator->() const {
+        return &node->value;
+    }
+    map_cursor& operator++() {
+        node = node != nullptr ? node->next() : owner != nullptr ? owner->map->first_node() : nullptr;
+        return *this;
+    }
+    map_cursor operator++(int) {
+        map_cursor other = *this;
+        ++*this;
+        return other;
+    }
+    map_cursor& operator--() {
+        node = node != nullptr ? node->prev() : owner != nullptr ? owner->map->last_node() : nullptr;
+        return *this;
+    }
+    map_cursor operator--(int) {
+        map_cursor other = *this;
+        --*this;
+        return other;
+    }
+    template <bool OtherConst>
+    bool operator==(const map_cursor<Map, OtherConst>& other) const {
+        return node == other.node;
+    }
+    template <bool OtherConst>
+    bool operator!=(const map_cursor<Map, OtherConst>& other) const {
+        return node != other.node;
+    }
+private:
+    map_cursor(node_type* node, tree_owner* owner) : node(node), owner(owner) {}
+    node_type* node = nullptr;
+    tree_owner* owner = nullptr;
+};
+
+// The cursors of a whole map, for range-based for loops.
+template <class Cursor>
+struct map_cursor_range {
+    Cursor first;
+    Cursor last;
+    Cursor begin() const {
+        return first;
+    }
+    Cursor end() const {
+        return last;
+    }
+};
+
+// Walks a map backwards. Unlike std::reverse_iterator, which keeps the
+// position after the element and steps back on every dereference, it pins
+// the element it points at, so it stays valid when that element is erased
+// and carries on from the nearest live key like the forward iterators.
+template <class Iterator>
+class map_reverse_iterator {
+public:
+    using iterator_type = Iterator;
+    using iterator_category = std::bidirectional_iterator_tag;
+    using difference_type = typename Iterator::difference_type;
+    using value_type = typename Iterator::value_type;
+    using pointer = typename Iterator::pointer;
+    using reference = typename Iterator::reference;
+    map_reverse_iterator() = default;
+    // Points at the element before base, as std::reverse_iterator does.
+    explicit map_reverse_iterator(Iterator base) : current(std::move(base)) {
+        --current;
+    }
+    template <class Other, class = std::enable_if_t<std::is_convertible_v<const Other&, Iterator>>>
+    map_reverse_iterator(const map_reverse_iterator<Other>& other) : current(other.current) {}
+    // The position after the element, so that std::prev(it.base()) is it.
+    Iterator base() const {
+        Iterator next = current;
+        return ++next;
+    }
+    reference operator*() const {
+        return *current;
+    }
+    pointer operator->() const {
+        return &*current;
+    }
+    map_reverse_iterator& operator++() {
+        --current;
+        return *this;
+    }
+    map_reverse_iterator operator++(int) {
+        map_reverse_iterator other(*this);
+        --current;
+        return other;
+    }
+    map_reverse_iterator& operator--() {
+        ++current;
+        return *this;
+    }
+    map_reverse_iterator operator--(int) {
+        map_reverse_iterator other(*this);
+        ++current;
+        return other;
+    }
+    template <class Other>
+    bool operator==(const map_reverse_iterator<Other>& other) const {
+        return current == other.current;
+    }
+    template <class Other>
+    bool operator!=(const map_reverse_iterator<Other>& other) const {
+        return current != other.current;
+    }
+private:
+    template <class Other>
+    friend class map_reverse_iterator;
+    Iterator current;
+};
\ No newline at end of file
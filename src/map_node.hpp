@@ -2,40 +2,168 @@
 
 #include "fwd.hpp"
 
-template <class V, class Allocator>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+// Only maps keeping order statistics pay for the subtree size, for the others
+// it is an empty base that takes no space.
+template <bool OrderStatistics>
+struct node_subtree_size {};
+
+template <>
+struct node_subtree_size<true> {
+    uint32_t subtree_size = 1;
+};
+
+// Links are plain pointers: a node is referenced once by the tree while it is
+// linked, once by every node_pointer pinning it and once by every erased node
+// whose parent it was at the time of erasure. Bookkeeping shares one word.
+// Traversal works on borrowed raw pointers and never touches ref_count, which
+// is atomic only so that readers sharing a const map can pin nodes at once.
+template <class V, bool OrderStatistics>
+class map_node : public node_subtree_size<OrderStatistics> {
+public:
+    static constexpr bool order_statistics = OrderStatistics;
+    template <class... Args>
+    map_node(Args&& ... args) : value(std::forward<Args>(args)...) {}
+    ~map_node() = default;
+    const auto& key() const {
+        return value.first;
+    }
+    map_node* prev() {
+        if (is_deleted) {
+            return nearest_not_deleted();
+        }
+        if (left != nullptr) {
+            return left->max();
+        }
+        return nearest_right_ancestor();
+    }
+    map_node* next() {
+        if (is_deleted) {
+           return nearest_not_deleted();
+        }
+        if (right != nullptr) {
+            return right->min();
+        }
+        return nearest_left_ancestor();
+    }
+    map_node* min() {
+        map_node* node = this;
+        while (node->left != nullptr) {
+            node = node->left;
+        }
+        return node;
+    }
+    map_node* max() {
+        map_node* node = this;
+        while (node->right != nullptr) {
+            node = node->right;
+        }
+        return node;
+    }
+    map_node* nearest_left_ancestor() {
+        map_node* node = this;
+        while (node->parent != nullptr) {
+            if (node->parent->left == node) {
+                return node->parent;
+            }
+            node = node->parent;
+        }
+        return nullptr;
+    }
+    map_node* nearest_right_ancestor() {
+        map_node* node = this;
+        while (node->parent != nullptr) {
+            if (node->parent->right == node) {
+                return node->parent;
+            }
+            node = node->parent;
+        }
+        return nullptr;
+    }
+    map_node* nearest_not_deleted() {
+        map_node* node = this;
+        while (node != nullptr && node->is_deleted) {
+            node = node->parent;
+        }
+        return node;
+    }
+    static std::size_t size(const map_node* node) {
+        return node == nullptr ? 0 : node->subtree_size;
+    }
+    // Index of a linked node in key order and the root of its tree.
+    std::pair<std::size_t, map_node*> position() {
+        std::size_t index = size(left);
+        map_node* node = this;
+        while (node->parent != nullptr) {
+            if (node->parent->right == node) {
+                index += size(node->parent->left) + 1;
+            }
+            node = node->parent;
+        }
+        return {index, node};
+    }
+    static map_node* select(map_node* node, std::size_t index) {
+        while (node != nullptr) {
+            std::size_t left_size = size(node->left);
+            if (index == left_size) {
+                return node;
+            }
+            if (index < left_size) {
+                node = node->left;
+            } else {
+                index -= left_size + 1;
+                node = node->right;
+            }
+        }
+        return nullptr;
+    }
+    map_node* left = nullptr;
+    map_node* right = nullptr;
+    map_node* parent = nullptr;
+    std::atomic<uint32_t> ref_count{0};
+    int8_t height = 1;
+    bool is_deleted = false;
+    // Set for nodes dropped by clear(), which have no tree to go back to.
+    bool is_detached = false;
+    V value;
+};
+
+// The defaulted destructor keeps nodes of trivially destructible elements
+// trivially destructible, which lets teardown skip destroying them.
+static_assert(std::is_trivially_destructible_v<map_node<std::pair<const int, int>, false>>);
+
+// Allocators other than std::allocator may do more in destroy() than run the
+// destructor, e.g. count the call, so only theirs is never skipped.
+template <class Alloc, class T, class = void>
+struct has_custom_destroy : std::false_type {};
+
+template <class Alloc, class T>
+struct has_custom_destroy<Alloc, T, std::void_t<decltype(std::declval<Alloc&>().destroy(std::declval<T*>()))>>
+    : std::bool_constant<!std::is_same_v<Alloc, std::allocator<T>>> {};
+
+template <class V, class Allocator, bool OrderStatistics>
 class node_pointer {
-private:
-    class map_node {
-    public:
-        template <class... Args>
-        map_node(Args&& ... args) : value(std::forward<Args>(args)...) {}
-        ~map_node() = default;
-        const auto& key() {
-            return value.first;
-        }
-        node_pointer left = nullptr;
-        node_pointer right = nullptr;
-        node_pointer parent = nullptr;
-        int8_t height = 1;
-        size_t ref_count = 0;
-        bool is_deleted = false;
-        V value;
-    };
 public:
-    using allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<map_node>;
+    using node_type = map_node<V, OrderStatistics>;
+    using allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<node_type>;
     node_pointer() = default;
-    template <class... Args>
-    node_pointer(allocator_type& allocator, Args&&... args) : allocator(&allocator) {
-        owned_node = std::allocator_traits<allocator_type>::allocate(allocator, 1);
-        std::allocator_traits<allocator_type>::construct(allocator, owned_node, std::forward<Args>(args)...);
-        owned_node->ref_count += 1;
+    node_pointer(node_type* node, allocator_type* allocator) : owned_node(node), allocator(allocator) {
+        if (owned_node != nullptr) {
+            owned_node->ref_count.fetch_add(1, std::memory_order_relaxed);
+        }
     }
     node_pointer(std::nullptr_t) {}
     node_pointer& operator=(std::nullptr_t) {
         release();
         return *this;
     }
-    node_pointer(const node_pointer& other) : allocator(other.allocator) {
+    node_pointer(const node_pointer& other) {
         acquire(other);
     }
     node_pointer& operator=(const node_pointer& other) {
@@ -46,115 +174,83 @@ public:
         acquire(other);
         return *this;
     }
-    map_node* operator->() {
+    node_type* operator->() const {
         return owned_node;
     }
-    bool operator==(node_pointer rhs) const {
+    node_type* get() const {
+        return owned_node;
+    }
+    bool operator==(const node_pointer& rhs) const {
         return owned_node == rhs.owned_node;
     }
-    bool operator!=(node_pointer rhs) const {
+    bool operator!=(const node_pointer& rhs) const {
         return owned_node != rhs.owned_node;
     }
+    bool operator==(std::nullptr_t) const {
+        return owned_node == nullptr;
+    }
+    bool operator!=(std::nullptr_t) const {
+        return owned_node != nullptr;
+    }
     ~node_pointer() {
         release();
     }
+    template <class... Args>
+    static node_type* create(allocator_type& allocator, Args&&... args) {
+        node_type* node = std::allocator_traits<allocator_type>::allocate(allocator, 1);
+        try {
+            std::allocator_traits<allocator_type>::construct(allocator, node, std::forward<Args>(args)...);
+        } catch (...) {
+            std::allocator_traits<allocator_type>::deallocate(allocator, node, 1);
+            throw;
+        }
+        return node;
+    }
+    // Nodes of trivially destructible elements are only deallocated.
+    static void destroy(node_type* node, allocator_type& allocator) {
+        if constexpr (!std::is_trivially_destructible_v<node_type> ||
+                      has_custom_destroy<allocator_type, node_type>::value) {
+            std::allocator_traits<allocator_type>::destroy(allocator, node);
+        }
+        std::allocator_traits<allocator_type>::deallocate(allocator, node, 1);
+    }
+    // Drops one reference; an erased node going away drops the reference it
+    // held on its parent, which may be erased and unreferenced as well.
+    static void release(node_type* node, allocator_type& allocator) {
+        while (node != nullptr) {
+            if (node->ref_count.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                return;
+            }
+            node_type* parent = node->is_deleted ? node->parent : nullptr;
+            destroy(node, allocator);
+            node = parent;
+        }
+    }
     void acquire(const node_pointer& other) {
         allocator = other.allocator;
         owned_node = other.owned_node;
         if (owned_node != nullptr) {
-            owned_node->ref_count += 1;
+            owned_node->ref_count.fetch_add(1, std::memory_order_relaxed);
         }
     }
     void release() {
         if (owned_node != nullptr) {
-            owned_node->ref_count -= 1;
-            if (owned_node->ref_count == 0) {
-                destroy();
-            }
+            release(owned_node, *allocator);
             owned_node = nullptr;
             allocator = nullptr;
         }
     }
-    void destroy() {
-        std::allocator_traits<allocator_type>::destroy(*allocator, owned_node);
-        std::allocator_traits<allocator_type>::deallocate(*allocator, owned_node, 1);
-    }
-    void force_destroy() {
-        if (owned_node == nullptr) {
-            return;
+    // Pins the new node before letting go of the current one, which may be
+    // the only thing keeping the new one alive.
+    void reset(node_type* node) {
+        if (node != nullptr) {
+            node->ref_count.fetch_add(1, std::memory_order_relaxed);
         }
-        if (owned_node->left != nullptr) {
-            owned_node->left.force_destroy();
-        }
-        if (owned_node->right != nullptr) {
-            owned_node->right.force_destroy();
-        }
-        if (owned_node->left == nullptr && owned_node->right == nullptr) {
-            owned_node->parent = nullptr;
-            destroy();
-            owned_node = nullptr;
-            allocator = nullptr;
-        }
-    }
-    node_pointer prev() {
-        if (owned_node->is_deleted) {
-            return nearest_not_deleted();
-        }
-        if (owned_node->left != nullptr) {
-            return owned_node->left.max();
-        }
-        return nearest_right_ancestor();
-    }
-    node_pointer next() {
-        if (owned_node->is_deleted) {
-           return nearest_not_deleted();
-        }
-        if (owned_node->right != nullptr) {
-            return owned_node->right.min();
-        }
-        return nearest_left_ancestor();
-    }
-    node_pointer min() {
-        node_pointer node = *this;
-        while (node->left != nullptr) {
-            node = node->left;
-        }
-        return node;
-    }
-    node_pointer max() {
-        node_pointer node = *this;
-        while (node->right != nullptr) {
-            node = node->right;
-        }
-        return node;
-    }
-    node_pointer nearest_left_ancestor() {
-        node_pointer node = *this;
-        while (node != nullptr) {
-            if (node->parent != nullptr && node->parent->left == node) {
-                return node->parent;
-            }
-            node = node->parent;
-        }
-        return nullptr;
-    }
-    node_pointer nearest_right_ancestor() {
-        node_pointer node = *this;
-        while (node != nullptr) {
-            if (node->parent != nullptr && node->parent->right == node) {
-                return node->parent;
-            }
-            node = node->parent;
-        }
-        return nullptr;
-    }
-    node_pointer nearest_not_deleted() {
-        node_pointer node = *this;
-        while (node != nullptr && node->is_deleted) {
-            node = node->parent;
-        }
-        return node;
+        allocator_type* node_allocator = allocator;
+        release();
+        owned_node = node;
+        allocator = node_allocator;
     }
-    map_node* owned_node = nullptr;
+    node_type* owned_node = nullptr;
     allocator_type* allocator = nullptr;
 };
\ No newline at end of file
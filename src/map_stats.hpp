@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace polyndrom {
+
+// Counters kept by an acid_map with statistic traits since it was created or
+// since reset_stats(). Without them stats() returns all zeros and no counter
+// is touched on any path.
+struct map_stats {
+    // Descents from the root by a point lookup, insertion or erasure.
+    uint64_t lookups = 0;
+    // Key comparisons of all operations, comparisons / lookups is the mean
+    // search depth.
+    uint64_t comparisons = 0;
+    uint64_t rotations = 0;
+    // Walks towards the root after an insertion or erasure, the nodes they
+    // visited and the longest of them; long walks with many rotations are
+    // rebalancing storms.
+    uint64_t retraces = 0;
+    uint64_t retrace_steps = 0;
+    uint64_t longest_retrace = 0;
+    uint64_t allocations = 0;
+    // Iterators pinning a node right now.
+    uint64_t pinned_iterators = 0;
+    // Erased nodes waiting for reclaim(), see deferred_reclamation.
+    uint64_t pending_reclamation = 0;
+};
+
+struct no_map_stats {};
+
+// Shape of the tree as returned by inspect(): the number of nodes at every
+// depth, the root being at depth zero, so that the height is the size of the
+// histogram.
+struct map_shape {
+    std::size_t height = 0;
+    std::vector<std::size_t> depth_histogram;
+};
+
+} // polyndrom
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+namespace polyndrom {
+
+// Optional features of acid_map, passed as its last template argument.
+struct default_map_traits {
+    // Keeps the size of every subtree in its root node, which enables nth(),
+    // rank() and random access iterators at the cost of a word per node and
+    // of walking up to the root on every insertion and erasure.
+    static constexpr bool order_statistics = false;
+    // Erased nodes whose last iterator goes away are queued on the map
+    // instead of being freed, together with the erased parents they kept
+    // alive, and freed by reclaim() or reclaim_batch at a time at the end of
+    // every insertion and erasure. Releasing an iterator is then O(1).
+    static constexpr bool deferred_reclamation = false;
+    static constexpr std::size_t reclaim_batch = 0;
+    // Counts comparisons, rotations, retrace lengths, allocations and pins
+    // for stats(), see map_stats.hpp.
+    static constexpr bool statistics = false;
+};
+
+struct order_statistic_traits : default_map_traits {
+    static constexpr bool order_statistics = true;
+};
+
+struct statistic_traits : default_map_traits {
+    static constexpr bool statistics = true;
+};
+
+struct deferred_reclamation_traits : default_map_traits {
+    static constexpr bool deferred_reclamation = true;
+    static constexpr std::size_t reclaim_batch = 16;
+};
+
+// Replaces the AVL nodes by a B+tree whose nodes hold up to Width keys,
+// see wide_node_map.hpp, which has to be included to use it. The layout
+// keeps no order statistics and no counters, so nth(), rank() and cursors
+// are rejected at compile time and stats() is all zeros.
+template <std::size_t Width = 32>
+struct wide_node_traits : default_map_traits {
+    static constexpr std::size_t node_width = Width;
+};
+
+// Traits asking for wide nodes, which the AVL layout refuses so that a
+// missing include cannot silently fall back to it.
+template <class Traits, class = void>
+struct has_node_width : std::false_type {};
+
+template <class Traits>
+struct has_node_width<Traits, std::void_t<decltype(Traits::node_width)>> : std::true_type {};
+
+} // polyndrom
\ No newline at end of file
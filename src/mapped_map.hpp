@@ -0,0 +1,377 @@
+#pragma once
+
+#include "acid_map.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace polyndrom {
+
+// How keys and values are laid out in a mapped file. Trivially copyable types
+// are stored as they are, other types need a specialization converting them
+// to and from a trivially copyable stored_type, such as a fixed size buffer
+// for short strings.
+template <class T, class = void>
+struct map_codec;
+
+template <class T>
+struct map_codec<T, std::enable_if_t<std::is_trivially_copyable_v<T>>> {
+    using stored_type = T;
+    static const T& encode(const T& value) {
+        return value;
+    }
+    static const T& decode(const stored_type& stored) {
+        return stored;
+    }
+};
+
+// Read-only map over a file written by save(). The nodes are stored in key
+// order and linked by their indices into a perfectly balanced tree, so the
+// file does not depend on where it is mapped: opening it only maps and checks
+// the header, pages are read in by the lookups and iterations that touch
+// them. Iteration is a sequential scan and nth() an index.
+//
+// With copy_on_write the mapping is private and writable, and values found by
+// find_writable() can be changed in place. Changed pages are copied in memory
+// and never written back to the file; the structure itself stays read-only.
+template <class Key, class T, class Compare>
+class mapped_acid_map {
+private:
+    using key_codec = map_codec<Key>;
+    using mapped_codec = map_codec<T>;
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using stored_key = typename key_codec::stored_type;
+    using stored_mapped = typename mapped_codec::stored_type;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using key_compare = Compare;
+    struct value_type {
+        stored_key first;
+        stored_mapped second;
+    };
+    class const_iterator;
+    using iterator = const_iterator;
+    static_assert(std::is_trivially_copyable_v<stored_key> && std::is_trivially_copyable_v<stored_mapped>,
+                  "mapped keys and values need a trivially copyable stored type");
+    explicit mapped_acid_map(const std::string& path, bool copy_on_write = false) : writable(copy_on_write) {
+        int file = ::open(path.c_str(), O_RDONLY);
+        if (file < 0) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        struct stat info;
+        if (::fstat(file, &info) != 0) {
+            ::close(file);
+            throw std::runtime_error("Cannot open " + path);
+        }
+        length = static_cast<size_type>(info.st_size);
+        if (length < sizeof(mapped_header)) {
+            ::close(file);
+            throw std::runtime_error("Not a mapped map: " + path);
+        }
+        int protection = copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ;
+        address = ::mmap(nullptr, length, protection, copy_on_write ? MAP_PRIVATE : MAP_SHARED, file, 0);
+        ::close(file);
+        if (address == MAP_FAILED) {
+            address = nullptr;
+            throw std::runtime_error("Cannot map " + path);
+        }
+        const auto* header = static_cast<const mapped_header*>(address);
+        bool valid = std::memcmp(header->magic, file_magic, sizeof(file_magic)) == 0 &&
+            header->version == file_version && header->node_size == sizeof(mapped_node) &&
+            header->nodes_offset == nodes_offset() &&
+            (length - nodes_offset()) / sizeof(mapped_node) >= header->count &&
+            (header->count == 0 ? header->root == no_node : header->root < header->count);
+        if (!valid) {
+            ::munmap(address, length);
+            address = nullptr;
+            throw std::runtime_error("Not a mapped map: " + path);
+        }
+        nodes = reinterpret_cast<mapped_node*>(static_cast<char*>(address) + nodes_offset());
+        node_count = static_cast<size_type>(header->count);
+        root = header->root;
+    }
+    mapped_acid_map(mapped_acid_map&& other) noexcept
+        : address(std::exchange(other.address, nullptr)), length(std::exchange(other.length, 0)),
+          nodes(std::exchange(other.nodes, nullptr)), node_count(std::exchange(other.node_count, 0)),
+          root(std::exchange(other.root, no_node)), writable(other.writable), comparator(other.comparator) {}
+    mapped_acid_map& operator=(mapped_acid_map&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            address = std::exchange(other.address, nullptr);
+            length = std::exchange(other.length, 0);
+            nodes = std::exchange(other.nodes, nullptr);
+            node_count = std::exchange(other.node_count, 0);
+            root = std::exchange(other.root, no_node);
+            writable = other.writable;
+            comparator = other.comparator;
+        }
+        return *this;
+    }
+    ~mapped_acid_map() {
+        unmap();
+    }
+    // Writes the elements of any map iterated in key order, which makes the
+    // file independent of the layout of the map it came from.
+    template <class Map>
+    static void save(const Map& map, const std::string& path) {
+        std::vector<std::pair<uint64_t, uint64_t>> links(map.size());
+        uint64_t root = link_range(links, 0, links.size());
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        mapped_header header{};
+        std::memcpy(header.magic, file_magic, sizeof(file_magic));
+        header.version = file_version;
+        header.node_size = sizeof(mapped_node);
+        header.count = links.size();
+        header.root = root;
+        header.nodes_offset = nodes_offset();
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::vector<char> padding(nodes_offset() - sizeof(header));
+        out.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+        size_type index = 0;
+        for (const auto& [key, mapped] : map) {
+            mapped_node node{{key_codec::encode(key), mapped_codec::encode(mapped)}, links[index].first,
+                             links[index].second};
+            out.write(reinterpret_cast<const char*>(&node), sizeof(node));
+            index++;
+        }
+        out.flush();
+        if (!out || index != links.size()) {
+            throw std::runtime_error("Cannot write " + path);
+        }
+    }
+    size_type size() const {
+        return node_count;
+    }
+    bool empty() const {
+        return node_count == 0;
+    }
+    const_iterator begin() const {
+        return const_iterator(nodes);
+    }
+    const_iterator end() const {
+        return const_iterator(nodes + node_count);
+    }
+    const_iterator cbegin() const {
+        return begin();
+    }
+    const_iterator cend() const {
+        return end();
+    }
+    template <class K>
+    const_iterator find(const K& key) const {
+        const mapped_node* node = lower_bound_node(key);
+        if (node == nodes + node_count || comparator(key, key_of(*node))) {
+            return end();
+        }
+        return const_iterator(node);
+    }
+    template <class K>
+    bool contains(const K& key) const {
+        return find(key) != end();
+    }
+    template <class K>
+    size_type count(const K& key) const {
+        return static_cast<size_type>(contains(key));
+    }
+    template <class K>
+    const stored_mapped& at(const K& key) const {
+        const_iterator it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("Key does not exists");
+        }
+        return it->second;
+    }
+    template <class K>
+    const_iterator lower_bound(const K& key) const {
+        return const_iterator(lower_bound_node(key));
+    }
+    template <class K>
+    const_iterator upper_bound(const K& key) const {
+        const mapped_node* result = nodes + node_count;
+        for (uint64_t index = root; index != no_node;) {
+            const mapped_node& node = nodes[index];
+            if (comparator(key, key_of(node))) {
+                result = &node;
+                index = node.left;
+            } else {
+                index = node.right;
+            }
+        }
+        return const_iterator(result);
+    }
+    template <class K>
+    std::pair<const_iterator, const_iterator> equal_range(const K& key) const {
+        return {lower_bound(key), upper_bound(key)};
+    }
+    const_iterator nth(size_type k) const {
+        return const_iterator(nodes + std::min(k, node_count));
+    }
+    // The value of an element to change in place, nullptr if there is none.
+    // Only available on maps opened with copy_on_write.
+    template <class K>
+    stored_mapped* find_writable(const K& key) {
+        if (!writable) {
+            throw std::logic_error("Map is mapped read-only");
+        }
+        const_iterator it = find(key);
+        if (it == end()) {
+            return nullptr;
+        }
+        return &nodes[it - begin()].value.second;
+    }
+private:
+    struct mapped_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t node_size;
+        uint64_t count;
+        uint64_t root;
+        uint64_t nodes_offset;
+    };
+    struct mapped_node {
+        value_type value;
+        uint64_t left;
+        uint64_t right;
+    };
+    static constexpr char file_magic[8] = {'A', 'C', 'I', 'D', 'M', 'A', 'P', '\0'};
+    static constexpr uint32_t file_version = 1;
+    static constexpr uint64_t no_node = ~uint64_t(0);
+    static constexpr size_type nodes_offset() {
+        return (sizeof(mapped_header) + alignof(mapped_node) - 1) / alignof(mapped_node) * alignof(mapped_node);
+    }
+    // Links the nodes of [low, high) below its middle one and returns it.
+    static uint64_t link_range(std::vector<std::pair<uint64_t, uint64_t>>& links, size_type low, size_type high) {
+        if (low == high) {
+            return no_node;
+        }
+        size_type middle = low + (high - low) / 2;
+        links[middle] = {link_range(links, low, middle), link_range(links, middle + 1, high)};
+        return middle;
+    }
+    static decltype(auto) key_of(const mapped_node& node) {
+        return key_codec::decode(node.value.first);
+    }
+    template <class K>
+    const mapped_node* lower_bound_node(const K& key) const {
+        const mapped_node* result = nodes + node_count;
+        for (uint64_t index = root; index != no_node;) {
+            const mapped_node& node = nodes[index];
+            if (comparator(key_of(node), key)) {
+                index = node.right;
+            } else {
+                result = &node;
+                index = node.left;
+            }
+        }
+        return result;
+    }
+    void unmap() {
+        if (address != nullptr) {
+            ::munmap(address, length);
+            address = nullptr;
+        }
+    }
+    void* address = nullptr;
+    size_type length = 0;
+    mapped_node* nodes = nullptr;
+    size_type node_count = 0;
+    uint64_t root = no_node;
+    bool writable = false;
+    key_compare comparator;
+};
+
+// Nodes are stored in key order, so iterators are plain node pointers.
+template <class Key, class T, class Compare>
+class mapped_acid_map<Key, T, Compare>::const_iterator {
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = typename mapped_acid_map::value_type;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+    const_iterator() = default;
+    reference operator*() const {
+        return node->value;
+    }
+    pointer operator->() const {
+        return &node->value;
+    }
+    reference operator[](difference_type n) const {
+        return node[n].value;
+    }
+    const_iterator& operator++() {
+        ++node;
+        return *this;
+    }
+    const_iterator operator++(int) {
+        return const_iterator(node++);
+    }
+    const_iterator& operator--() {
+        --node;
+        return *this;
+    }
+    const_iterator operator--(int) {
+        return const_iterator(node--);
+    }
+    const_iterator& operator+=(difference_type n) {
+        node += n;
+        return *this;
+    }
+    const_iterator& operator-=(difference_type n) {
+        node -= n;
+        return *this;
+    }
+    const_iterator operator+(difference_type n) const {
+        return const_iterator(node + n);
+    }
+    friend const_iterator operator+(difference_type n, const const_iterator& it) {
+        return it + n;
+    }
+    const_iterator operator-(difference_type n) const {
+        return const_iterator(node - n);
+    }
+    difference_type operator-(const const_iterator& other) const {
+        return node - other.node;
+    }
+    bool operator==(const const_iterator& other) const {
+        return node == other.node;
+    }
+    bool operator!=(const const_iterator& other) const {
+        return node != other.node;
+    }
+    bool operator<(const const_iterator& other) const {
+        return node < other.node;
+    }
+    bool operator>(const const_iterator& other) const {
+        return other < *this;
+    }
+    bool operator<=(const const_iterator& other) const {
+        return !(other < *this);
+    }
+    bool operator>=(const const_iterator& other) const {
+        return !(*this < other);
+    }
+private:
+    friend mapped_acid_map;
+    explicit const_iterator(const mapped_node* node) : node(node) {}
+    const mapped_node* node = nullptr;
+};
+
+} // polyndrom
\ No newline at end of file
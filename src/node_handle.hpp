@@ -0,0 +1,91 @@
+#pragma once
+
+#include <optional>
+#include <utility>
+
+namespace polyndrom {
+
+// Owns an element taken out of a map by extract(), together with a copy of
+// the allocator it came from, until insert() links the same element into a
+// map again. The handle holds the reference the tree held, so iterators that
+// still pin the element keep it alive and step away from it by key, as from
+// an erased element.
+template <class Map>
+class map_node_handle {
+private:
+    friend Map;
+    using stored_node = typename Map::extracted_node;
+    using stored_allocator = typename Map::extracted_allocator;
+public:
+    using key_type = typename Map::key_type;
+    using mapped_type = typename Map::mapped_type;
+    using allocator_type = typename Map::allocator_type;
+    map_node_handle() noexcept = default;
+    map_node_handle(map_node_handle&& other) noexcept
+        : node(std::exchange(other.node, nullptr)), allocator(std::move(other.allocator)) {
+        other.allocator.reset();
+    }
+    map_node_handle& operator=(map_node_handle&& other) noexcept {
+        if (this != &other) {
+            reset();
+            node = std::exchange(other.node, nullptr);
+            allocator = std::move(other.allocator);
+            other.allocator.reset();
+        }
+        return *this;
+    }
+    ~map_node_handle() {
+        reset();
+    }
+    bool empty() const noexcept {
+        return node == nullptr;
+    }
+    explicit operator bool() const noexcept {
+        return node != nullptr;
+    }
+    allocator_type get_allocator() const {
+        return allocator_type(*allocator);
+    }
+    // The key may be changed before the element is inserted again, which is
+    // how an element is re-keyed without reallocating it.
+    key_type& key() const {
+        return const_cast<key_type&>(node->value.first);
+    }
+    mapped_type& mapped() const {
+        return node->value.second;
+    }
+    void swap(map_node_handle& other) noexcept {
+        std::swap(node, other.node);
+        std::swap(allocator, other.allocator);
+    }
+    friend void swap(map_node_handle& lhs, map_node_handle& rhs) noexcept {
+        lhs.swap(rhs);
+    }
+private:
+    map_node_handle(stored_node* node, const stored_allocator& allocator) : node(node), allocator(allocator) {}
+    // Gives the element up to a map that took it over.
+    stored_node* release() {
+        allocator.reset();
+        return std::exchange(node, nullptr);
+    }
+    void reset() {
+        if (node != nullptr) {
+            Map::release_extracted(std::exchange(node, nullptr), *allocator);
+            allocator.reset();
+        }
+    }
+    stored_node* node = nullptr;
+    std::optional<stored_allocator> allocator;
+};
+
+// What insert() of a node handle returns, as insert_return_type of the
+// standard containers: the element inserted or the one that blocked it, in
+// which case the handle is handed back.
+template <class Iterator, class NodeHandle>
+struct map_insert_return {
+    Iterator position;
+    bool inserted;
+    NodeHandle node;
+};
+
+} // polyndrom
\ No newline at end of file
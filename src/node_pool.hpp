@@ -0,0 +1,315 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace polyndrom {
+
+struct node_pool_options {
+    // Size of the pages blocks are carved from.
+    std::size_t page_size = 64 * 1024;
+    // Guards the shared free lists, required when maps on different threads share a pool.
+    bool thread_safe = false;
+    // Keeps a small per-thread stash of blocks in front of the shared free lists,
+    // exchanged in batches. Implies thread_safe and needs the pool to be owned by
+    // a std::shared_ptr, as pool_allocator does.
+    bool thread_cache = false;
+    std::size_t thread_cache_size = 64;
+};
+
+// Slab allocator for fixed-size nodes. Requests are rounded up to one of the
+// size classes, every class bump-allocates from its current page and recycles
+// freed blocks through an intrusive free list. Pages are only returned to the
+// system when the pool is destroyed. Requests that are too large or
+// over-aligned go straight to operator new.
+class node_pool : public std::enable_shared_from_this<node_pool> {
+public:
+    static constexpr std::size_t granularity = 8;
+    static constexpr std::size_t max_block_size = 1024;
+    static constexpr std::size_t class_count = max_block_size / granularity;
+    explicit node_pool(const node_pool_options& options = node_pool_options())
+        : pool_options(options), pool_id(next_id()) {
+        if (pool_options.thread_cache) {
+            pool_options.thread_safe = true;
+        }
+        pool_options.thread_cache_size = std::max<std::size_t>(pool_options.thread_cache_size, 2);
+    }
+    node_pool(const node_pool&) = delete;
+    node_pool& operator=(const node_pool&) = delete;
+    ~node_pool() {
+        for (void* page : pages) {
+            ::operator delete(page);
+        }
+    }
+    static bool is_pooled(std::size_t size, std::size_t alignment) {
+        return size <= max_block_size && alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+    }
+    void* allocate(std::size_t size, std::size_t alignment) {
+        if (!is_pooled(size, alignment)) {
+            return ::operator new(size, std::align_val_t(alignment));
+        }
+        std::size_t index = class_index(size, alignment);
+        if (pool_options.thread_cache) {
+            if (cache_lists* lists = local_lists()) {
+                free_list& list = (*lists)[index];
+                if (list.head == nullptr) {
+                    refill(index, list);
+                }
+                return list.pop();
+            }
+        }
+        return with_lock([&] {
+            return take_block(index);
+        });
+    }
+    void deallocate(void* ptr, std::size_t size, std::size_t alignment) {
+        if (!is_pooled(size, alignment)) {
+            ::operator delete(ptr, std::align_val_t(alignment));
+            return;
+        }
+        std::size_t index = class_index(size, alignment);
+        if (pool_options.thread_cache) {
+            if (cache_lists* lists = local_lists()) {
+                free_list& list = (*lists)[index];
+                list.push(ptr);
+                if (list.size > pool_options.thread_cache_size) {
+                    flush(index, list, pool_options.thread_cache_size / 2);
+                }
+                return;
+            }
+        }
+        with_lock([&] {
+            classes[index].free.push(ptr);
+            return nullptr;
+        });
+    }
+    // Makes sure count blocks of the given size can be handed out without
+    // asking the system for more memory, and touches the pages up front so
+    // that they are faulted in before the first insertion.
+    void reserve(std::size_t size, std::size_t alignment, std::size_t count) {
+        if (!is_pooled(size, alignment)) {
+            return;
+        }
+        std::size_t index = class_index(size, alignment);
+        std::size_t block = block_size(index);
+        with_lock([&] {
+            size_class& cls = classes[index];
+            std::size_t available = cls.free.size + static_cast<std::size_t>(cls.bump_end - cls.bump) / block;
+            while (available < count) {
+                std::size_t blocks = std::max<std::size_t>(1, pool_options.page_size / block);
+                blocks = std::max(blocks, std::min(count - available, blocks * 64));
+                char* page = new_page(blocks * block);
+                for (std::size_t offset = 0; offset < blocks * block; offset += 4096) {
+                    page[offset] = 0;
+                }
+                for (char* ptr = cls.bump; ptr + block <= cls.bump_end; ptr += block) {
+                    cls.free.push(ptr);
+                }
+                cls.bump = page;
+                cls.bump_end = page + blocks * block;
+                available = cls.free.size + blocks;
+            }
+            return nullptr;
+        });
+    }
+    std::size_t reserved_bytes() const {
+        return reserved_size.load(std::memory_order_relaxed);
+    }
+    const node_pool_options& options() const {
+        return pool_options;
+    }
+private:
+    struct free_list {
+        struct block {
+            block* next;
+        };
+        void push(void* ptr) {
+            block* node = static_cast<block*>(ptr);
+            node->next = head;
+            head = node;
+            size += 1;
+        }
+        void* pop() {
+            block* node = head;
+            head = node->next;
+            size -= 1;
+            return node;
+        }
+        block* head = nullptr;
+        std::size_t size = 0;
+    };
+    struct size_class {
+        free_list free;
+        char* bump = nullptr;
+        char* bump_end = nullptr;
+    };
+    using cache_lists = std::array<free_list, class_count>;
+    struct thread_cache {
+        struct entry {
+            uint64_t pool_id;
+            std::weak_ptr<node_pool> pool;
+            cache_lists lists;
+        };
+        ~thread_cache() {
+            for (auto& cache : entries) {
+                if (auto pool = cache.pool.lock()) {
+                    for (std::size_t index = 0; index < class_count; index++) {
+                        pool->flush(index, cache.lists[index], 0);
+                    }
+                }
+            }
+        }
+        std::vector<entry> entries;
+    };
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> counter{0};
+        return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    // Blocks of a class are laid out back to back from a page start, so
+    // rounding the size up to the alignment keeps every block aligned.
+    static std::size_t class_index(std::size_t size, std::size_t alignment) {
+        std::size_t step = std::max(alignment, granularity);
+        size = (std::max<std::size_t>(size, 1) + step - 1) / step * step;
+        return size / granularity - 1;
+    }
+    static std::size_t block_size(std::size_t index) {
+        return (index + 1) * granularity;
+    }
+    template <class Fn>
+    void* with_lock(Fn&& fn) {
+        if (pool_options.thread_safe) {
+            std::lock_guard<std::mutex> guard(mutex);
+            return fn();
+        }
+        return fn();
+    }
+    char* new_page(std::size_t bytes) {
+        char* page = static_cast<char*>(::operator new(bytes));
+        try {
+            pages.push_back(page);
+        } catch (...) {
+            ::operator delete(page);
+            throw;
+        }
+        reserved_size.fetch_add(bytes, std::memory_order_relaxed);
+        return page;
+    }
+    void* take_block(std::size_t index) {
+        size_class& cls = classes[index];
+        if (cls.free.head != nullptr) {
+            return cls.free.pop();
+        }
+        std::size_t block = block_size(index);
+        if (cls.bump + block > cls.bump_end) {
+            std::size_t blocks = std::max<std::size_t>(1, pool_options.page_size / block);
+            cls.bump = new_page(blocks * block);
+            cls.bump_end = cls.bump + blocks * block;
+        }
+        void* ptr = cls.bump;
+        cls.bump += block;
+        return ptr;
+    }
+    // A thread meets a pool it has no entry for rarely, so that is when the
+    // entries of pools destroyed since are dropped, together with the blocks
+    // they still listed, which went away with their pages.
+    cache_lists* local_lists() {
+        static thread_local thread_cache cache;
+        for (auto& entry : cache.entries) {
+            if (entry.pool_id == pool_id) {
+                return &entry.lists;
+            }
+        }
+        std::weak_ptr<node_pool> self = weak_from_this();
+        if (self.expired()) {
+            return nullptr;
+        }
+        cache.entries.erase(std::remove_if(cache.entries.begin(), cache.entries.end(), [](const auto& entry) {
+            return entry.pool.expired();
+        }), cache.entries.end());
+        cache.entries.push_back({pool_id, std::move(self), {}});
+        return &cache.entries.back().lists;
+    }
+    void refill(std::size_t index, free_list& list) {
+        with_lock([&] {
+            std::size_t count = pool_options.thread_cache_size / 2;
+            for (std::size_t i = 0; i < count; i++) {
+                list.push(take_block(index));
+            }
+            return nullptr;
+        });
+    }
+    void flush(std::size_t index, free_list& list, std::size_t keep) {
+        with_lock([&] {
+            while (list.size > keep) {
+                classes[index].free.push(list.pop());
+            }
+            return nullptr;
+        });
+    }
+    node_pool_options pool_options;
+    uint64_t pool_id;
+    std::mutex mutex;
+    std::array<size_class, class_count> classes;
+    std::vector<void*> pages;
+    std::atomic<std::size_t> reserved_size{0};
+};
+
+// Allocator handle sharing a node_pool. A default constructed allocator owns
+// a fresh pool, copies and rebinds share it. A copied container gets a fresh
+// pool with the same options instead, so that a copy handed to another
+// thread never shares free lists that are not thread-safe; maps only share
+// a pool when they are given the same allocator explicitly.
+template <class T>
+class pool_allocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    pool_allocator() : shared_pool(std::make_shared<node_pool>()) {}
+    explicit pool_allocator(const node_pool_options& options) : shared_pool(std::make_shared<node_pool>(options)) {}
+    explicit pool_allocator(std::shared_ptr<node_pool> pool) : shared_pool(std::move(pool)) {}
+    template <class U>
+    pool_allocator(const pool_allocator<U>& other) : shared_pool(other.pool()) {}
+    pool_allocator select_on_container_copy_construction() const {
+        return pool_allocator(shared_pool->options());
+    }
+    T* allocate(std::size_t n) {
+        if (n == 1) {
+            return static_cast<T*>(shared_pool->allocate(sizeof(T), alignof(T)));
+        }
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* ptr, std::size_t n) {
+        if (n == 1) {
+            shared_pool->deallocate(ptr, sizeof(T), alignof(T));
+        } else {
+            std::allocator<T>().deallocate(ptr, n);
+        }
+    }
+    void reserve(std::size_t n) {
+        shared_pool->reserve(sizeof(T), alignof(T), n);
+    }
+    const std::shared_ptr<node_pool>& pool() const {
+        return shared_pool;
+    }
+    template <class U>
+    bool operator==(const pool_allocator<U>& other) const {
+        return shared_pool == other.pool();
+    }
+    template <class U>
+    bool operator!=(const pool_allocator<U>& other) const {
+        return shared_pool != other.pool();
+    }
+private:
+    std::shared_ptr<node_pool> shared_pool;
+};
+
+} // polyndrom
\ No newline at end of file
@@ -0,0 +1,315 @@
+#pragma once
+
+#include "acid_map.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace polyndrom {
+
+// Splits the key space into ordered ranges, each held by its own acid_map
+// behind its own lock and with its own allocator, so threads working on
+// different ranges do not contend. Every shard default constructs its
+// allocator: with pool_allocator that is a pool of its own, whose pages are
+// first touched by the threads inserting into that range. A shard split off
+// another keeps sharing its pool.
+//
+// Point operations and for_each lock one shard at a time and can be called
+// concurrently. Iterators chain the shards in key order but, like acid_map
+// iterators, must not be used while other threads modify the map. split()
+// cuts the tree of a shard in O(log n). merge() joins two trees in O(log n)
+// when the shards share an allocator, as shards split off one another do,
+// and otherwise first copies the upper shard in O(m). Both invalidate
+// iterators.
+template <class Key, class T, class Compare = std::less<Key>, class Allocator = std::allocator<std::pair<const Key, T>>>
+class sharded_acid_map {
+public:
+    using map_type = acid_map<Key, T, Compare, Allocator>;
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<const Key, T>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using key_compare = Compare;
+    using allocator_type = Allocator;
+    class iterator;
+    sharded_acid_map() {
+        shards.push_back(std::make_unique<shard>(std::nullopt));
+    }
+    // One shard per range between consecutive boundaries, which must be
+    // sorted and unique.
+    explicit sharded_acid_map(const std::vector<key_type>& boundaries) : sharded_acid_map() {
+        for (const key_type& boundary : boundaries) {
+            shards.push_back(std::make_unique<shard>(boundary));
+        }
+    }
+    template <class V>
+    bool insert(V&& value) {
+        return with_shard(value.first, [&](map_type& map) {
+            return map.insert(std::forward<V>(value)).second;
+        });
+    }
+    template <class K, class... Args>
+    bool try_emplace(K&& key, Args&&... args) {
+        return with_shard(key, [&](map_type& map) {
+            return map.try_emplace(std::forward<K>(key), std::forward<Args>(args)...).second;
+        });
+    }
+    template <class M>
+    bool insert_or_assign(const key_type& key, M&& value) {
+        return with_shard(key, [&](map_type& map) {
+            auto [it, inserted] = map.try_emplace(key, std::forward<M>(value));
+            if (!inserted) {
+                it->second = std::forward<M>(value);
+            }
+            return inserted;
+        });
+    }
+    template <class K>
+    size_type erase(const K& key) {
+        return with_shard(key, [&](map_type& map) {
+            return map.erase(key);
+        });
+    }
+    template <class K>
+    bool contains(const K& key) const {
+        return with_shard(key, [&](map_type& map) {
+            return map.contains(key);
+        });
+    }
+    template <class K>
+    size_type count(const K& key) const {
+        return static_cast<size_type>(contains(key));
+    }
+    template <class K>
+    std::optional<mapped_type> get(const K& key) const {
+        return with_shard(key, [&](map_type& map) -> std::optional<mapped_type> {
+            auto it = map.find(key);
+            if (it == map.end()) {
+                return std::nullopt;
+            }
+            return it->second;
+        });
+    }
+    // Calls fn with the element while its shard is locked.
+    template <class K, class Fn>
+    bool visit(const K& key, Fn fn) {
+        return with_shard(key, [&](map_type& map) {
+            auto it = map.find(key);
+            if (it == map.end()) {
+                return false;
+            }
+            fn(*it);
+            return true;
+        });
+    }
+    // Calls fn on every element with a key in [from, to) in order, locking
+    // one shard after another. fn must not modify the map.
+    template <class K1, class K2, class Fn>
+    void for_each_in_range(const K1& from, const K2& to, Fn fn) {
+        std::shared_lock<std::shared_mutex> directory(directory_mutex);
+        for (size_type index = locate(from); index < shards.size(); index++) {
+            shard& current = *shards[index];
+            if (current.lower.has_value() && !comparator(*current.lower, to)) {
+                break;
+            }
+            std::lock_guard<std::mutex> lock(current.mutex);
+            current.map.for_each_in_range(from, to, fn);
+        }
+    }
+    template <class Fn>
+    void for_each(Fn fn) {
+        std::shared_lock<std::shared_mutex> directory(directory_mutex);
+        for (auto& current : shards) {
+            std::lock_guard<std::mutex> lock(current->mutex);
+            for (auto& value : current->map) {
+                fn(value);
+            }
+        }
+    }
+    size_type size() const {
+        std::shared_lock<std::shared_mutex> directory(directory_mutex);
+        size_type total = 0;
+        for (auto& current : shards) {
+            std::lock_guard<std::mutex> lock(current->mutex);
+            total += current->map.size();
+        }
+        return total;
+    }
+    bool empty() const {
+        return size() == 0;
+    }
+    void clear() {
+        std::shared_lock<std::shared_mutex> directory(directory_mutex);
+        for (auto& current : shards) {
+            std::lock_guard<std::mutex> lock(current->mutex);
+            current->map.clear();
+        }
+    }
+    iterator begin() {
+        iterator it(this, 0, shards.front()->map.begin());
+        it.skip_empty();
+        return it;
+    }
+    iterator end() {
+        return iterator(this, shards.size() - 1, shards.back()->map.end());
+    }
+    size_type shard_count() const {
+        std::shared_lock<std::shared_mutex> directory(directory_mutex);
+        return shards.size();
+    }
+    size_type shard_size(size_type index) const {
+        std::shared_lock<std::shared_mutex> directory(directory_mutex);
+        std::lock_guard<std::mutex> lock(shards[index]->mutex);
+        return shards[index]->map.size();
+    }
+    // Point operations routed to the shard since it was created, the signal
+    // for which range is hot enough to split.
+    uint64_t shard_operations(size_type index) const {
+        std::shared_lock<std::shared_mutex> directory(directory_mutex);
+        return shards[index]->operations.load(std::memory_order_relaxed);
+    }
+    // Starts a new shard at the given key. Returns false if one already
+    // starts there. Everything that can throw happens before the shard is
+    // cut, so a split that throws leaves the map as it was.
+    bool split(const key_type& at) {
+        std::unique_lock<std::shared_mutex> directory(directory_mutex);
+        size_type index = locate(at);
+        shard& old = *shards[index];
+        if (old.lower.has_value() && !comparator(*old.lower, at)) {
+            return false;
+        }
+        auto upper = std::make_unique<shard>(at);
+        shards.insert(shards.begin() + static_cast<difference_type>(index) + 1, nullptr);
+        upper->map = old.map.split(at);
+        shards[index + 1] = std::move(upper);
+        return true;
+    }
+    // Splits the shard at its median key. Returns false if it holds fewer
+    // than two elements.
+    bool split_shard(size_type index) {
+        std::optional<key_type> median;
+        {
+            std::shared_lock<std::shared_mutex> directory(directory_mutex);
+            shard& current = *shards[index];
+            std::lock_guard<std::mutex> lock(current.mutex);
+            if (current.map.size() < 2) {
+                return false;
+            }
+            median.emplace(std::next(current.map.begin(), static_cast<difference_type>(current.map.size() / 2))->first);
+        }
+        return split(*median);
+    }
+    // Joins the shard with the one after it. Throws std::out_of_range if
+    // there is no shard after it. The upper shard's elements are copied
+    // into a map with the lower shard's allocator if the two differ, so a
+    // copy that throws leaves both shards as they were.
+    void merge(size_type index) {
+        std::unique_lock<std::shared_mutex> directory(directory_mutex);
+        if (index + 1 >= shards.size()) {
+            throw std::out_of_range("No shard after the merged one");
+        }
+        map_type& lower = shards[index]->map;
+        map_type& upper = shards[index + 1]->map;
+        if (lower.get_allocator() == upper.get_allocator()) {
+            lower.join(upper);
+        } else {
+            map_type copy(upper, lower.get_allocator());
+            lower.join(copy);
+        }
+        shards.erase(shards.begin() + static_cast<difference_type>(index) + 1);
+    }
+private:
+    struct shard {
+        explicit shard(std::optional<key_type> lower) : lower(std::move(lower)) {}
+        // Smallest key of the range, empty for the first shard.
+        std::optional<key_type> lower;
+        std::mutex mutex;
+        std::atomic<uint64_t> operations{0};
+        map_type map;
+    };
+    // Index of the last shard whose range starts at or before the key.
+    template <class K>
+    size_type locate(const K& key) const {
+        size_type low = 1;
+        size_type high = shards.size();
+        while (low < high) {
+            size_type middle = low + (high - low) / 2;
+            if (comparator(key, *shards[middle]->lower)) {
+                high = middle;
+            } else {
+                low = middle + 1;
+            }
+        }
+        return low - 1;
+    }
+    template <class K, class Fn>
+    decltype(auto) with_shard(const K& key, Fn fn) const {
+        std::shared_lock<std::shared_mutex> directory(directory_mutex);
+        shard& target = *shards[locate(key)];
+        target.operations.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(target.mutex);
+        return fn(target.map);
+    }
+    std::vector<std::unique_ptr<shard>> shards;
+    mutable std::shared_mutex directory_mutex;
+    key_compare comparator;
+};
+
+template <class Key, class T, class Compare, class Allocator>
+class sharded_acid_map<Key, T, Compare, Allocator>::iterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = typename sharded_acid_map::value_type;
+    using pointer = value_type*;
+    using reference = value_type&;
+    iterator() = default;
+    reference operator*() const {
+        return *position;
+    }
+    pointer operator->() const {
+        return &*position;
+    }
+    iterator& operator++() {
+        ++position;
+        skip_empty();
+        return *this;
+    }
+    iterator operator++(int) {
+        iterator other = *this;
+        ++*this;
+        return other;
+    }
+    bool operator==(const iterator& other) const {
+        return index == other.index && position == other.position;
+    }
+    bool operator!=(const iterator& other) const {
+        return !(*this == other);
+    }
+private:
+    friend sharded_acid_map;
+    iterator(sharded_acid_map* map, size_type index, typename map_type::iterator position)
+        : map(map), index(index), position(std::move(position)) {}
+    // Moves past the end of exhausted shards to the first element of the
+    // next non-empty one, stopping at the end of the last shard.
+    void skip_empty() {
+        while (index + 1 < map->shards.size() && position == map->shards[index]->map.end()) {
+            index++;
+            position = map->shards[index]->map.begin();
+        }
+    }
+    sharded_acid_map* map = nullptr;
+    size_type index = 0;
+    typename map_type::iterator position;
+};
+
+} // polyndrom
\ No newline at end of file
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "key_compare.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace polyndrom {
+
+template <class Key, class V, std::size_t Width>
+struct wide_leaf;
+
+// Element of a wide-node map. Leaves only hold a copy of its key and its
+// address, so the element itself never moves while leaves split and merge.
+// It is referenced once by the tree while it is linked and once by every
+// iterator pinning it, atomically so that readers may share a const map; an
+// erased element keeps its key, which is all an iterator needs to find its
+// way back.
+template <class Key, class V, std::size_t Width>
+struct wide_element {
+    template <class... Args>
+    wide_element(Args&&... args) : value(std::forward<Args>(args)...) {}
+    const auto& key() const {
+        return value.first;
+    }
+    wide_leaf<Key, V, Width>* leaf = nullptr;
+    std::atomic<uint32_t> ref_count{1};
+    bool is_deleted = false;
+    V value;
+};
+
+struct wide_node_base {
+    uint32_t count = 0;
+};
+
+// Sorted keys of up to Width elements, with the leaves chained in key order.
+template <class Key, class V, std::size_t Width>
+struct wide_leaf : wide_node_base {
+    wide_leaf* prev = nullptr;
+    wide_leaf* next = nullptr;
+    std::array<Key, Width> keys;
+    std::array<wide_element<Key, V, Width>*, Width> elements;
+};
+
+// keys[i] is the smallest key of children[i + 1] at the time it was split
+// off, everything in children[i] is less than it.
+template <class Key, std::size_t Width>
+struct wide_inner : wide_node_base {
+    std::array<Key, Width - 1> keys;
+    std::array<wide_node_base*, Width> children;
+};
+
+// Keys compared by std::less that are plain 32 or 64 bit integers are
+// searched with vector compares, other arithmetic keys with a branch-free
+// scan, everything else with a binary search.
+template <class Compare, class Key, class K>
+inline constexpr bool use_wide_scan = is_default_less<Compare, Key>::value && std::is_same_v<Key, K> &&
+    std::is_arithmetic_v<Key>;
+
+template <bool Upper, class Key>
+std::size_t wide_scan_rank(const Key* keys, std::size_t count, Key key) {
+    std::size_t rank = 0;
+    std::size_t i = 0;
+    if constexpr (std::is_integral_v<Key> && (sizeof(Key) == 4 || sizeof(Key) == 8)) {
+#if defined(__AVX2__)
+        if constexpr (sizeof(Key) == 4) {
+            // Flipping the sign bit maps unsigned order onto signed order.
+            const __m256i bias = _mm256_set1_epi32(std::is_signed_v<Key> ? 0 : INT32_MIN);
+            const __m256i needle = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int32_t>(key)), bias);
+            for (; i + 8 <= count; i += 8) {
+                __m256i data = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), bias);
+                __m256i mask = Upper ? _mm256_cmpgt_epi32(data, needle) : _mm256_cmpgt_epi32(needle, data);
+                int lanes = __builtin_popcount(static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(mask))));
+                rank += static_cast<std::size_t>(Upper ? 8 - lanes : lanes);
+            }
+        } else {
+            const __m256i bias = _mm256_set1_epi64x(std::is_signed_v<Key> ? 0 : INT64_MIN);
+            const __m256i needle = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<int64_t>(key)), bias);
+            for (; i + 4 <= count; i += 4) {
+                __m256i data = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), bias);
+                __m256i mask = Upper ? _mm256_cmpgt_epi64(data, needle) : _mm256_cmpgt_epi64(needle, data);
+                int lanes = __builtin_popcount(static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(mask))));
+                rank += static_cast<std::size_t>(Upper ? 4 - lanes : lanes);
+            }
+        }
+#elif defined(__SSE2__)
+        if constexpr (sizeof(Key) == 4) {
+            const __m128i bias = _mm_set1_epi32(std::is_signed_v<Key> ? 0 : INT32_MIN);
+            const __m128i needle = _mm_xor_si128(_mm_set1_epi32(static_cast<int32_t>(key)), bias);
+            for (; i + 4 <= count; i += 4) {
+                __m128i data = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), bias);
+                __m128i mask = Upper ? _mm_cmpgt_epi32(data, needle) : _mm_cmpgt_epi32(needle, data);
+                int lanes = __builtin_popcount(static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(mask))));
+                rank += static_cast<std::size_t>(Upper ? 4 - lanes : lanes);
+            }
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        if constexpr (sizeof(Key) == 4) {
+            using lane_type = std::conditional_t<std::is_signed_v<Key>, int32_t, uint32_t>;
+            for (; i + 4 <= count; i += 4) {
+                uint32x4_t mask;
+                if constexpr (std::is_signed_v<Key>) {
+                    int32x4_t data = vld1q_s32(reinterpret_cast<const lane_type*>(keys + i));
+                    int32x4_t needle = vdupq_n_s32(static_cast<lane_type>(key));
+                    mask = Upper ? vcleq_s32(data, needle) : vcltq_s32(data, needle);
+                } else {
+                    uint32x4_t data = vld1q_u32(reinterpret_cast<const lane_type*>(keys + i));
+                    uint32x4_t needle = vdupq_n_u32(static_cast<lane_type>(key));
+                    mask = Upper ? vcleq_u32(data, needle) : vcltq_u32(data, needle);
+                }
+                rank += vaddvq_u32(vshrq_n_u32(mask, 31));
+            }
+        } else {
+            using lane_type = std::conditional_t<std::is_signed_v<Key>, int64_t, uint64_t>;
+            for (; i + 2 <= count; i += 2) {
+                uint64x2_t mask;
+                if constexpr (std::is_signed_v<Key>) {
+                    int64x2_t data = vld1q_s64(reinterpret_cast<const lane_type*>(keys + i));
+                    int64x2_t needle = vdupq_n_s64(static_cast<lane_type>(key));
+                    mask = Upper ? vcleq_s64(data, needle) : vcltq_s64(data, needle);
+                } else {
+                    uint64x2_t data = vld1q_u64(reinterpret_cast<const lane_type*>(keys + i));
+                    uint64x2_t needle = vdupq_n_u64(static_cast<lane_type>(key));
+                    mask = Upper ? vcleq_u64(data, needle) : vcltq_u64(data, needle);
+                }
+                rank += vaddvq_u64(vshrq_n_u64(mask, 63));
+            }
+        }
+#endif
+    }
+    for (; i < count; i++) {
+        rank += Upper ? !(key < keys[i]) : keys[i] < key;
+    }
+    return rank;
+}
+
+// Number of the first count keys that are less than key, or with Upper
+// that are not greater than it.
+template <bool Upper, class Key, class K, class Compare>
+std::size_t wide_rank(const Key* keys, std::size_t count, const K& key, const Compare& comparator) {
+    if constexpr (use_wide_scan<Compare, Key, K>) {
+        return wide_scan_rank<Upper>(keys, count, key);
+    } else {
+        std::size_t low = 0;
+        std::size_t high = count;
+        while (low < high) {
+            std::size_t middle = low + (high - low) / 2;
+            bool before = Upper ? !comparator(key, keys[middle]) : comparator(keys[middle], key);
+            if (before) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low;
+    }
+}
+
+} // polyndrom
\ No newline at end of file
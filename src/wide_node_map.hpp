@@ -0,0 +1,1546 @@
+#pragma once
+
+#include "acid_map.hpp"
+#include "wide_node.hpp"
+
+#include <array>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace polyndrom {
+
+template <class Map, bool Const = false>
+class wide_node_iterator;
+
+template <class Map>
+class wide_tree_verifier;
+
+// B+tree behind acid_map with wide_node_traits. Inner nodes and leaves hold
+// up to Width sorted keys, so a lookup touches about log_Width(n) nodes and
+// iteration walks the leaves in order. Elements are allocated one by one and
+// leaves only point at them, which keeps references and iterators stable
+// under the same rules as the AVL layout: an iterator pins its element, and
+// stepping away from an erased element continues at the nearest live key
+// after or before it. Keys are copied into the leaves, so they have to be
+// default constructible and copyable, and moving them must not throw.
+template <class Key, class T, class Compare, class Allocator, std::size_t Width>
+class wide_node_map {
+private:
+    static_assert(Width >= 4 && Width <= 256, "node width must be between 4 and 256");
+    static_assert(std::is_default_constructible_v<Key> && std::is_copy_constructible_v<Key> &&
+                  std::is_nothrow_move_assignable_v<Key>,
+                  "wide nodes need default constructible, copyable and nothrow movable keys");
+    template <class Map, bool Const>
+    friend class wide_node_iterator;
+    template <class Map>
+    friend class wide_tree_verifier;
+    friend map_node_handle<wide_node_map>;
+    using self_type = wide_node_map<Key, T, Compare, Allocator, Width>;
+    using map_type = acid_map<Key, T, Compare, Allocator, wide_node_traits<Width>>;
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<const Key, T>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using key_compare = Compare;
+    using allocator_type = Allocator;
+    using traits_type = wide_node_traits<Width>;
+    using reference = value_type&;
+    using const_reference = const value_type&;
+    using pointer = typename std::allocator_traits<Allocator>::pointer;
+    using const_pointer = typename std::allocator_traits<Allocator>::const_pointer;
+    using iterator = wide_node_iterator<self_type>;
+    using const_iterator = wide_node_iterator<self_type, true>;
+    using reverse_iterator = map_reverse_iterator<iterator>;
+    using const_reverse_iterator = map_reverse_iterator<const_iterator>;
+    using node_type = map_node_handle<self_type>;
+    using insert_return_type = map_insert_return<iterator, node_type>;
+private:
+    using element_type = wide_element<Key, value_type, Width>;
+    using leaf_type = wide_leaf<Key, value_type, Width>;
+    using inner_type = wide_inner<Key, Width>;
+    template <class U>
+    using rebind_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<U>;
+    using extracted_node = element_type;
+    using extracted_allocator = rebind_allocator<element_type>;
+    // Leaves are searched with Compare alone, so only a transparent one takes
+    // keys of another type as they are.
+    template <class K>
+    static constexpr bool is_leaf_key = std::is_same_v<K, Key> || is_transparent_compare<Compare>::value;
+    template <class K>
+    static constexpr bool is_position = std::is_convertible_v<const K&, const_iterator>;
+    struct node_allocators {
+        explicit node_allocators(const Allocator& allocator)
+            : elements(allocator), leaves(allocator), inners(allocator) {}
+        rebind_allocator<element_type> elements;
+        rebind_allocator<leaf_type> leaves;
+        rebind_allocator<inner_type> inners;
+    };
+    // Nodes below the root never drop under min_count entries, which keeps
+    // the height far below this even for the smallest width.
+    static constexpr size_type max_depth = 64;
+    // Nodes with fewer entries are merged with or refilled from a sibling.
+    static constexpr size_type min_count = Width / 4 < 2 ? 2 : Width / 4;
+    struct position {
+        leaf_type* leaf;
+        size_type index;
+    };
+    // The owner of the tree, handed over with it like the AVL layout's, and
+    // the element allocator the last iterator on an erased element frees it
+    // with, also when the map is const.
+    struct tree_owner {
+        wide_node_map* map;
+        rebind_allocator<element_type> elements;
+    };
+    struct search_path {
+        std::array<inner_type*, max_depth> nodes;
+        std::array<uint32_t, max_depth> slots;
+        size_type depth = 0;
+        leaf_type* leaf = nullptr;
+        size_type index = 0;
+    };
+public:
+    wide_node_map(const allocator_type& allocator = allocator_type()) : allocators(allocator) {}
+    template <class InputIt>
+    wide_node_map(InputIt first, InputIt last, const allocator_type& allocator = allocator_type())
+        : allocators(allocator) {
+        insert(first, last);
+    }
+    template <class InputIt>
+    wide_node_map(sorted_unique_t, InputIt first, InputIt last, const allocator_type& allocator = allocator_type())
+        : allocators(allocator) {
+        insert(sorted_unique, first, last);
+    }
+    // Leaves only point at their elements, so a copy inserts the elements
+    // one after another in key order.
+    wide_node_map(const wide_node_map& other)
+        : wide_node_map(other, std::allocator_traits<allocator_type>::select_on_container_copy_construction(
+                                   other.get_allocator())) {}
+    wide_node_map(const wide_node_map& other, const allocator_type& allocator)
+        : comparator(other.comparator), allocators(allocator) {
+        insert(sorted_unique, other.begin(), other.end());
+    }
+    // Same rules for iterators as the AVL layout: they follow the tree,
+    // end() included, into this map.
+    wide_node_map(wide_node_map&& other) noexcept
+        : root(std::exchange(other.root, nullptr)), height(std::exchange(other.height, 0)),
+          first_leaf(std::exchange(other.first_leaf, nullptr)), last_leaf(std::exchange(other.last_leaf, nullptr)),
+          map_size(std::exchange(other.map_size, 0)), comparator(other.comparator), allocators(other.allocators),
+          owner(std::move(other.owner)) {
+        if (owner != nullptr) {
+            owner->map = this;
+        }
+    }
+    wide_node_map& operator=(const wide_node_map& other) {
+        if (this != &other) {
+            using propagate = typename std::allocator_traits<allocator_type>::propagate_on_container_copy_assignment;
+            wide_node_map copy(other, propagate::value ? other.get_allocator() : get_allocator());
+            swap(copy);
+        }
+        return *this;
+    }
+    wide_node_map& operator=(wide_node_map&& other) noexcept(
+        std::allocator_traits<allocator_type>::propagate_on_container_move_assignment::value ||
+        std::allocator_traits<allocator_type>::is_always_equal::value) {
+        if (this == &other) {
+            return *this;
+        }
+        using propagate = typename std::allocator_traits<allocator_type>::propagate_on_container_move_assignment;
+        if (propagate::value || allocators.elements == other.allocators.elements) {
+            wide_node_map taken(std::move(other));
+            swap(taken);
+        } else {
+            clear();
+            comparator = other.comparator;
+            insert(sorted_unique, std::make_move_iterator(other.begin()), std::make_move_iterator(other.end()));
+            other.clear();
+        }
+        return *this;
+    }
+    void swap(wide_node_map& other) noexcept {
+        using std::swap;
+        swap(root, other.root);
+        swap(height, other.height);
+        swap(first_leaf, other.first_leaf);
+        swap(last_leaf, other.last_leaf);
+        swap(map_size, other.map_size);
+        swap(comparator, other.comparator);
+        swap(allocators.elements, other.allocators.elements);
+        swap(allocators.leaves, other.allocators.leaves);
+        swap(allocators.inners, other.allocators.inners);
+        swap(owner, other.owner);
+        for (wide_node_map* map : {this, &other}) {
+            if (map->owner != nullptr) {
+                map->owner->map = map;
+            }
+        }
+    }
+    template <class K>
+    iterator find(const K& key) {
+        return make_iterator(find_element(key));
+    }
+    // As with the AVL layout, the const overloads only read the tree and a
+    // const_iterator writes nothing but its element's reference count.
+    template <class K>
+    const_iterator find(const K& key) const {
+        return make_const_iterator(find_element(key));
+    }
+    template <typename K>
+    mapped_type& operator[](K&& key) {
+        return try_emplace(std::forward<K>(key)).first->second;
+    }
+    mapped_type& at(const key_type& key) {
+        return at_element(key)->value.second;
+    }
+    const mapped_type& at(const key_type& key) const {
+        return at_element(key)->value.second;
+    }
+    template <class K, class = std::enable_if_t<is_leaf_key<K>>>
+    mapped_type& at(const K& key) {
+        return at_element(key)->value.second;
+    }
+    template <class K, class = std::enable_if_t<is_leaf_key<K>>>
+    const mapped_type& at(const K& key) const {
+        return at_element(key)->value.second;
+    }
+    template <class K>
+    bool contains(const K& key) const {
+        return find_element(key) != nullptr;
+    }
+    template <class K>
+    size_type count(const K& key) const {
+        return static_cast<size_type>(contains(key));
+    }
+    template <class K>
+    iterator lower_bound(const K& key) {
+        return make_iterator(element_at(locate<false>(key)));
+    }
+    template <class K>
+    const_iterator lower_bound(const K& key) const {
+        return make_const_iterator(element_at(locate<false>(key)));
+    }
+    template <class K>
+    iterator upper_bound(const K& key) {
+        return make_iterator(element_at(locate<true>(key)));
+    }
+    template <class K>
+    const_iterator upper_bound(const K& key) const {
+        return make_const_iterator(element_at(locate<true>(key)));
+    }
+    template <class K>
+    std::pair<iterator, iterator> equal_range(const K& key) {
+        auto [first, last] = equal_range_elements(key);
+        return std::make_pair(make_iterator(first), make_iterator(last));
+    }
+    template <class K>
+    std::pair<const_iterator, const_iterator> equal_range(const K& key) const {
+        auto [first, last] = equal_range_elements(key);
+        return std::make_pair(make_const_iterator(first), make_const_iterator(last));
+    }
+    // Only a few levels deep, so the keys are simply looked up one by one.
+    template <class ForwardIt, class OutputIt>
+    OutputIt find_batch(ForwardIt first, ForwardIt last, OutputIt out) {
+        for (; first != last; ++first) {
+            *out++ = find(*first);
+        }
+        return out;
+    }
+    template <class ForwardIt, class OutputIt>
+    OutputIt find_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+        for (; first != last; ++first) {
+            *out++ = find(*first);
+        }
+        return out;
+    }
+    template <class ForwardIt, class OutputIt>
+    OutputIt contains_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+        for (; first != last; ++first) {
+            *out++ = contains(*first);
+        }
+        return out;
+    }
+    // Calls fn on every element with a key in [from, to) in order, comparing
+    // against the keys stored in the leaves. fn must not insert or erase
+    // elements of this map.
+    template <class K1, class K2, class Fn>
+    void for_each_in_range(const K1& from, const K2& to, Fn fn) {
+        visit_range(from, to, [&](element_type* element) {
+            fn(element->value);
+        });
+    }
+    template <class K1, class K2, class Fn>
+    void for_each_in_range(const K1& from, const K2& to, Fn fn) const {
+        visit_range(from, to, [&](const element_type* element) {
+            fn(element->value);
+        });
+    }
+    template <class V>
+    std::pair<iterator, bool> insert(V&& value) {
+        const auto& key = lookup_key(value.first);
+        search_path path;
+        descend(key, path);
+        if (element_type* existing = found(path, key)) {
+            return std::make_pair(make_iterator(existing), false);
+        }
+        return std::make_pair(make_iterator(link(path, create_element(std::forward<V>(value)))), true);
+    }
+    template <class ...Args>
+    std::pair<iterator, bool> emplace(Args&& ...args) {
+        element_type* element = create_element(std::forward<Args>(args)...);
+        search_path path;
+        descend(element->key(), path);
+        if (element_type* existing = found(path, element->key())) {
+            destroy_element(element);
+            return std::make_pair(make_iterator(existing), false);
+        }
+        return std::make_pair(make_iterator(link(path, element)), true);
+    }
+    template <class K, class ...Args>
+    std::pair<iterator, bool> try_emplace(K&& key, Args&& ...args) {
+        if constexpr (!is_leaf_key<std::decay_t<K>>) {
+            return try_emplace(key_type(std::forward<K>(key)), std::forward<Args>(args)...);
+        } else {
+            search_path path;
+            descend(key, path);
+            if (element_type* existing = found(path, key)) {
+                return std::make_pair(make_iterator(existing), false);
+            }
+            element_type* element = create_element(std::piecewise_construct,
+                                                   std::forward_as_tuple(std::forward<K>(key)),
+                                                   std::forward_as_tuple(std::forward<Args>(args)...));
+            return std::make_pair(make_iterator(link(path, element)), true);
+        }
+    }
+    // The descent is only a few wide nodes deep, so hints are accepted for
+    // compatibility and not used.
+    template <class V, class = std::enable_if_t<std::is_constructible_v<value_type, V&&>>>
+    iterator insert(const_iterator, V&& value) {
+        return insert(std::forward<V>(value)).first;
+    }
+    template <class ...Args>
+    iterator emplace_hint(const_iterator, Args&& ...args) {
+        return emplace(std::forward<Args>(args)...).first;
+    }
+    template <class InputIt>
+    void insert(InputIt first, InputIt last) {
+        for (; first != last; ++first) {
+            emplace(*first);
+        }
+    }
+    // Fills the leaves one after another when the map is empty, in O(n).
+    // Otherwise the elements are inserted one by one, every descent being
+    // only a few wide nodes deep.
+    template <class InputIt>
+    void insert(sorted_unique_t, InputIt first, InputIt last) {
+        constexpr bool is_forward = std::is_base_of_v<std::forward_iterator_tag,
+            typename std::iterator_traits<InputIt>::iterator_category>;
+        if constexpr (is_forward) {
+            if (root == nullptr) {
+                build_from(static_cast<size_type>(std::distance(first, last)), [&] {
+                    return create_element(*first++);
+                });
+                return;
+            }
+        }
+        insert(first, last);
+    }
+    size_type erase(const key_type& key) {
+        return erase_key(key);
+    }
+    template <class K, class = std::enable_if_t<is_leaf_key<K> && !is_position<K>>>
+    size_type erase(const K& key) {
+        return erase_key(key);
+    }
+    // An element that is already erased or extracted is left alone, as in
+    // the AVL layout, and the iterator after it is returned.
+    iterator erase(const_iterator pos) {
+        element_type* element = pos.element;
+        element_type* next = next_element(element);
+        if (element->is_deleted) {
+            return make_iterator(next);
+        }
+        search_path path;
+        descend(element->key(), path);
+        unlink(path);
+        return make_iterator(next);
+    }
+    iterator erase(iterator pos) {
+        return erase(const_iterator(pos));
+    }
+    // Elements are allocated apart from the leaves, so extracting one only
+    // removes its key from a leaf and reinserting it only adds the key back.
+    node_type extract(const_iterator pos) {
+        if (pos.element->is_deleted) {
+            return node_type();
+        }
+        search_path path;
+        descend(pos.element->key(), path);
+        return node_type(detach_element(path), allocators.elements);
+    }
+    node_type extract(const key_type& key) {
+        return extract_key(key);
+    }
+    template <class K, class = std::enable_if_t<is_leaf_key<K> && !is_position<K>>>
+    node_type extract(const K& key) {
+        return extract_key(key);
+    }
+    insert_return_type insert(node_type&& handle) {
+        if (handle.empty()) {
+            return {end(), false, node_type()};
+        }
+        search_path path;
+        descend(handle.key(), path);
+        if (element_type* existing = found(path, handle.key())) {
+            return {make_iterator(existing), false, std::move(handle)};
+        }
+        return {make_iterator(link_extracted(path, handle)), true, node_type()};
+    }
+    iterator insert(const_iterator, node_type&& handle) {
+        if (handle.empty()) {
+            return end();
+        }
+        search_path path;
+        descend(handle.key(), path);
+        if (element_type* existing = found(path, handle.key())) {
+            return make_iterator(existing);
+        }
+        return make_iterator(link_extracted(path, handle));
+    }
+    iterator begin() {
+        return make_iterator(first_element());
+    }
+    const_iterator begin() const {
+        return make_const_iterator(first_element());
+    }
+    const_iterator cbegin() const {
+        return begin();
+    }
+    iterator end() {
+        return make_iterator(nullptr);
+    }
+    const_iterator end() const {
+        return make_const_iterator(nullptr);
+    }
+    const_iterator cend() const {
+        return end();
+    }
+    reverse_iterator rbegin() {
+        return reverse_iterator(end());
+    }
+    const_reverse_iterator rbegin() const {
+        return const_reverse_iterator(end());
+    }
+    const_reverse_iterator crbegin() const {
+        return rbegin();
+    }
+    reverse_iterator rend() {
+        return reverse_iterator(begin());
+    }
+    const_reverse_iterator rend() const {
+        return const_reverse_iterator(begin());
+    }
+    const_reverse_iterator crend() const {
+        return rend();
+    }
+    // See acid_map::save() and open_mmap().
+    template <class Mapped = mapped_acid_map<Key, T, Compare>>
+    void save(const std::string& path) const {
+        Mapped::save(*this, path);
+    }
+    template <class Mapped = mapped_acid_map<Key, T, Compare>>
+    static Mapped open_mmap(const std::string& path, bool copy_on_write = false) {
+        return Mapped(path, copy_on_write);
+    }
+    size_type size() const {
+        return map_size;
+    }
+    bool empty() const {
+        return map_size == 0;
+    }
+    allocator_type get_allocator() const {
+        return allocator_type(allocators.elements);
+    }
+    void reserve(size_type n) {
+        if constexpr (allocator_has_reserve<rebind_allocator<element_type>>::value) {
+            if (n > map_size) {
+                allocators.elements.reserve(n - map_size);
+            }
+        }
+    }
+    void clear() {
+        teardown(std::exchange(root, nullptr), std::exchange(height, 0), allocators);
+        first_leaf = nullptr;
+        last_leaf = nullptr;
+        map_size = 0;
+    }
+    // Detaches all elements in O(1) and frees them on the reclaimer's thread.
+    // No iterator into the map may be alive, and the allocator must be safe
+    // to use from the reclaimer's thread.
+    void clear(background_reclaimer& reclaimer) {
+        wide_node_base* detached = std::exchange(root, nullptr);
+        size_type levels = std::exchange(height, 0);
+        first_leaf = nullptr;
+        last_leaf = nullptr;
+        map_size = 0;
+        if (detached != nullptr) {
+            reclaimer.submit([detached, levels, copy = allocators]() mutable {
+                teardown(detached, levels, copy);
+            });
+        }
+    }
+    // Moves the elements with keys not less than key into the returned map,
+    // which shares this map's allocator. Elements are not reallocated, so
+    // iterators stay on them, with the same caveat as in the AVL layout, but
+    // both maps get new leaves filled from the old ones in O(n) instead of a
+    // tree cut along one path.
+    template <class K>
+    map_type split(const K& requested) {
+        const auto& key = lookup_key(requested);
+        map_type upper(get_allocator());
+        upper.comparator = comparator;
+        std::vector<element_type*> lower_elements;
+        std::vector<element_type*> upper_elements;
+        for (leaf_type* leaf = first_leaf; leaf != nullptr; leaf = leaf->next) {
+            for (size_type i = 0; i < leaf->count; i++) {
+                (is_less(leaf->keys[i], key) ? lower_elements : upper_elements).push_back(leaf->elements[i]);
+            }
+        }
+        built_tree lower_tree = build(lower_elements);
+        built_tree upper_tree;
+        try {
+            upper_tree = upper.build(upper_elements);
+        } catch (...) {
+            free_nodes(lower_tree.root, lower_tree.height, allocators);
+            throw;
+        }
+        install(lower_tree, lower_elements.size());
+        upper.install(upper_tree, upper_elements.size());
+        return upper;
+    }
+    // Takes over all elements of other, whose keys must all be less or all be
+    // greater than the keys of this map, and throws std::invalid_argument if
+    // they overlap. Elements change maps without being reallocated; the
+    // leaves are refilled in O(n + m). Maps with unequal allocators move the
+    // elements one by one.
+    void join(wide_node_map& other) {
+        if (this == &other || other.root == nullptr) {
+            return;
+        }
+        if (root != nullptr && !before(*this, other) && !before(other, *this)) {
+            throw std::invalid_argument("Key ranges of joined maps overlap");
+        }
+        if (!(allocators.elements == other.allocators.elements)) {
+            take_elements(other);
+            return;
+        }
+        if (root == nullptr) {
+            swap(other);
+            return;
+        }
+        std::vector<element_type*> elements;
+        elements.reserve(map_size + other.map_size);
+        bool is_first = before(*this, other);
+        collect_elements(is_first ? *this : other, elements);
+        collect_elements(is_first ? other : *this, elements);
+        install(build(elements), elements.size());
+        other.install(built_tree(), 0);
+    }
+    // Moves the elements of other whose keys are not in this map yet, as
+    // std::map::merge does, leaving the others in other. Both maps get new
+    // leaves in O(n + m) and keep their elements where they are.
+    void merge(wide_node_map& other) {
+        if (this == &other || other.root == nullptr) {
+            return;
+        }
+        if (root == nullptr || before(*this, other) || before(other, *this)) {
+            join(other);
+            return;
+        }
+        if (!(allocators.elements == other.allocators.elements)) {
+            take_elements(other);
+            return;
+        }
+        std::vector<element_type*> merged;
+        std::vector<element_type*> kept;
+        merged.reserve(map_size + other.map_size);
+        element_type* element = first_element();
+        element_type* other_element = other.first_element();
+        while (element != nullptr && other_element != nullptr) {
+            if (is_less(element->key(), other_element->key())) {
+                merged.push_back(element);
+                element = next_element(element);
+            } else if (is_less(other_element->key(), element->key())) {
+                merged.push_back(other_element);
+                other_element = other.next_element(other_element);
+            } else {
+                merged.push_back(element);
+                kept.push_back(other_element);
+                element = next_element(element);
+                other_element = other.next_element(other_element);
+            }
+        }
+        for (; element != nullptr; element = next_element(element)) {
+            merged.push_back(element);
+        }
+        for (; other_element != nullptr; other_element = other.next_element(other_element)) {
+            merged.push_back(other_element);
+        }
+        built_tree merged_tree = build(merged);
+        built_tree kept_tree;
+        try {
+            kept_tree = other.build(kept);
+        } catch (...) {
+            free_nodes(merged_tree.root, merged_tree.height, allocators);
+            throw;
+        }
+        install(merged_tree, merged.size());
+        other.install(kept_tree, kept.size());
+    }
+    // The parallel operations of the AVL layout. for_each hands runs of
+    // leaves to the executor; insert sorts the range in parallel and, into
+    // an empty map, fills the leaves directly; merge is merge().
+    template <class Executor, class Fn>
+    void parallel_for_each(Executor& executor, Fn fn) {
+        visit_leaves_parallel(executor, [&fn](element_type* element) {
+            fn(element->value);
+        });
+    }
+    template <class Executor, class Fn>
+    void parallel_for_each(Executor& executor, Fn fn) const {
+        visit_leaves_parallel(executor, [&fn](const element_type* element) {
+            fn(element->value);
+        });
+    }
+    template <class Executor, class ForwardIt>
+    void parallel_insert(Executor& executor, ForwardIt first, ForwardIt last) {
+        if (root != nullptr) {
+            map_type built(get_allocator());
+            built.comparator = comparator;
+            built.parallel_insert(executor, first, last);
+            merge(built);
+            return;
+        }
+        std::vector<ForwardIt> sources;
+        for (; first != last; ++first) {
+            sources.push_back(first);
+        }
+        parallel_stable_sort(executor, sources, [this](const ForwardIt& lhs, const ForwardIt& rhs) {
+            return is_less((*lhs).first, (*rhs).first);
+        });
+        sources.erase(std::unique(sources.begin(), sources.end(), [this](const ForwardIt& lhs, const ForwardIt& rhs) {
+            return !is_less((*lhs).first, (*rhs).first);
+        }), sources.end());
+        auto next = sources.begin();
+        build_from(sources.size(), [&] {
+            return create_element(**next++);
+        });
+    }
+    template <class Executor>
+    void parallel_merge(Executor&, wide_node_map& other) {
+        merge(other);
+    }
+    // Erased elements are freed by their last iterator right away and the
+    // layout counts nothing, so these report zeros, as acid_map does without
+    // statistic traits or deferred reclamation.
+    map_stats stats() const {
+        return map_stats();
+    }
+    void reset_stats() {}
+    size_type reclaim(size_type = std::numeric_limits<size_type>::max()) {
+        return 0;
+    }
+    size_type pending_reclamation() const {
+        return 0;
+    }
+    // Number of wide nodes at every depth, the leaves being the deepest.
+    map_shape inspect() const {
+        map_shape shape;
+        std::vector<wide_node_base*> level;
+        if (root != nullptr) {
+            level.push_back(root);
+        }
+        for (size_type depth = height; depth > 0; depth--) {
+            shape.depth_histogram.push_back(level.size());
+            std::vector<wide_node_base*> below;
+            for (wide_node_base* node : level) {
+                if (depth > 1) {
+                    auto* inner = static_cast<inner_type*>(node);
+                    below.insert(below.end(), inner->children.begin(), inner->children.begin() + inner->count);
+                }
+            }
+            level = std::move(below);
+        }
+        shape.height = shape.depth_histogram.size();
+        return shape;
+    }
+    // Deleted: the wide layout keeps no subtree sizes, so it has no order
+    // statistics, and its elements have no links a non-pinning cursor could
+    // follow. Being deleted rather than missing, they still fail detection
+    // the way absent members do.
+    template <class... Args>
+    void nth(Args&&...) = delete;
+    template <class... Args>
+    void rank(Args&&...) const = delete;
+    void begin_cursor() = delete;
+    void end_cursor() = delete;
+    void view() = delete;
+    ~wide_node_map() {
+        teardown(root, height, allocators);
+    }
+private:
+    iterator make_iterator(element_type* element) {
+        return iterator(owner.get(), element);
+    }
+    // Pinning changes reference counts only, never what the map holds.
+    const_iterator make_const_iterator(element_type* element) const {
+        return const_iterator(owner.get(), element);
+    }
+    void ensure_owner() {
+        if (owner == nullptr) {
+            owner.reset(new tree_owner{this, allocators.elements});
+        }
+    }
+    template <class K>
+    static decltype(auto) lookup_key(const K& key) {
+        if constexpr (is_leaf_key<K>) {
+            return (key);
+        } else {
+            return key_type(key);
+        }
+    }
+    template <class K>
+    size_type erase_key(const K& key) {
+        search_path path;
+        descend(key, path);
+        if (found(path, key) == nullptr) {
+            return 0;
+        }
+        unlink(path);
+        return 1;
+    }
+    template <class K>
+    node_type extract_key(const K& key) {
+        search_path path;
+        descend(key, path);
+        if (found(path, key) == nullptr) {
+            return node_type();
+        }
+        return node_type(detach_element(path), allocators.elements);
+    }
+    template <class K>
+    element_type* at_element(const K& key) const {
+        element_type* element = find_element(key);
+        if (element == nullptr) {
+            throw std::out_of_range("Key does not exists");
+        }
+        return element;
+    }
+    template <class K>
+    std::pair<element_type*, element_type*> equal_range_elements(const K& requested) const {
+        const auto& key = lookup_key(requested);
+        position first = locate<false>(key);
+        position last = first;
+        element_type* element = element_at(first);
+        if (element != nullptr && !is_less(key, element->key())) {
+            last = {element->leaf, index_in_leaf(element) + 1};
+        }
+        return {element, element_at(last)};
+    }
+    template <class K1, class K2, class Visit>
+    void visit_range(const K1& from, const K2& requested_to, Visit visit) const {
+        const auto& to = lookup_key(requested_to);
+        position pos = locate<false>(from);
+        for (leaf_type* leaf = pos.leaf; leaf != nullptr; leaf = leaf->next, pos.index = 0) {
+            for (size_type i = pos.index; i < leaf->count; i++) {
+                if (!is_less(leaf->keys[i], to)) {
+                    return;
+                }
+                visit(leaf->elements[i]);
+            }
+        }
+    }
+    element_type* first_element() const {
+        return first_leaf == nullptr ? nullptr : first_leaf->elements[0];
+    }
+    template <class... Args>
+    element_type* create_element(Args&&... args) {
+        ensure_owner();
+        using traits = std::allocator_traits<rebind_allocator<element_type>>;
+        element_type* element = traits::allocate(allocators.elements, 1);
+        try {
+            traits::construct(allocators.elements, element, std::forward<Args>(args)...);
+        } catch (...) {
+            traits::deallocate(allocators.elements, element, 1);
+            throw;
+        }
+        return element;
+    }
+    void release_element(element_type* element) {
+        if (element->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            destroy_element(element);
+        }
+    }
+    // Links the element of a handle. Its extra reference lets a failing
+    // link drop one without freeing it, which leaves the handle as it was.
+    element_type* link_extracted(search_path& path, node_type& handle) {
+        ensure_owner();
+        if (!(*handle.allocator == allocators.elements)) {
+            element_type* element = link(path, create_element(std::move(handle.node->value)));
+            handle.reset();
+            return element;
+        }
+        element_type* element = handle.node;
+        element->ref_count.fetch_add(1, std::memory_order_relaxed);
+        element->is_deleted = false;
+        try {
+            link(path, element);
+        } catch (...) {
+            element->is_deleted = true;
+            throw;
+        }
+        handle.release();
+        element->ref_count.fetch_sub(1, std::memory_order_relaxed);
+        return element;
+    }
+    static void release_extracted(element_type* element, rebind_allocator<element_type>& allocator) {
+        if (element->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            destroy_element(element, allocator);
+        }
+    }
+    static void destroy_element(element_type* element, rebind_allocator<element_type>& allocator) {
+        std::allocator_traits<rebind_allocator<element_type>>::destroy(allocator, element);
+        std::allocator_traits<rebind_allocator<element_type>>::deallocate(allocator, element, 1);
+    }
+    void destroy_element(element_type* element) {
+        destroy_element(element, allocators.elements);
+    }
+    template <class Node, class NodeAllocator>
+    static Node* create_node(NodeAllocator& allocator) {
+        Node* node = std::allocator_traits<NodeAllocator>::allocate(allocator, 1);
+        try {
+            std::allocator_traits<NodeAllocator>::construct(allocator, node);
+        } catch (...) {
+            std::allocator_traits<NodeAllocator>::deallocate(allocator, node, 1);
+            throw;
+        }
+        return node;
+    }
+    template <class Node, class NodeAllocator>
+    static void destroy_node(Node* node, NodeAllocator& allocator) {
+        std::allocator_traits<NodeAllocator>::destroy(allocator, node);
+        std::allocator_traits<NodeAllocator>::deallocate(allocator, node, 1);
+    }
+    // Leaf and rank of the key in it, without recording the path.
+    template <bool Upper, class K>
+    position locate(const K& requested) const {
+        const auto& key = lookup_key(requested);
+        if (root == nullptr) {
+            return {nullptr, 0};
+        }
+        wide_node_base* node = root;
+        for (size_type level = height; level > 1; level--) {
+            auto* inner = static_cast<inner_type*>(node);
+            node = inner->children[wide_rank<true>(inner->keys.data(), inner->count - 1, key, comparator)];
+        }
+        auto* leaf = static_cast<leaf_type*>(node);
+        return {leaf, wide_rank<Upper>(leaf->keys.data(), leaf->count, key, comparator)};
+    }
+    template <class K>
+    void descend(const K& requested, search_path& path) const {
+        const auto& key = lookup_key(requested);
+        path.depth = 0;
+        path.leaf = nullptr;
+        path.index = 0;
+        if (root == nullptr) {
+            return;
+        }
+        wide_node_base* node = root;
+        for (size_type level = height; level > 1; level--) {
+            auto* inner = static_cast<inner_type*>(node);
+            size_type slot = wide_rank<true>(inner->keys.data(), inner->count - 1, key, comparator);
+            path.nodes[path.depth] = inner;
+            path.slots[path.depth] = static_cast<uint32_t>(slot);
+            path.depth++;
+            node = inner->children[slot];
+        }
+        path.leaf = static_cast<leaf_type*>(node);
+        path.index = wide_rank<false>(path.leaf->keys.data(), path.leaf->count, key, comparator);
+    }
+    template <class K>
+    element_type* found(const search_path& path, const K& requested) const {
+        const auto& key = lookup_key(requested);
+        if (path.leaf == nullptr || path.index == path.leaf->count || is_less(key, path.leaf->keys[path.index])) {
+            return nullptr;
+        }
+        return path.leaf->elements[path.index];
+    }
+    template <class K>
+    element_type* find_element(const K& requested) const {
+        const auto& key = lookup_key(requested);
+        position pos = locate<false>(key);
+        if (pos.leaf == nullptr || pos.index == pos.leaf->count || is_less(key, pos.leaf->keys[pos.index])) {
+            return nullptr;
+        }
+        return pos.leaf->elements[pos.index];
+    }
+    // The element at a position, where one past the end of a leaf is the
+    // start of the next one.
+    static element_type* element_at(position pos) {
+        if (pos.leaf == nullptr) {
+            return nullptr;
+        }
+        if (pos.index == pos.leaf->count) {
+            pos.leaf = pos.leaf->next;
+            if (pos.leaf == nullptr) {
+                return nullptr;
+            }
+            pos.index = 0;
+        }
+        return pos.leaf->elements[pos.index];
+    }
+    static element_type* element_before(position pos) {
+        if (pos.leaf == nullptr) {
+            return nullptr;
+        }
+        if (pos.index == 0) {
+            pos.leaf = pos.leaf->prev;
+            if (pos.leaf == nullptr) {
+                return nullptr;
+            }
+            pos.index = pos.leaf->count;
+        }
+        return pos.leaf->elements[pos.index - 1];
+    }
+    size_type index_in_leaf(const element_type* element) const {
+        const leaf_type* leaf = element->leaf;
+        return wide_rank<false>(leaf->keys.data(), leaf->count, element->key(), comparator);
+    }
+    // An erased element is no longer in any leaf and is looked up by key.
+    element_type* next_element(const element_type* element) const {
+        if (element == nullptr) {
+            return first_element();
+        }
+        if (element->is_deleted) {
+            return element_at(locate<true>(element->key()));
+        }
+        return element_at({element->leaf, index_in_leaf(element) + 1});
+    }
+    element_type* prev_element(const element_type* element) const {
+        if (element == nullptr) {
+            return last_leaf == nullptr ? nullptr : last_leaf->elements[last_leaf->count - 1];
+        }
+        if (element->is_deleted) {
+            return element_before(locate<false>(element->key()));
+        }
+        return element_before({element->leaf, index_in_leaf(element)});
+    }
+    static void insert_into_leaf(leaf_type* leaf, size_type index, Key&& key, element_type* element) {
+        for (size_type i = leaf->count; i > index; i--) {
+            leaf->keys[i] = std::move(leaf->keys[i - 1]);
+            leaf->elements[i] = leaf->elements[i - 1];
+        }
+        leaf->keys[index] = std::move(key);
+        leaf->elements[index] = element;
+        element->leaf = leaf;
+        leaf->count++;
+    }
+    // Puts child right after children[slot], separated from it by key.
+    static void insert_into_inner(inner_type* node, size_type slot, Key&& key, wide_node_base* child) {
+        for (size_type i = node->count - 1; i > slot; i--) {
+            node->keys[i] = std::move(node->keys[i - 1]);
+        }
+        for (size_type i = node->count; i > slot + 1; i--) {
+            node->children[i] = node->children[i - 1];
+        }
+        node->keys[slot] = std::move(key);
+        node->children[slot + 1] = child;
+        node->count++;
+    }
+    // Drops children[slot + 1] and the key in front of it.
+    static void remove_child(inner_type* node, size_type slot) {
+        for (size_type i = slot; i + 2 < node->count; i++) {
+            node->keys[i] = std::move(node->keys[i + 1]);
+        }
+        for (size_type i = slot + 1; i + 1 < node->count; i++) {
+            node->children[i] = node->children[i + 1];
+        }
+        node->count--;
+    }
+    // Links the element where the path leads. Every node the split of a full
+    // leaf and its full ancestors needs is allocated before anything is
+    // changed, so on failure the tree is left as it was.
+    element_type* link(search_path& path, element_type* element) {
+        std::optional<Key> key;
+        try {
+            key.emplace(element->key());
+            if (root == nullptr) {
+                leaf_type* leaf = create_node<leaf_type>(allocators.leaves);
+                root = leaf;
+                height = 1;
+                first_leaf = leaf;
+                last_leaf = leaf;
+                path.leaf = leaf;
+                path.index = 0;
+                path.depth = 0;
+            }
+        } catch (...) {
+            release_element(element);
+            throw;
+        }
+        leaf_type* leaf = path.leaf;
+        map_size++;
+        if (leaf->count < Width) {
+            insert_into_leaf(leaf, path.index, std::move(*key), element);
+            return element;
+        }
+        size_type level = path.depth;
+        while (level > 0 && path.nodes[level - 1]->count == Width) {
+            level--;
+        }
+        size_type inner_needed = path.depth - level + (level == 0 ? 1 : 0);
+        std::array<inner_type*, max_depth + 1> spares;
+        size_type allocated = 0;
+        leaf_type* right = nullptr;
+        std::optional<Key> separator;
+        try {
+            right = create_node<leaf_type>(allocators.leaves);
+            for (; allocated < inner_needed; allocated++) {
+                spares[allocated] = create_node<inner_type>(allocators.inners);
+            }
+            separator.emplace(leaf->keys[Width / 2]);
+        } catch (...) {
+            while (allocated > 0) {
+                destroy_node(spares[--allocated], allocators.inners);
+            }
+            if (right != nullptr) {
+                destroy_node(right, allocators.leaves);
+            }
+            release_element(element);
+            map_size--;
+            throw;
+        }
+        constexpr size_type middle = Width / 2;
+        for (size_type i = middle; i < Width; i++) {
+            right->keys[i - middle] = std::move(leaf->keys[i]);
+            right->elements[i - middle] = leaf->elements[i];
+            right->elements[i - middle]->leaf = right;
+        }
+        right->count = Width - middle;
+        leaf->count = middle;
+        right->prev = leaf;
+        right->next = leaf->next;
+        (leaf->next != nullptr ? leaf->next->prev : last_leaf) = right;
+        leaf->next = right;
+        if (path.index <= middle) {
+            insert_into_leaf(leaf, path.index, std::move(*key), element);
+        } else {
+            insert_into_leaf(right, path.index - middle, std::move(*key), element);
+        }
+        wide_node_base* child = right;
+        Key up = std::move(*separator);
+        for (level = path.depth; level > 0; level--) {
+            inner_type* node = path.nodes[level - 1];
+            size_type slot = path.slots[level - 1];
+            if (node->count < Width) {
+                insert_into_inner(node, slot, std::move(up), child);
+                return element;
+            }
+            constexpr size_type half = Width / 2;
+            inner_type* sibling = spares[--allocated];
+            Key next_up = std::move(node->keys[half - 1]);
+            for (size_type i = half; i < Width; i++) {
+                sibling->children[i - half] = node->children[i];
+            }
+            for (size_type i = half; i + 1 < Width; i++) {
+                sibling->keys[i - half] = std::move(node->keys[i]);
+            }
+            sibling->count = Width - half;
+            node->count = half;
+            if (slot < half) {
+                insert_into_inner(node, slot, std::move(up), child);
+            } else {
+                insert_into_inner(sibling, slot - half, std::move(up), child);
+            }
+            up = std::move(next_up);
+            child = sibling;
+        }
+        inner_type* new_root = spares[--allocated];
+        new_root->count = 2;
+        new_root->children[0] = root;
+        new_root->children[1] = child;
+        new_root->keys[0] = std::move(up);
+        root = new_root;
+        height++;
+        return element;
+    }
+    void unlink(search_path& path) {
+        release_element(detach_element(path));
+    }
+    // Takes the element off its leaf, leaving it with its references.
+    element_type* detach_element(search_path& path) {
+        leaf_type* leaf = path.leaf;
+        element_type* element = leaf->elements[path.index];
+        for (size_type i = path.index; i + 1 < leaf->count; i++) {
+            leaf->keys[i] = std::move(leaf->keys[i + 1]);
+            leaf->elements[i] = leaf->elements[i + 1];
+        }
+        leaf->count--;
+        map_size--;
+        element->is_deleted = true;
+        rebalance(path);
+        return element;
+    }
+    // Fixes underfull nodes from the leaf up, merging a node with a sibling
+    // when both fit into one and evening them out otherwise.
+    void rebalance(search_path& path) {
+        wide_node_base* node = path.leaf;
+        for (size_type level = path.depth; level > 0; level--) {
+            if (node->count >= min_count) {
+                return;
+            }
+            inner_type* parent = path.nodes[level - 1];
+            size_type slot = path.slots[level - 1];
+            size_type left = slot + 1 < parent->count ? slot : slot - 1;
+            bool merged = level == path.depth ? join_leaves(parent, left) : join_inner(parent, left);
+            if (!merged) {
+                return;
+            }
+            node = parent;
+        }
+        if (height == 1 && root->count == 0) {
+            destroy_node(static_cast<leaf_type*>(root), allocators.leaves);
+            root = nullptr;
+            height = 0;
+            first_leaf = nullptr;
+            last_leaf = nullptr;
+        } else if (height > 1 && root->count == 1) {
+            auto* old_root = static_cast<inner_type*>(root);
+            root = old_root->children[0];
+            height--;
+            destroy_node(old_root, allocators.inners);
+        }
+    }
+    // Returns whether the two leaves were merged, which takes a child away
+    // from the parent.
+    bool join_leaves(inner_type* parent, size_type slot) {
+        auto* left = static_cast<leaf_type*>(parent->children[slot]);
+        auto* right = static_cast<leaf_type*>(parent->children[slot + 1]);
+        size_type total = left->count + right->count;
+        if (total <= Width) {
+            for (size_type i = 0; i < right->count; i++) {
+                left->keys[left->count + i] = std::move(right->keys[i]);
+                left->elements[left->count + i] = right->elements[i];
+                right->elements[i]->leaf = left;
+            }
+            left->count = static_cast<uint32_t>(total);
+            left->next = right->next;
+            (right->next != nullptr ? right->next->prev : last_leaf) = left;
+            remove_child(parent, slot);
+            destroy_node(right, allocators.leaves);
+            return true;
+        }
+        // The new separator is a copy of the key that ends up first in the
+        // right leaf. Should copying it throw, the leaf stays underfull,
+        // which costs space but keeps the tree valid.
+        size_type target = total / 2;
+        std::optional<Key> separator;
+        try {
+            separator.emplace(left->count < target ? right->keys[target - left->count] : left->keys[target]);
+        } catch (...) {
+            return false;
+        }
+        if (left->count < target) {
+            size_type moved = target - left->count;
+            for (size_type i = 0; i < moved; i++) {
+                left->keys[left->count + i] = std::move(right->keys[i]);
+                left->elements[left->count + i] = right->elements[i];
+                right->elements[i]->leaf = left;
+            }
+            for (size_type i = 0; i + moved < right->count; i++) {
+                right->keys[i] = std::move(right->keys[i + moved]);
+                right->elements[i] = right->elements[i + moved];
+            }
+            right->count -= static_cast<uint32_t>(moved);
+        } else {
+            size_type moved = left->count - target;
+            for (size_type i = right->count; i-- > 0;) {
+                right->keys[i + moved] = std::move(right->keys[i]);
+                right->elements[i + moved] = right->elements[i];
+            }
+            for (size_type i = 0; i < moved; i++) {
+                right->keys[i] = std::move(left->keys[target + i]);
+                right->elements[i] = left->elements[target + i];
+                right->elements[i]->leaf = right;
+            }
+            right->count += static_cast<uint32_t>(moved);
+        }
+        left->count = static_cast<uint32_t>(target);
+        parent->keys[slot] = std::move(*separator);
+        return false;
+    }
+    // Same for inner nodes, whose separators rotate through the parent.
+    bool join_inner(inner_type* parent, size_type slot) {
+        auto* left = static_cast<inner_type*>(parent->children[slot]);
+        auto* right = static_cast<inner_type*>(parent->children[slot + 1]);
+        size_type total = left->count + right->count;
+        if (total <= Width) {
+            left->keys[left->count - 1] = std::move(parent->keys[slot]);
+            for (size_type i = 0; i < right->count; i++) {
+                left->children[left->count + i] = right->children[i];
+            }
+            for (size_type i = 0; i + 1 < right->count; i++) {
+                left->keys[left->count + i] = std::move(right->keys[i]);
+            }
+            left->count = static_cast<uint32_t>(total);
+            remove_child(parent, slot);
+            destroy_node(right, allocators.inners);
+            return true;
+        }
+        size_type target = total / 2;
+        if (left->count < target) {
+            size_type moved = target - left->count;
+            left->keys[left->count - 1] = std::move(parent->keys[slot]);
+            for (size_type i = 0; i < moved; i++) {
+                left->children[left->count + i] = right->children[i];
+            }
+            for (size_type i = 0; i + 1 < moved; i++) {
+                left->keys[left->count + i] = std::move(right->keys[i]);
+            }
+            parent->keys[slot] = std::move(right->keys[moved - 1]);
+            for (size_type i = 0; i + moved < right->count; i++) {
+                right->children[i] = right->children[i + moved];
+            }
+            for (size_type i = 0; i + moved + 1 < right->count; i++) {
+                right->keys[i] = std::move(right->keys[i + moved]);
+            }
+            right->count -= static_cast<uint32_t>(moved);
+        } else {
+            size_type moved = left->count - target;
+            for (size_type i = right->count; i-- > 0;) {
+                right->children[i + moved] = right->children[i];
+            }
+            for (size_type i = right->count - 1; i-- > 0;) {
+                right->keys[i + moved] = std::move(right->keys[i]);
+            }
+            right->keys[moved - 1] = std::move(parent->keys[slot]);
+            for (size_type i = 0; i < moved; i++) {
+                right->children[i] = left->children[target + i];
+            }
+            for (size_type i = 0; i + 1 < moved; i++) {
+                right->keys[i] = std::move(left->keys[target + i]);
+            }
+            parent->keys[slot] = std::move(left->keys[target - 1]);
+            right->count += static_cast<uint32_t>(moved);
+        }
+        left->count = static_cast<uint32_t>(target);
+        return false;
+    }
+    // Elements still pinned by iterators are marked erased and left to them.
+    static void teardown(wide_node_base* node, size_type level, node_allocators& allocators) {
+        if (node == nullptr) {
+            return;
+        }
+        if (level > 1) {
+            auto* inner = static_cast<inner_type*>(node);
+            for (size_type i = 0; i < inner->count; i++) {
+                teardown(inner->children[i], level - 1, allocators);
+            }
+            destroy_node(inner, allocators.inners);
+            return;
+        }
+        auto* leaf = static_cast<leaf_type*>(node);
+        for (size_type i = 0; i < leaf->count; i++) {
+            element_type* element = leaf->elements[i];
+            if (element->ref_count.load(std::memory_order_acquire) == 1) {
+                destroy_element(element, allocators.elements);
+            } else {
+                element->is_deleted = true;
+                element->ref_count.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        destroy_node(leaf, allocators.leaves);
+    }
+    struct built_tree {
+        wide_node_base* root = nullptr;
+        size_type height = 0;
+        leaf_type* first_leaf = nullptr;
+        leaf_type* last_leaf = nullptr;
+    };
+    // Fills leaves with the sorted elements, then every level above with the
+    // nodes below it, spreading the entries evenly so that no node but the
+    // root is less than half full. Leaves the elements alone; if it throws,
+    // every node built so far is freed again.
+    built_tree build(const std::vector<element_type*>& elements) {
+        built_tree tree;
+        if (elements.empty()) {
+            return tree;
+        }
+        size_type leaf_count = (elements.size() + Width - 1) / Width;
+        std::vector<leaf_type*> leaves;
+        std::vector<inner_type*> inners;
+        std::vector<wide_node_base*> level;
+        std::vector<const Key*> lowest;
+        leaves.reserve(leaf_count);
+        inners.reserve(leaf_count);
+        level.reserve(leaf_count);
+        lowest.reserve(leaf_count);
+        try {
+            size_type next = 0;
+            for (size_type i = 0; i < leaf_count; i++) {
+                size_type take = elements.size() / leaf_count + (i < elements.size() % leaf_count ? 1 : 0);
+                leaf_type* leaf = create_node<leaf_type>(allocators.leaves);
+                leaves.push_back(leaf);
+                for (size_type j = 0; j < take; j++) {
+                    leaf->keys[j] = elements[next]->key();
+                    leaf->elements[j] = elements[next++];
+                }
+                leaf->count = static_cast<uint32_t>(take);
+                if (i > 0) {
+                    leaf->prev = leaves[i - 1];
+                    leaves[i - 1]->next = leaf;
+                }
+                level.push_back(leaf);
+                lowest.push_back(&leaf->keys[0]);
+            }
+            tree.height = 1;
+            while (level.size() > 1) {
+                size_type node_count = (level.size() + Width - 1) / Width;
+                size_type below = 0;
+                for (size_type i = 0; i < node_count; i++) {
+                    size_type take = level.size() / node_count + (i < level.size() % node_count ? 1 : 0);
+                    inner_type* inner = create_node<inner_type>(allocators.inners);
+                    inners.push_back(inner);
+                    for (size_type j = 0; j < take; j++) {
+                        inner->children[j] = level[below + j];
+                        if (j > 0) {
+                            inner->keys[j - 1] = *lowest[below + j];
+                        }
+                    }
+                    inner->count = static_cast<uint32_t>(take);
+                    level[i] = inner;
+                    lowest[i] = lowest[below];
+                    below += take;
+                }
+                level.resize(node_count);
+                lowest.resize(node_count);
+                tree.height++;
+            }
+        } catch (...) {
+            for (inner_type* inner : inners) {
+                destroy_node(inner, allocators.inners);
+            }
+            for (leaf_type* leaf : leaves) {
+                destroy_node(leaf, allocators.leaves);
+            }
+            throw;
+        }
+        tree.root = level.front();
+        tree.first_leaf = leaves.front();
+        tree.last_leaf = leaves.back();
+        return tree;
+    }
+    // Replaces the nodes of the map by a built tree and points its elements
+    // at their new leaves.
+    void install(const built_tree& tree, size_type count) noexcept {
+        free_nodes(root, height, allocators);
+        root = tree.root;
+        height = tree.height;
+        first_leaf = tree.first_leaf;
+        last_leaf = tree.last_leaf;
+        map_size = count;
+        for (leaf_type* leaf = first_leaf; leaf != nullptr; leaf = leaf->next) {
+            for (size_type i = 0; i < leaf->count; i++) {
+                leaf->elements[i]->leaf = leaf;
+            }
+        }
+    }
+    // Fills the empty map with count elements made by next in key order.
+    template <class Next>
+    void build_from(size_type count, Next next) {
+        std::vector<element_type*> elements;
+        elements.reserve(count);
+        try {
+            for (size_type i = 0; i < count; i++) {
+                elements.push_back(next());
+            }
+            install(build(elements), elements.size());
+        } catch (...) {
+            for (element_type* element : elements) {
+                destroy_element(element);
+            }
+            throw;
+        }
+    }
+    static void collect_elements(const wide_node_map& map, std::vector<element_type*>& elements) {
+        for (leaf_type* leaf = map.first_leaf; leaf != nullptr; leaf = leaf->next) {
+            elements.insert(elements.end(), leaf->elements.begin(), leaf->elements.begin() + leaf->count);
+        }
+    }
+    static bool before(const wide_node_map& lhs, const wide_node_map& rhs) {
+        return lhs.is_less(lhs.last_leaf->keys[lhs.last_leaf->count - 1], rhs.first_leaf->keys[0]);
+    }
+    // Moves the elements of other whose keys are not in this map into new
+    // elements and erases just those from other, as in the AVL layout.
+    void take_elements(wide_node_map& other) {
+        for (auto it = other.begin(); it != other.end();) {
+            if (try_emplace(it->first, std::move(it->second)).second) {
+                it = other.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    template <class Executor, class Visit>
+    void visit_leaves_parallel(Executor& executor, Visit visit) const {
+        std::vector<leaf_type*> leaves;
+        for (leaf_type* leaf = first_leaf; leaf != nullptr; leaf = leaf->next) {
+            leaves.push_back(leaf);
+        }
+        visit_leaves(executor, leaves.data(), leaves.size(), visit);
+    }
+    // Runs of leaves below this many elements are not worth another thread.
+    static constexpr size_type parallel_grain = 4096;
+    template <class Executor, class Visit>
+    static void visit_leaves(Executor& executor, leaf_type* const* leaves, size_type count, Visit& visit) {
+        if (count * Width <= parallel_grain) {
+            for (size_type i = 0; i < count; i++) {
+                for (size_type j = 0; j < leaves[i]->count; j++) {
+                    visit(leaves[i]->elements[j]);
+                }
+            }
+            return;
+        }
+        size_type half = count / 2;
+        executor.fork_join([&] { visit_leaves(executor, leaves, half, visit); },
+                           [&] { visit_leaves(executor, leaves + half, count - half, visit); });
+    }
+    // Frees the inner nodes and leaves of a tree, not its elements.
+    static void free_nodes(wide_node_base* node, size_type level, node_allocators& allocators) noexcept {
+        if (node == nullptr) {
+            return;
+        }
+        if (level > 1) {
+            auto* inner = static_cast<inner_type*>(node);
+            for (size_type i = 0; i < inner->count; i++) {
+                free_nodes(inner->children[i], level - 1, allocators);
+            }
+            destroy_node(inner, allocators.inners);
+            return;
+        }
+        destroy_node(static_cast<leaf_type*>(node), allocators.leaves);
+    }
+    template <class K1, class K2>
+    inline bool is_less(const K1& lhs, const K2& rhs) const {
+        return comparator(lhs, rhs);
+    }
+    wide_node_base* root = nullptr;
+    // Levels below and including the root, leaves being level one.
+    size_type height = 0;
+    leaf_type* first_leaf = nullptr;
+    leaf_type* last_leaf = nullptr;
+    size_type map_size = 0;
+    key_compare comparator;
+    node_allocators allocators;
+    std::unique_ptr<tree_owner> owner{new tree_owner{this, allocators.elements}};
+};
+
+template <class Map, bool Const>
+class wide_node_iterator {
+private:
+    friend Map;
+    template <class, bool>
+    friend class wide_node_iterator;
+    using element_type = typename Map::element_type;
+    using tree_owner = typename Map::tree_owner;
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = typename Map::value_type;
+    using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+    using reference = std::conditional_t<Const, const value_type&, value_type&>;
+    wide_node_iterator() = default;
+    wide_node_iterator(const wide_node_iterator& other) : wide_node_iterator(other.owner, other.element) {}
+    template <bool OtherConst, class = std::enable_if_t<Const && !OtherConst>>
+    wide_node_iterator(const wide_node_iterator<Map, OtherConst>& other)
+        : wide_node_iterator(other.owner, other.element) {}
+    wide_node_iterator& operator=(const wide_node_iterator& other) {
+        if (other.element != nullptr) {
+            other.element->ref_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        reset(nullptr);
+        owner = other.owner;
+        element = other.element;
+        return *this;
+    }
+    ~wide_node_iterator() {
+        reset(nullptr);
+    }
+    wide_node_iterator& operator++() {
+        reset(owner != nullptr ? owner->map->next_element(element) : nullptr);
+        return *this;
+    }
+    wide_node_iterator operator++(int) {
+        wide_node_iterator other(*this);
+        ++*this;
+        return other;
+    }
+    // Decrementing end() gives the last element and incrementing it wraps
+    // around to the first one.
+    wide_node_iterator& operator--() {
+        reset(owner != nullptr ? owner->map->prev_element(element) : nullptr);
+        return *this;
+    }
+    wide_node_iterator operator--(int) {
+        wide_node_iterator other(*this);
+        --*this;
+        return other;
+    }
+    reference operator*() const {
+        return element->value;
+    }
+    pointer operator->() const {
+        return &element->value;
+    }
+    template <bool OtherConst>
+    bool operator==(const wide_node_iterator<Map, OtherConst>& other) const {
+        return element == other.element;
+    }
+    template <bool OtherConst>
+    bool operator!=(const wide_node_iterator<Map, OtherConst>& other) const {
+        return element != other.element;
+    }
+private:
+    wide_node_iterator(tree_owner* owner, element_type* element) : owner(owner) {
+        reset(element);
+    }
+    // Pins the new element before letting go of the current one.
+    void reset(element_type* next) {
+        if (next != nullptr) {
+            next->ref_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (element != nullptr && element->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            Map::destroy_element(element, owner->elements);
+        }
+        element = next;
+    }
+    tree_owner* owner = nullptr;
+    element_type* element = nullptr;
+};
+
+// acid_map with wide_node_traits keeps its interface on top of the B+tree.
+// Order statistics are not available in this layout.
+template <class Key, class T, class Compare, class Allocator, std::size_t Width>
+class acid_map<Key, T, Compare, Allocator, wide_node_traits<Width>>
+    : public wide_node_map<Key, T, Compare, Allocator, Width> {
+public:
+    using wide_node_map<Key, T, Compare, Allocator, Width>::wide_node_map;
+};
+
+} // polyndrom
\ No newline at end of file
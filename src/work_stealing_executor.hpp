@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace polyndrom {
+
+// Executors run the parallel operations of acid_map. All they have to offer
+// is fork_join(f, g), which runs both callables, possibly at the same time,
+// returns once both have finished and rethrows the first exception either
+// of them threw. This one runs them one after the other.
+struct sequential_executor {
+    template <class F, class G>
+    void fork_join(F&& f, G&& g) {
+        f();
+        g();
+    }
+};
+
+// Fork-join pool with a deque per worker. fork_join() pushes g onto the
+// deque of the calling thread and runs f; idle workers steal from the
+// other end of the deques, so they take the largest pieces of a divide and
+// conquer. A thread waiting for a stolen g keeps running other queued tasks
+// meanwhile, threads outside the pool included, so nested fork_join() calls
+// never leave a thread blocked while there is work.
+class work_stealing_executor {
+public:
+    // The calling thread takes part in its own fork_join() calls, so
+    // threads - 1 workers make up threads running tasks.
+    explicit work_stealing_executor(std::size_t threads = std::thread::hardware_concurrency()) {
+        std::size_t worker_count = std::max<std::size_t>(threads, 1) - 1;
+        for (std::size_t i = 0; i <= worker_count; i++) {
+            queues.push_back(std::make_unique<task_queue>());
+        }
+        for (std::size_t i = 0; i < worker_count; i++) {
+            workers.emplace_back([this, i] { run(i); });
+        }
+    }
+    work_stealing_executor(const work_stealing_executor&) = delete;
+    work_stealing_executor& operator=(const work_stealing_executor&) = delete;
+    ~work_stealing_executor() {
+        {
+            std::lock_guard<std::mutex> guard(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+    std::size_t concurrency() const {
+        return workers.size() + 1;
+    }
+    template <class F, class G>
+    void fork_join(F&& f, G&& g) {
+        task forked;
+        forked.callable = &g;
+        forked.invoke = [](void* callable) {
+            (*static_cast<std::remove_reference_t<G>*>(callable))();
+        };
+        task_queue& queue = *queues[own_queue()];
+        {
+            std::lock_guard<std::mutex> guard(queue.mutex);
+            queue.tasks.push_back(&forked);
+        }
+        wake.notify_one();
+        std::exception_ptr error;
+        try {
+            f();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        bool popped = false;
+        {
+            std::lock_guard<std::mutex> guard(queue.mutex);
+            auto it = std::find(queue.tasks.rbegin(), queue.tasks.rend(), &forked);
+            if (it != queue.tasks.rend()) {
+                queue.tasks.erase(std::next(it).base());
+                popped = true;
+            }
+        }
+        if (popped) {
+            execute(forked);
+        } else {
+            while (!forked.done.load(std::memory_order_acquire)) {
+                if (task* other = steal(own_queue())) {
+                    execute(*other);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+        if (error == nullptr) {
+            error = forked.error;
+        }
+        if (error != nullptr) {
+            std::rethrow_exception(error);
+        }
+    }
+private:
+    struct task {
+        void* callable = nullptr;
+        void (*invoke)(void*) = nullptr;
+        std::exception_ptr error;
+        std::atomic<bool> done = false;
+    };
+    struct task_queue {
+        std::mutex mutex;
+        std::deque<task*> tasks;
+    };
+    // Workers own the first queues, threads outside the pool share the last.
+    std::size_t own_queue() const {
+        return current_executor == this ? current_worker : workers.size();
+    }
+    static void execute(task& job) {
+        try {
+            job.invoke(job.callable);
+        } catch (...) {
+            job.error = std::current_exception();
+        }
+        job.done.store(true, std::memory_order_release);
+    }
+    // Takes the oldest task of any queue but the given one, then of that
+    // one, which external threads share.
+    task* steal(std::size_t own) {
+        for (std::size_t i = 1; i <= queues.size(); i++) {
+            task_queue& queue = *queues[(own + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task* job = queue.tasks.front();
+                queue.tasks.pop_front();
+                return job;
+            }
+        }
+        return nullptr;
+    }
+    void run(std::size_t index) {
+        current_executor = this;
+        current_worker = index;
+        while (true) {
+            if (task* job = steal(index)) {
+                execute(*job);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            if (stopping) {
+                return;
+            }
+            // Pushes do not take the sleep mutex, so a wakeup can be missed;
+            // the timeout bounds how long a task then waits for a thief.
+            wake.wait_for(lock, std::chrono::milliseconds(1));
+        }
+    }
+    static inline thread_local const work_stealing_executor* current_executor = nullptr;
+    static inline thread_local std::size_t current_worker = 0;
+    std::vector<std::unique_ptr<task_queue>> queues;
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
+
+// Stable merge sort whose halves are sorted and merged through the
+// executor; the merges split both runs around the middle of the longer one.
+template <class Executor, class T, class Less>
+void parallel_stable_sort(Executor& executor, std::vector<T>& values, Less less) {
+    constexpr std::size_t grain = 4096;
+    std::vector<T> buffer(values.size());
+    std::function<void(T*, std::size_t, T*, std::size_t, T*)> merge =
+        [&](T* lhs, std::size_t lhs_count, T* rhs, std::size_t rhs_count, T* out) {
+        if (lhs_count + rhs_count <= grain) {
+            std::merge(std::make_move_iterator(lhs), std::make_move_iterator(lhs + lhs_count),
+                       std::make_move_iterator(rhs), std::make_move_iterator(rhs + rhs_count), out, less);
+            return;
+        }
+        std::size_t lhs_split;
+        std::size_t rhs_split;
+        if (lhs_count >= rhs_count) {
+            lhs_split = lhs_count / 2;
+            rhs_split = static_cast<std::size_t>(std::lower_bound(rhs, rhs + rhs_count, lhs[lhs_split], less) - rhs);
+        } else {
+            rhs_split = rhs_count / 2;
+            lhs_split = static_cast<std::size_t>(std::upper_bound(lhs, lhs + lhs_count, rhs[rhs_split], less) - lhs);
+        }
+        executor.fork_join([&] { merge(lhs, lhs_split, rhs, rhs_split, out); },
+                           [&] { merge(lhs + lhs_split, lhs_count - lhs_split, rhs + rhs_split, rhs_count - rhs_split,
+                                       out + lhs_split + rhs_split); });
+    };
+    // Sorts count values at data, into the buffer at spare if into_spare.
+    std::function<void(T*, T*, std::size_t, bool)> sort = [&](T* data, T* spare, std::size_t count, bool into_spare) {
+        if (count <= grain) {
+            std::stable_sort(data, data + count, less);
+            if (into_spare) {
+                std::move(data, data + count, spare);
+            }
+            return;
+        }
+        std::size_t half = count / 2;
+        executor.fork_join([&] { sort(data, spare, half, !into_spare); },
+                           [&] { sort(data + half, spare + half, count - half, !into_spare); });
+        T* from = into_spare ? data : spare;
+        merge(from, half, from + half, count - half, into_spare ? spare : data);
+    };
+    sort(values.data(), buffer.data(), values.size(), false);
+}
+
+} // polyndrom
\ No newline at end of file
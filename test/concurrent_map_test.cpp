@@ -0,0 +1,502 @@
+#include "concurrent_map.hpp"
+#include "tree_verifier.hpp"
+#include "utils.hpp"
+
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <map>
+#include <optional>
+#include <string>
+#include <thread>
+
+namespace {
+
+size_t live_nodes = 0;
+size_t allocations = 0;
+
+template <class T>
+struct counting_allocator {
+    using value_type = T;
+    counting_allocator() = default;
+    template <class U>
+    counting_allocator(const counting_allocator<U>&) {}
+    T* allocate(size_t n) {
+        live_nodes += n;
+        allocations += n;
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* ptr, size_t n) {
+        live_nodes -= n;
+        std::allocator<T>().deallocate(ptr, n);
+    }
+    template <class U>
+    bool operator==(const counting_allocator<U>&) const {
+        return true;
+    }
+    template <class U>
+    bool operator!=(const counting_allocator<U>&) const {
+        return false;
+    }
+};
+
+}
+
+TEST(ConcurrentMapTest, MatchesStdMap) {
+    polyndrom::concurrent_map<int, int> map;
+    std::map<int, int> expected;
+    int_generator key_generator(0, 2000);
+    int_generator op_generator(0, 3);
+    for (int i = 0; i < 20000; i++) {
+        int key = key_generator.next_value();
+        switch (op_generator.next_value()) {
+            case 0:
+                EXPECT_EQ(map.erase(key), expected.erase(key));
+                break;
+            case 1:
+                EXPECT_EQ(map.emplace(key, i), expected.emplace(key, i).second);
+                break;
+            case 2:
+                EXPECT_EQ(map.try_emplace(key, i), expected.try_emplace(key, i).second);
+                break;
+            default:
+                EXPECT_EQ(map.insert_or_assign(key, i), expected.insert_or_assign(key, i).second);
+                break;
+        }
+        if (i % 1000 == 0) {
+            ASSERT_TRUE(polyndrom::verify_version_tree(map));
+        }
+    }
+    EXPECT_TRUE(polyndrom::verify_version_tree(map));
+    auto view = map.read();
+    EXPECT_EQ(view.size(), expected.size());
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), view.begin(), view.end()));
+    EXPECT_TRUE(std::equal(expected.rbegin(), expected.rend(), std::make_reverse_iterator(view.end()),
+                           std::make_reverse_iterator(view.begin())));
+    for (int key = -1; key <= 2001; key++) {
+        auto it = view.lower_bound(key);
+        auto expected_it = expected.lower_bound(key);
+        EXPECT_EQ(it == view.end(), expected_it == expected.end());
+        if (expected_it != expected.end()) {
+            EXPECT_EQ(it->first, expected_it->first);
+        }
+        auto upper = view.upper_bound(key);
+        auto expected_upper = expected.upper_bound(key);
+        EXPECT_EQ(upper == view.end(), expected_upper == expected.end());
+        if (expected_upper != expected.end()) {
+            EXPECT_EQ(upper->first, expected_upper->first);
+        }
+        EXPECT_EQ(map.get(key).has_value(), expected.count(key) == 1);
+    }
+}
+
+TEST(ConcurrentMapTest, ViewKeepsItsVersion) {
+    polyndrom::concurrent_map<std::string, int, std::less<>> map;
+    for (int i = 0; i < 100; i++) {
+        map.emplace(std::to_string(i), i);
+    }
+    auto view = map.read();
+    for (int i = 0; i < 100; i += 2) {
+        map.erase(std::to_string(i));
+        map.insert_or_assign(std::to_string(i + 1), -1);
+    }
+    map.emplace("x", 0);
+    map.reclaim();
+    EXPECT_EQ(view.size(), 100u);
+    EXPECT_EQ(view.at(std::string_view("0")), 0);
+    EXPECT_EQ(view.at(std::string_view("1")), 1);
+    EXPECT_FALSE(view.contains(std::string_view("x")));
+    EXPECT_EQ(map.size(), 51u);
+    EXPECT_EQ(map.get(std::string_view("1")), -1);
+    std::vector<int> visited;
+    map.for_each_in_range(std::string_view("1"), std::string_view("2"), [&](auto& value) {
+        visited.push_back(value.second);
+    });
+    EXPECT_EQ(visited.size(), 6u);
+}
+
+TEST(ConcurrentMapTest, ReclaimsReplacedVersions) {
+    {
+        polyndrom::concurrent_map<int, int, std::less<int>, counting_allocator<std::pair<const int, int>>> map;
+        for (int i = 0; i < 1000; i++) {
+            map.emplace(i, i);
+        }
+        {
+            auto view = map.read();
+            for (int i = 0; i < 1000; i += 2) {
+                map.erase(i);
+            }
+            map.reclaim();
+            EXPECT_GT(live_nodes, 1000u);
+            EXPECT_EQ(view.size(), 1000u);
+        }
+        map.reclaim();
+        EXPECT_EQ(live_nodes, map.size());
+        map.clear();
+        map.reclaim();
+        EXPECT_EQ(live_nodes, 0u);
+        map.emplace(1, 1);
+    }
+    EXPECT_EQ(live_nodes, 0u);
+}
+
+TEST(ConcurrentMapTest, ReadersSeeCompleteVersions) {
+    int n = 20000;
+    int readers = 4;
+    polyndrom::concurrent_map<int, int> map;
+    std::atomic<bool> done{false};
+    std::atomic<size_t> failures{0};
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; r++) {
+        threads.emplace_back([&] {
+            while (!done.load()) {
+                auto view = map.read();
+                // The writer inserts keys in order and erases them in order
+                // from the front, so every version holds one contiguous run.
+                int expected = view.empty() ? 0 : view.begin()->first;
+                size_t count = 0;
+                for (auto& [key, value] : view) {
+                    failures += key != expected || value != key;
+                    expected++;
+                    count++;
+                }
+                failures += count != view.size();
+            }
+        });
+    }
+    for (int i = 0; i < n; i++) {
+        map.emplace(i, i);
+        if (i % 3 == 0) {
+            map.erase(i / 3);
+        }
+    }
+    done = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(failures.load(), 0u);
+    EXPECT_TRUE(polyndrom::verify_version_tree(map));
+}
+TEST(ConcurrentMapTest, SnapshotSharesUnchangedNodes) {
+    std::optional<polyndrom::concurrent_map<int, int, std::less<int>,
+                                            counting_allocator<std::pair<const int, int>>>::snapshot_view> old;
+    {
+        polyndrom::concurrent_map<int, int, std::less<int>, counting_allocator<std::pair<const int, int>>> map;
+        for (int i = 0; i < 1000; i++) {
+            map.emplace(i, i);
+        }
+        auto snapshot = map.snapshot();
+        for (int i = 0; i < 10; i++) {
+            map.insert_or_assign(i * 100, -i);
+        }
+        map.erase(5);
+        map.reclaim();
+        EXPECT_GT(live_nodes, 1000u);
+        EXPECT_LE(live_nodes, 1000u + 11 * 16);
+        auto copy = snapshot;
+        EXPECT_EQ(copy.size(), 1000u);
+        EXPECT_EQ(copy.at(500), 500);
+        EXPECT_TRUE(copy.contains(5));
+        EXPECT_EQ(map.get(500), -5);
+        EXPECT_FALSE(map.contains(5));
+        old = std::move(copy);
+    }
+    EXPECT_EQ(live_nodes, 1000u);
+    EXPECT_EQ(old->size(), 1000u);
+    int expected = 0;
+    for (auto& [key, value] : *old) {
+        EXPECT_EQ(key, expected);
+        EXPECT_EQ(value, expected);
+        expected++;
+    }
+    old.reset();
+    EXPECT_EQ(live_nodes, 0u);
+}
+
+TEST(ConcurrentMapTest, SnapshotsFromReaders) {
+    polyndrom::concurrent_map<int, int> map;
+    std::atomic<bool> done{false};
+    std::atomic<size_t> failures{0};
+    std::thread reader([&] {
+        std::vector<decltype(map.snapshot())> snapshots;
+        while (!done.load()) {
+            snapshots.push_back(map.snapshot());
+            if (snapshots.size() > 16) {
+                snapshots.erase(snapshots.begin());
+            }
+            for (auto& snapshot : snapshots) {
+                size_t count = 0;
+                for (auto& [key, value] : snapshot) {
+                    failures += static_cast<size_t>(key) != count || value != key;
+                    count++;
+                }
+                failures += count != snapshot.size();
+            }
+        }
+    });
+    for (int i = 0; i < 5000; i++) {
+        map.emplace(i, i);
+    }
+    done = true;
+    reader.join();
+    EXPECT_EQ(failures.load(), 0u);
+}
+
+TEST(ConcurrentMapTest, TransactionMatchesSequentialWrites) {
+    polyndrom::concurrent_map<int, int> map;
+    std::map<int, int> expected;
+    int_generator key_generator(0, 500);
+    int_generator op_generator(0, 3);
+    for (int round = 0; round < 20; round++) {
+        polyndrom::concurrent_map<int, int>::transaction transaction(map);
+        for (int i = 0; i < 200; i++) {
+            int key = key_generator.next_value();
+            switch (op_generator.next_value()) {
+                case 0:
+                    transaction.erase(key);
+                    expected.erase(key);
+                    break;
+                case 1:
+                    transaction.emplace(key, i);
+                    expected.emplace(key, i);
+                    break;
+                case 2:
+                    transaction.try_emplace(key, i);
+                    expected.try_emplace(key, i);
+                    break;
+                default:
+                    transaction.insert_or_assign(key, i);
+                    expected.insert_or_assign(key, i);
+                    break;
+            }
+        }
+        transaction.commit();
+        ASSERT_TRUE(polyndrom::verify_version_tree(map));
+    }
+    auto view = map.read();
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), view.begin(), view.end()));
+}
+
+TEST(ConcurrentMapTest, TransactionAbortAndBatching) {
+    polyndrom::concurrent_map<int, int, std::less<int>, counting_allocator<std::pair<const int, int>>> map;
+    for (int i = 0; i < 10000; i++) {
+        map.emplace(i, i);
+    }
+    {
+        decltype(map)::transaction transaction(map);
+        transaction.erase(1);
+        transaction.emplace(-1, -1);
+        transaction.abort();
+        transaction.commit();
+    }
+    EXPECT_TRUE(map.contains(1));
+    EXPECT_FALSE(map.contains(-1));
+    allocations = 0;
+    decltype(map)::transaction transaction(map);
+    for (int i = 2000; i > 1000; i--) {
+        transaction.insert_or_assign(i, -i);
+    }
+    EXPECT_EQ(map.get(1500), 1500);
+    transaction.commit();
+    EXPECT_EQ(map.get(1500), -1500);
+    EXPECT_LT(allocations, 1200u);
+    EXPECT_TRUE(polyndrom::verify_version_tree(map));
+}
+
+TEST(ConcurrentMapTest, ReadersSeeWholeTransactions) {
+    int batch = 1000;
+    polyndrom::concurrent_map<int, int> map;
+    std::atomic<bool> done{false};
+    std::atomic<size_t> failures{0};
+    std::thread reader([&] {
+        while (!done.load()) {
+            size_t size = map.read().size();
+            failures += size != 0 && size != static_cast<size_t>(batch);
+        }
+    });
+    for (int round = 0; round < 50; round++) {
+        polyndrom::concurrent_map<int, int>::transaction transaction(map);
+        for (int i = 0; i < batch; i++) {
+            if (round % 2 == 0) {
+                transaction.emplace(i, round);
+            } else {
+                transaction.erase(i);
+            }
+        }
+        transaction.commit();
+    }
+    done = true;
+    reader.join();
+    EXPECT_EQ(failures.load(), 0u);
+    EXPECT_TRUE(map.empty());
+}
+TEST(ConcurrentMapTest, ConcurrentWriters) {
+    int writers = 16;
+    int per_writer = 2000;
+    polyndrom::concurrent_map<int, int> map;
+    for (int i = 0; i < writers * per_writer; i += 2) {
+        map.emplace(i, -1);
+    }
+    std::atomic<bool> done{false};
+    std::atomic<size_t> failures{0};
+    std::thread reader([&] {
+        while (!done.load()) {
+            auto view = map.read();
+            // Every writer only adds keys, so a later version never loses one.
+            auto snapshot = map.snapshot();
+            failures += snapshot.size() < view.size();
+            int previous = -1;
+            for (auto& [key, value] : view) {
+                failures += key <= previous;
+                previous = key;
+            }
+        }
+    });
+    std::vector<std::thread> threads;
+    std::atomic<size_t> inserted{0};
+    for (int w = 0; w < writers; w++) {
+        threads.emplace_back([&, w] {
+            for (int i = w * per_writer; i < (w + 1) * per_writer; i++) {
+                inserted += map.try_emplace(i, w);
+                if (i % 7 == 0) {
+                    map.insert_or_assign(i, i);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    done = true;
+    reader.join();
+    EXPECT_EQ(failures.load(), 0u);
+    EXPECT_EQ(inserted.load(), static_cast<size_t>(writers * per_writer / 2));
+    EXPECT_TRUE(polyndrom::verify_version_tree(map));
+    auto view = map.read();
+    ASSERT_EQ(view.size(), static_cast<size_t>(writers * per_writer));
+    int expected = 0;
+    for (auto& [key, value] : view) {
+        EXPECT_EQ(key, expected);
+        if (key % 7 == 0) {
+            EXPECT_EQ(value, key);
+        } else {
+            EXPECT_EQ(value, key % 2 == 0 ? -1 : key / per_writer);
+        }
+        expected++;
+    }
+}
+
+TEST(ConcurrentMapTest, LookupsAcrossStripes) {
+    polyndrom::concurrent_map<int, int> map;
+    std::map<int, int> expected;
+    for (int i = 0; i < 20000; i += 2) {
+        map.emplace(i, i);
+        expected.emplace(i, i);
+    }
+    EXPECT_GT(polyndrom::version_stripes(map), 1u);
+    EXPECT_TRUE(polyndrom::verify_version_tree(map));
+    auto view = map.read();
+    auto snapshot = map.snapshot();
+    EXPECT_EQ(view.size(), expected.size());
+    EXPECT_TRUE(std::equal(expected.rbegin(), expected.rend(), std::make_reverse_iterator(view.end()),
+                           std::make_reverse_iterator(view.begin())));
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), snapshot.begin(), snapshot.end()));
+    for (int key = -1; key <= 20001; key++) {
+        auto it = view.lower_bound(key);
+        auto expected_it = expected.lower_bound(key);
+        ASSERT_EQ(it == view.end(), expected_it == expected.end());
+        if (expected_it != expected.end()) {
+            EXPECT_EQ(it->first, expected_it->first);
+        }
+        it = view.upper_bound(key);
+        expected_it = expected.upper_bound(key);
+        ASSERT_EQ(it == view.end(), expected_it == expected.end());
+        if (expected_it != expected.end()) {
+            EXPECT_EQ(it->first, expected_it->first);
+        }
+        EXPECT_EQ(view.contains(key), expected.count(key) == 1);
+        EXPECT_EQ(snapshot.find(key) != snapshot.end(), expected.count(key) == 1);
+        EXPECT_EQ(map.contains(key), expected.count(key) == 1);
+    }
+}
+
+TEST(ConcurrentMapTest, DisjointWritersSplitStripes) {
+    int writers = 16;
+    int per_writer = 3000;
+    polyndrom::concurrent_map<int, int> map;
+    std::atomic<bool> done{false};
+    std::atomic<size_t> failures{0};
+    std::thread reader([&] {
+        while (!done.load()) {
+            // Every writer inserts its range in order, so a complete version
+            // holds a prefix of each range, however the stripes cut them.
+            auto view = map.read();
+            std::vector<int> next(writers);
+            size_t count = 0;
+            for (auto& [key, value] : view) {
+                int writer = key / per_writer;
+                failures += key != writer * per_writer + next[writer] || value != writer;
+                next[writer] = key - writer * per_writer + 1;
+                count++;
+            }
+            failures += count != view.size();
+        }
+    });
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writers; w++) {
+        threads.emplace_back([&, w] {
+            for (int i = w * per_writer; i < (w + 1) * per_writer; i++) {
+                map.emplace(i, w);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    done = true;
+    reader.join();
+    EXPECT_EQ(failures.load(), 0u);
+    EXPECT_GT(polyndrom::version_stripes(map), 1u);
+    EXPECT_TRUE(polyndrom::verify_version_tree(map));
+    EXPECT_EQ(map.size(), static_cast<size_t>(writers * per_writer));
+    for (int i = 0; i < writers * per_writer; i += 97) {
+        EXPECT_EQ(map.get(i), i / per_writer);
+    }
+}
+
+TEST(ConcurrentMapTest, TransactionsSpanStripes) {
+    int n = 9999;
+    polyndrom::concurrent_map<int, int> map;
+    for (int i = 0; i < n; i++) {
+        map.emplace(i, 0);
+    }
+    ASSERT_GT(polyndrom::version_stripes(map), 1u);
+    std::atomic<bool> done{false};
+    std::atomic<size_t> failures{0};
+    std::thread reader([&] {
+        while (!done.load()) {
+            auto view = map.read();
+            int round = view.begin()->second;
+            for (auto& [key, value] : view) {
+                failures += value != round;
+            }
+            failures += view.size() != static_cast<size_t>(n);
+        }
+    });
+    for (int round = 1; round <= 30; round++) {
+        polyndrom::concurrent_map<int, int>::transaction transaction(map);
+        for (int i = 0; i < n; i += 3) {
+            transaction.insert_or_assign(i, round);
+            transaction.insert_or_assign(i + 1, round);
+            transaction.insert_or_assign(i + 2, round);
+        }
+        transaction.commit();
+    }
+    done = true;
+    reader.join();
+    EXPECT_EQ(failures.load(), 0u);
+    EXPECT_TRUE(polyndrom::verify_version_tree(map));
+    map.clear();
+    EXPECT_EQ(polyndrom::version_stripes(map), 1u);
+    EXPECT_TRUE(map.empty());
+}
\ No newline at end of file
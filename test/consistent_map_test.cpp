@@ -1,9 +1,16 @@
 #include "acid_map.hpp"
+#include "node_pool.hpp"
+#include "wide_node_map.hpp"
 #include "tree_verifier.hpp"
 #include "utils.hpp"
 
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <optional>
+#include <sstream>
+#include <thread>
+
 TEST(ConsistentMapTest, InvalidateAllDirect) {
     int n = 10000;
     polyndrom::acid_map<int, int> map;
@@ -134,4 +141,472 @@ TEST(ConsistentMapTest, RandomStepsInvalidate) {
         }
         EXPECT_TRUE(map.contains(it->first));
     }
+}
+
+TEST(ConsistentMapTest, LookupsDoNotPin) {
+    int n = 10000;
+    polyndrom::acid_map<int, int> map;
+    for (int i = 0; i < n; i++) {
+        map.emplace(i, i);
+    }
+    for (int i = 0; i < 2 * n; i++) {
+        EXPECT_EQ(map.contains(i), i < n);
+        EXPECT_EQ(map.find(i) != map.end(), i < n);
+    }
+    for (auto it = map.begin(); it != map.end(); ++it) {
+        EXPECT_TRUE(map.contains(it->first));
+    }
+    EXPECT_TRUE(polyndrom::verify_unpinned(map));
+    {
+        auto it = map.find(n / 2);
+        std::ostringstream fails;
+        EXPECT_FALSE(polyndrom::verify_unpinned(map, fails));
+    }
+    EXPECT_TRUE(polyndrom::verify_unpinned(map));
+}
+TEST(ConsistentMapTest, ClearKeepsPinnedNodes) {
+    int n = 10000;
+    polyndrom::acid_map<int, complex_object> map;
+    complex_object_generator generator;
+    std::vector<decltype(map.begin())> its;
+    std::vector<complex_object> values;
+    for (int i = 0; i < n; i++) {
+        auto it = map.emplace(i, generator.next_value()).first;
+        if (i % 7 == 0) {
+            its.push_back(it);
+            values.push_back(it->second);
+        }
+    }
+    map.clear();
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(map.begin(), map.end());
+    for (int i = 0; i < n; i++) {
+        map.emplace(i, complex_object());
+    }
+    EXPECT_TRUE(polyndrom::verify_tree(map));
+    for (size_t i = 0; i < its.size(); i++) {
+        EXPECT_EQ(its[i]->first, static_cast<int>(i) * 7);
+        EXPECT_EQ(its[i]->second, values[i]);
+        auto it = its[i];
+        EXPECT_EQ(++it, map.end());
+    }
+}
+
+TEST(ConsistentMapTest, ClearOnReclaimer) {
+    int n = 100000;
+    polyndrom::background_reclaimer reclaimer;
+    polyndrom::acid_map<int, std::string> map;
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < n; i++) {
+            map.emplace(i, std::to_string(i));
+        }
+        map.clear(reclaimer);
+        EXPECT_TRUE(map.empty());
+        EXPECT_FALSE(map.contains(n / 2));
+    }
+    reclaimer.drain();
+    map.emplace(1, "1");
+    EXPECT_EQ(map.size(), 1);
+}
+TEST(ConsistentMapTest, RankedRandomInvalidate) {
+    int n = 10000;
+    int m = 5000;
+    polyndrom::acid_map<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+                        polyndrom::order_statistic_traits> map;
+    for (int i = 0; i < n; i++) {
+        map.emplace(i, i);
+    }
+    std::vector<decltype(map.begin())> its;
+    its.reserve(m);
+    for (int i = 0; i < m; i++) {
+        auto it = random_element(map);
+        EXPECT_EQ(static_cast<size_t>(std::distance(map.begin(), it)), map.rank(it->first));
+        its.push_back(it);
+        map.erase(it);
+        EXPECT_FALSE(map.contains(it->first));
+    }
+    EXPECT_EQ(map.size(), static_cast<size_t>(n - m));
+    EXPECT_TRUE(polyndrom::verify_tree(map));
+    its.clear();
+    EXPECT_TRUE(polyndrom::verify_unpinned(map));
+}
+TEST(ConsistentMapTest, WideRandomInvalidate) {
+    int n = 10000;
+    int m = 5000;
+    polyndrom::acid_map<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+                        polyndrom::wide_node_traits<8>> map;
+    for (int i = 0; i < n; i++) {
+        map.emplace(i, i);
+    }
+    std::vector<decltype(map.begin())> its;
+    for (int i = 0; i < m; i++) {
+        its.push_back(random_element(map));
+        map.erase(its.back());
+    }
+    EXPECT_TRUE(polyndrom::verify_wide_tree(map));
+    // An erased element steps to the nearest live key on either side.
+    for (auto it : its) {
+        int key = it->first;
+        EXPECT_FALSE(map.contains(key));
+        auto next = std::next(it);
+        auto expected = map.upper_bound(key);
+        EXPECT_EQ(next, expected);
+        auto prev = std::prev(it);
+        if (expected == map.begin()) {
+            EXPECT_EQ(prev, map.end());
+        } else {
+            EXPECT_EQ(prev, std::prev(expected));
+        }
+    }
+    for (auto& it : its) {
+        it = map.end();
+    }
+    map.clear();
+    EXPECT_TRUE(polyndrom::verify_wide_tree(map));
+}
+
+TEST(ConsistentMapTest, WideClearKeepsPinnedNodes) {
+    int n = 10000;
+    polyndrom::acid_map<int, complex_object, std::less<int>, std::allocator<std::pair<const int, complex_object>>,
+                        polyndrom::wide_node_traits<>> map;
+    complex_object_generator generator;
+    std::vector<decltype(map.begin())> its;
+    std::vector<complex_object> values;
+    for (int i = 0; i < n; i++) {
+        auto it = map.emplace(i, generator.next_value()).first;
+        if (i % 7 == 0) {
+            its.push_back(it);
+            values.push_back(it->second);
+        }
+    }
+    map.clear();
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(map.begin(), map.end());
+    for (int i = 0; i < n; i += 2) {
+        map.emplace(i, complex_object());
+    }
+    EXPECT_TRUE(polyndrom::verify_wide_tree(map));
+    for (size_t i = 0; i < its.size(); i++) {
+        int key = static_cast<int>(i) * 7;
+        EXPECT_EQ(its[i]->first, key);
+        EXPECT_EQ(its[i]->second, values[i]);
+        auto it = its[i];
+        ++it;
+        if (key + 1 < n) {
+            EXPECT_EQ(it->first, key % 2 == 0 ? key + 2 : key + 1);
+        }
+    }
+}
+
+TEST(ConsistentMapTest, ErasedNodesStepToNeighbours) {
+    int n = 10000;
+    int m = 5000;
+    polyndrom::acid_map<int, int> map;
+    for (int i = 0; i < n; i++) {
+        map.emplace(i, i);
+    }
+    std::vector<decltype(map.begin())> its;
+    for (int i = 0; i < m; i++) {
+        its.push_back(random_element(map));
+        map.erase(its.back());
+    }
+    EXPECT_TRUE(polyndrom::verify_tree(map));
+    for (auto it : its) {
+        int key = it->first;
+        EXPECT_FALSE(map.contains(key));
+        auto next = std::next(it);
+        auto expected = map.upper_bound(key);
+        EXPECT_EQ(next, expected);
+        auto prev = std::prev(it);
+        if (expected == map.begin()) {
+            EXPECT_EQ(prev, map.end());
+        } else {
+            EXPECT_EQ(prev, std::prev(expected));
+        }
+        // Erasing it again leaves the map alone and lands where ++ would.
+        EXPECT_EQ(map.erase(it), expected);
+        EXPECT_TRUE(map.extract(it).empty());
+    }
+    EXPECT_EQ(map.size(), static_cast<size_t>(n - m));
+    EXPECT_TRUE(polyndrom::verify_tree(map));
+}
+
+TEST(ConsistentMapTest, ReverseIteratorsKeepErasedNodes) {
+    int n = 10000;
+    polyndrom::acid_map<int, int> map;
+    for (int i = 0; i < n; i++) {
+        map.emplace(i, i);
+    }
+    std::vector<decltype(map.rbegin())> its;
+    for (auto it = map.rbegin(); it != map.rend(); ++it) {
+        if (it->first % 3 == 0) {
+            its.push_back(it);
+        }
+    }
+    for (int i = 0; i < n; i += 3) {
+        map.erase(i);
+    }
+    for (auto it : its) {
+        int key = it->first;
+        EXPECT_EQ(it->second, key);
+        ++it;
+        if (key == 0) {
+            EXPECT_EQ(it, map.rend());
+        } else {
+            EXPECT_EQ(it->first, key - 1);
+        }
+    }
+    int count = 0;
+    for (auto it = map.crbegin(); it != map.crend(); ++it) {
+        EXPECT_NE(it->first % 3, 0);
+        count++;
+    }
+    EXPECT_EQ(count, static_cast<int>(map.size()));
+}
+
+TEST(ConsistentMapTest, ConstLookupsDoNotPin) {
+    int n = 10000;
+    polyndrom::acid_map<int, int> map;
+    for (int i = 0; i < n; i++) {
+        map.emplace(i, i);
+    }
+    const auto& reader = map;
+    long long sum = 0;
+    for (int i = 0; i < n; i += 7) {
+        EXPECT_TRUE(reader.contains(i));
+        sum += reader.at(i);
+    }
+    reader.for_each_in_range(0, n, [&](const auto& value) {
+        sum -= value.second;
+    });
+    EXPECT_NE(sum, 0);
+    EXPECT_TRUE(polyndrom::verify_unpinned(map));
+    {
+        auto it = reader.find(n / 2);
+        std::ostringstream fails;
+        EXPECT_FALSE(polyndrom::verify_unpinned(map, fails));
+    }
+    EXPECT_TRUE(polyndrom::verify_unpinned(map));
+}
+
+template <class Map>
+void check_shared_const_readers() {
+    int n = 10000;
+    Map map;
+    for (int i = 0; i < n; i++) {
+        map.emplace(i, i);
+    }
+    const Map& reader = map;
+    std::vector<std::thread> threads;
+    std::vector<long long> sums(4);
+    for (size_t t = 0; t < sums.size(); t++) {
+        threads.emplace_back([&, t] {
+            for (int round = 0; round < 20; round++) {
+                for (int i = 0; i < n; i += 3) {
+                    sums[t] += reader.find(i)->second;
+                }
+                for (auto it = reader.lower_bound(n / 2); it != reader.end(); ++it) {
+                    sums[t] -= it->second;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(std::count(sums.begin(), sums.end(), sums.front()), static_cast<long>(sums.size()));
+    EXPECT_EQ(map.size(), static_cast<size_t>(n));
+}
+
+TEST(ConsistentMapTest, ConstReadersShareMap) {
+    check_shared_const_readers<polyndrom::acid_map<int, int>>();
+    check_shared_const_readers<polyndrom::acid_map<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+                                                   polyndrom::deferred_reclamation_traits>>();
+    check_shared_const_readers<polyndrom::acid_map<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+                                                   polyndrom::wide_node_traits<8>>>();
+}
+
+TEST(ConsistentMapTest, SplitAndMergeKeepPinnedNodes) {
+    int n = 10000;
+    polyndrom::acid_map<int, int> map;
+    for (int i = 0; i < n; i++) {
+        map.emplace(i, i);
+    }
+    std::vector<decltype(map.begin())> its;
+    for (int i = 0; i < n; i += 13) {
+        its.push_back(map.find(i));
+    }
+    auto upper = map.split(n / 2);
+    for (auto& it : its) {
+        EXPECT_EQ(it->first, it->second);
+    }
+    polyndrom::acid_map<int, int> overlapping;
+    for (int i = n / 2 - 100; i < n / 2 + 100; i++) {
+        overlapping.emplace(i, -i);
+    }
+    upper.merge(overlapping);
+    map.merge(upper);
+    EXPECT_TRUE(polyndrom::verify_tree(map));
+    EXPECT_TRUE(polyndrom::verify_tree(overlapping));
+    EXPECT_EQ(map.size(), static_cast<size_t>(n));
+    EXPECT_EQ(overlapping.size(), 100u);
+    for (auto& it : its) {
+        EXPECT_EQ(it->first, it->second);
+        auto next = std::next(it);
+        if (it->first + 1 < n) {
+            EXPECT_EQ(next->first, it->first + 1);
+        }
+    }
+    its.clear();
+    EXPECT_TRUE(polyndrom::verify_unpinned(map));
+}
+
+// Pool allocators of different maps hand out nodes from different pools, so
+// an element unpinned through the wrong map lands in the wrong free list.
+template <class Traits>
+void check_iterators_follow_tree() {
+    using map_type = polyndrom::acid_map<int, int, std::less<int>, polyndrom::pool_allocator<std::pair<const int, int>>,
+                                         Traits>;
+    map_type a;
+    std::optional<map_type> b(std::in_place);
+    for (int i = 0; i < 10; i++) {
+        a.emplace(i, i);
+    }
+    {
+        auto it = a.find(3);
+        a.swap(*b);
+        b->erase(3);
+        EXPECT_EQ(it->first, 3);
+        EXPECT_EQ(std::next(it)->first, 4);
+    }
+    b->swap(a);
+    b.reset();
+    for (int i = 10; i < 20; i++) {
+        a.emplace(i, i);
+    }
+    // Maps are declared before the iterators, which must not outlive them.
+    std::optional<map_type> source(std::move(a));
+    std::optional<map_type> moved;
+    std::optional<map_type> upper;
+    auto it = source->find(5);
+    auto last = source->end();
+    moved.emplace(std::move(*source));
+    source.reset();
+    moved->erase(5);
+    EXPECT_EQ(std::next(it)->first, 6);
+    EXPECT_EQ(std::prev(last)->first, 19);
+    a.emplace(0, 0);
+    EXPECT_EQ(std::prev(a.end())->first, 0);
+    auto upper_it = moved->find(15);
+    auto lower_it = moved->find(1);
+    upper.emplace(moved->split(10));
+    upper->erase(15);
+    EXPECT_EQ(upper_it->first, 15);
+    EXPECT_EQ(std::next(lower_it)->first, 2);
+    auto moved_it = upper->find(16);
+    EXPECT_EQ(std::next(moved_it)->first, 17);
+    EXPECT_EQ(upper->size(), 9u);
+    EXPECT_EQ(moved->size(), 8u);
+}
+
+TEST(ConsistentMapTest, IteratorsFollowSwapMoveAndSplit) {
+    check_iterators_follow_tree<polyndrom::default_map_traits>();
+    check_iterators_follow_tree<polyndrom::deferred_reclamation_traits>();
+    check_iterators_follow_tree<polyndrom::wide_node_traits<4>>();
+}
+
+TEST(ConsistentMapTest, ExtractKeepsPinnedNodes) {
+    int n = 10000;
+    polyndrom::acid_map<int, int> map;
+    polyndrom::acid_map<int, int> other;
+    for (int i = 0; i < n; i++) {
+        map.emplace(i, i);
+    }
+    std::vector<decltype(map.begin())> its;
+    for (int i = 0; i < n; i += 5) {
+        its.push_back(map.find(i));
+    }
+    for (int i = 0; i < n; i += 5) {
+        if (i % 2 == 0) {
+            other.insert(map.extract(i));
+        } else {
+            map.extract(i);
+        }
+    }
+    EXPECT_TRUE(polyndrom::verify_tree(map));
+    EXPECT_TRUE(polyndrom::verify_tree(other));
+    EXPECT_EQ(map.size(), static_cast<size_t>(n - n / 5));
+    // Moved nodes carry on in the map they were inserted into, dropped ones
+    // step to their live neighbour.
+    for (auto it : its) {
+        int key = it->first;
+        EXPECT_EQ(it->second, key);
+        ++it;
+        int next = key % 2 == 0 ? key + 10 : key + 1;
+        if (next < n) {
+            EXPECT_EQ(it->first, next);
+        }
+    }
+    its.clear();
+    EXPECT_TRUE(polyndrom::verify_unpinned(map));
+    EXPECT_TRUE(polyndrom::verify_unpinned(other));
+}
+
+namespace {
+
+struct counted_value {
+    static inline int destroyed = 0;
+    explicit counted_value(int value) : value(value) {}
+    ~counted_value() {
+        destroyed++;
+    }
+    int value;
+};
+
+} // namespace
+
+TEST(ConsistentMapTest, DeferredReclamation) {
+    int n = 10000;
+    polyndrom::acid_map<int, counted_value, std::less<int>, std::allocator<std::pair<const int, counted_value>>,
+                        polyndrom::deferred_reclamation_traits>
+        map;
+    for (int i = 0; i < n; i++) {
+        map.try_emplace(i, i);
+    }
+    std::vector<decltype(map.begin())> its;
+    for (int i = 0; i < n; i++) {
+        its.push_back(map.find(i));
+    }
+    counted_value::destroyed = 0;
+    for (int i = 0; i < n; i++) {
+        map.erase(i);
+    }
+    EXPECT_EQ(counted_value::destroyed, 0);
+    its.clear();
+    EXPECT_EQ(counted_value::destroyed, 0);
+    EXPECT_GT(map.pending_reclamation(), 0u);
+    EXPECT_EQ(map.reclaim(10), 10u);
+    EXPECT_EQ(counted_value::destroyed, 10);
+    // Every insertion pays for one batch.
+    map.try_emplace(n, n);
+    EXPECT_EQ(counted_value::destroyed, 10 + 16);
+    // Erased parents are queued as their last child goes, so draining frees
+    // everything.
+    map.reclaim();
+    EXPECT_EQ(map.pending_reclamation(), 0u);
+    EXPECT_EQ(counted_value::destroyed, n);
+    EXPECT_EQ(map.size(), 1u);
+    EXPECT_TRUE(polyndrom::verify_tree(map));
+    // A const iterator queues its erased element with the tree, which
+    // takes the queue along into the map it is swapped into.
+    const auto& reader = map;
+    auto pinned = reader.find(n);
+    map.erase(n);
+    decltype(map) other;
+    other.swap(map);
+    pinned = other.cend();
+    EXPECT_EQ(map.pending_reclamation(), 0u);
+    EXPECT_EQ(other.pending_reclamation(), 1u);
+    EXPECT_EQ(other.reclaim(), 1u);
+    EXPECT_EQ(counted_value::destroyed, n + 1);
 }
\ No newline at end of file
@@ -1,9 +1,18 @@
 #include "acid_map.hpp"
+#include "wide_node_map.hpp"
 #include "tree_verifier.hpp"
 #include "utils.hpp"
 
 #include "gtest/gtest.h"
 
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
 using std::cout;
 using std::endl;
 
@@ -204,8 +213,12 @@ TEST_F(FilledMapTest, EraseByIterator) {
         auto it = map_.begin();
         std::advance(it, std::distance(inserted_values_.begin(), random_it));
         it = map_.erase(it);
-        EXPECT_EQ(it->first, next(random_it)->first);
-        EXPECT_EQ(it->second, next(random_it)->second);
+        if (next(random_it) == inserted_values_.end()) {
+            EXPECT_EQ(it, map_.end());
+        } else {
+            EXPECT_EQ(it->first, next(random_it)->first);
+            EXPECT_EQ(it->second, next(random_it)->second);
+        }
         EXPECT_EQ(prev_size - 1, map_.size());
         inserted_values_.erase(random_it);
     }
@@ -349,4 +362,1126 @@ TEST_F(FilledMapTest, IteratorReversePostfixMove) {
         EXPECT_EQ(prev_it->first, key);
         EXPECT_EQ(prev_it->second, value);
     }
+}
+
+TEST(MapNodeTest, CompactLayout) {
+    using value_type = std::pair<const int, int>;
+    EXPECT_EQ(sizeof(map_node<value_type>), 3 * sizeof(void*) + sizeof(uint64_t) + sizeof(value_type));
+    EXPECT_EQ(sizeof(polyndrom::acid_map<int, int>::iterator), 2 * sizeof(void*));
+}
+struct counting_less {
+    bool operator()(int lhs, int rhs) const {
+        ++comparisons;
+        return lhs < rhs;
+    }
+    static inline size_t comparisons = 0;
+};
+
+class three_way_key {
+public:
+    three_way_key(int value) : value_(value) {}
+    int compare(const three_way_key& other) const {
+        ++three_way_calls;
+        return value_ < other.value_ ? -1 : (value_ > other.value_ ? 1 : 0);
+    }
+    bool operator<(const three_way_key& other) const {
+        ++less_calls;
+        return value_ < other.value_;
+    }
+    int value_;
+    static inline size_t three_way_calls = 0;
+    static inline size_t less_calls = 0;
+};
+
+std::ostream& operator<<(std::ostream& os, const three_way_key& key) {
+    return os << key.value_;
+}
+
+TEST(MapLookupTest, SingleComparisonPerLevel) {
+    int n = 1 << 14;
+    polyndrom::acid_map<int, int, counting_less> map;
+    for (int i = 0; i < n; i++) {
+        map.emplace(i, i);
+    }
+    size_t max_comparisons = static_cast<size_t>(1.45 * std::log2(n + 2)) + 1;
+    for (int i = -1; i <= n; i++) {
+        counting_less::comparisons = 0;
+        EXPECT_EQ(map.contains(i), i >= 0 && i < n);
+        EXPECT_LE(counting_less::comparisons, max_comparisons);
+    }
+    EXPECT_TRUE(polyndrom::verify_tree(map));
+}
+
+enum class small_key : uint8_t {};
+
+TEST(MapLookupTest, BranchlessTrivialKeys) {
+    static_assert(polyndrom::is_trivial_key<std::less<int>, int, int>);
+    static_assert(polyndrom::is_trivial_key<std::less<>, small_key, small_key>);
+    static_assert(!polyndrom::is_trivial_key<counting_less, int, int>);
+    polyndrom::acid_map<double, int> doubles;
+    polyndrom::acid_map<small_key, int> enums;
+    polyndrom::acid_map<int, int, std::less<>> ints;
+    for (int i = 0; i < 200; i += 2) {
+        doubles.emplace(i - 100.5, i);
+        enums.emplace(static_cast<small_key>(i), i);
+        ints.emplace(i - 100, i);
+    }
+    for (int i = -1; i <= 200; i++) {
+        EXPECT_EQ(doubles.contains(i - 100.5), i >= 0 && i < 200 && i % 2 == 0);
+        EXPECT_EQ(enums.contains(static_cast<small_key>(i)), i >= 0 && i < 200 && i % 2 == 0);
+        EXPECT_EQ(ints.contains(static_cast<long long>(i) - 100), i >= 0 && i < 200 && i % 2 == 0);
+        auto lower = doubles.lower_bound(i - 100.0);
+        EXPECT_EQ(lower == doubles.end() ? -1 : lower->second, i < 198 ? (i + 2) / 2 * 2 : -1);
+        auto upper = ints.upper_bound(static_cast<long long>(i) - 100);
+        EXPECT_EQ(upper == ints.end() ? -1 : upper->second, i < 198 ? (i + 2) / 2 * 2 : -1);
+    }
+    std::vector<long long> keys = {-100, -99, 0, 98, 99};
+    std::vector<polyndrom::acid_map<int, int, std::less<>>::iterator> found;
+    ints.find_batch(keys.begin(), keys.end(), std::back_inserter(found));
+    EXPECT_EQ(found[0]->second, 0);
+    EXPECT_EQ(found[1], ints.end());
+    EXPECT_EQ(found[2]->second, 100);
+    EXPECT_EQ(found[3]->second, 198);
+    EXPECT_EQ(found[4], ints.end());
+    EXPECT_EQ(ints.erase(0LL), 1u);
+    EXPECT_TRUE(polyndrom::verify_tree(ints));
+}
+
+TEST(MapLookupTest, ThreeWayCompareMember) {
+    int n = 1 << 12;
+    polyndrom::acid_map<three_way_key, int> map;
+    for (int i = 0; i < n; i += 2) {
+        map.emplace(i, i);
+    }
+    three_way_key::three_way_calls = 0;
+    three_way_key::less_calls = 0;
+    for (int i = 0; i < n; i++) {
+        auto it = map.find(three_way_key(i));
+        if (i % 2 == 0) {
+            EXPECT_EQ(it->second, i);
+        } else {
+            EXPECT_EQ(it, map.end());
+        }
+    }
+    EXPECT_EQ(three_way_key::less_calls, 0);
+    EXPECT_GT(three_way_key::three_way_calls, 0);
+    EXPECT_TRUE(polyndrom::verify_tree(map));
+}
+
+TEST(MapLookupTest, ThreeWayStringLookup) {
+    polyndrom::acid_map<std::string, int> map;
+    string_generator generator(1, 20);
+    std::vector<std::string> keys;
+    for (int i = 0; i < 1000; i++) {
+        keys.push_back(generator.next_value());
+        map.emplace(keys.back(), i);
+    }
+    for (auto& key : keys) {
+        EXPECT_TRUE(map.contains(std::string_view(key)));
+        EXPECT_EQ(map.find(std::string_view(key))->first, key);
+    }
+    EXPECT_FALSE(map.contains(std::string_view("not a generated key")));
+}
+
+struct counted_key {
+    counted_key() = default;
+    explicit counted_key(std::string_view value) : value(value) {
+        ++constructions;
+    }
+    std::string value;
+    static inline size_t constructions = 0;
+};
+
+struct counted_key_less {
+    using is_transparent = void;
+    bool operator()(const counted_key& lhs, const counted_key& rhs) const {
+        return lhs.value < rhs.value;
+    }
+    bool operator()(const counted_key& lhs, std::string_view rhs) const {
+        return lhs.value < rhs;
+    }
+    bool operator()(std::string_view lhs, const counted_key& rhs) const {
+        return lhs < rhs.value;
+    }
+};
+
+template <class Map>
+void check_heterogeneous_api() {
+    Map map;
+    for (int i = 0; i < 100; i += 2) {
+        map.try_emplace(std::to_string(100 + i), i);
+    }
+    counted_key::constructions = 0;
+    using namespace std::string_view_literals;
+    EXPECT_EQ(map.at("110"sv), 10);
+    EXPECT_THROW(map.at("111"sv), std::out_of_range);
+    EXPECT_EQ(map.count("120"sv), 1u);
+    EXPECT_EQ(map.lower_bound("121"sv)->second, 22);
+    EXPECT_EQ(map.equal_range("130"sv).first->second, 30);
+    size_t visited = 0;
+    map.for_each_in_range("140"sv, "150"sv, [&](auto&) { visited++; });
+    EXPECT_EQ(visited, 5u);
+    EXPECT_FALSE(map.try_emplace("160"sv, -1).second);
+    EXPECT_EQ(map.erase("170"sv), 1u);
+    EXPECT_EQ(map.erase("171"sv), 0u);
+    auto node = map.extract("180"sv);
+    ASSERT_FALSE(node.empty());
+    EXPECT_EQ(node.mapped(), 80);
+    EXPECT_TRUE(map.extract("181"sv).empty());
+    EXPECT_EQ(counted_key::constructions, 0u);
+    EXPECT_TRUE(map.try_emplace("181"sv, 81).second);
+    EXPECT_EQ(counted_key::constructions, 1u);
+    EXPECT_EQ(map.erase(map.find("181"sv))->second, 82);
+    EXPECT_EQ(map.size(), 48u);
+}
+
+struct rvalue_key {
+    std::string value;
+    explicit operator std::string() && {
+        return std::move(value);
+    }
+};
+
+TEST(MapLookupTest, HeterogeneousLookupAndErase) {
+    check_heterogeneous_api<polyndrom::acid_map<counted_key, int, counted_key_less>>();
+    check_heterogeneous_api<polyndrom::acid_map<counted_key, int, counted_key_less,
+                                                std::allocator<std::pair<const counted_key, int>>,
+                                                polyndrom::wide_node_traits<8>>>();
+    // Keys of other types that the comparator does not take are converted
+    // once, not at every level of the tree.
+    polyndrom::acid_map<std::string, int> map;
+    map.try_emplace("a", 1);
+    map.try_emplace(std::string_view("b"), 2);
+    EXPECT_EQ(map.at("a"), 1);
+    EXPECT_EQ(map.extract("b").mapped(), 2);
+    EXPECT_EQ(map.erase("a"), 1u);
+    EXPECT_TRUE(map.empty());
+    // Only the conversion is compiled for such keys, so one that converts
+    // just once, as an rvalue, works as well.
+    rvalue_key key{"c"};
+    EXPECT_TRUE(map.try_emplace(std::move(key), 3).second);
+    polyndrom::acid_map<std::string, int, std::less<std::string>, std::allocator<std::pair<const std::string, int>>,
+                        polyndrom::wide_node_traits<8>> wide;
+    EXPECT_TRUE(wide.try_emplace(rvalue_key{"c"}, 3).second);
+    EXPECT_EQ(map.at("c"), wide.at("c"));
+}
+TEST(MapRebalanceTest, RandomInsertErase) {
+    int n = 20000;
+    polyndrom::acid_map<int, int> map;
+    std::set<int> expected;
+    int_generator key_generator(0, n / 4);
+    int_generator op_generator(0, 2);
+    for (int i = 0; i < n; i++) {
+        int key = key_generator.next_value();
+        if (op_generator.next_value() == 0) {
+            EXPECT_EQ(map.erase(key), expected.erase(key));
+        } else {
+            EXPECT_EQ(map.emplace(key, key).second, expected.insert(key).second);
+        }
+        if (i % 1000 == 0) {
+            ASSERT_TRUE(polyndrom::verify_tree(map));
+        }
+    }
+    EXPECT_EQ(map.size(), expected.size());
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), map.begin(),
+                           [](int key, auto& value) { return key == value.first; }));
+    EXPECT_TRUE(polyndrom::verify_tree(map));
+}
+TEST(MapBulkBuildTest, BuildFromSortedRange) {
+    for (int n : {0, 1, 2, 3, 7, 8, 31, 50, 10000}) {
+        std::vector<std::pair<const int, int>> values;
+        for (int i = 0; i < n; i++) {
+            values.emplace_back(i * 2, i);
+        }
+        polyndrom::acid_map<int, int> map(polyndrom::sorted_unique, values.begin(), values.end());
+        EXPECT_EQ(map.size(), static_cast<size_t>(n));
+        EXPECT_TRUE(std::equal(values.begin(), values.end(), map.begin(), map.end()));
+        EXPECT_TRUE(polyndrom::verify_tree(map));
+        EXPECT_TRUE(polyndrom::verify_unpinned(map));
+        if (n > 0) {
+            EXPECT_LE(polyndrom::tree_height(map), static_cast<int>(std::log2(n)) + 1);
+        }
+    }
+}
+
+TEST(MapBulkBuildTest, MergeSortedRangeKeepsExisting) {
+    polyndrom::acid_map<int, int> map;
+    std::map<int, int> expected;
+    for (int i = 0; i < 300; i += 3) {
+        map.emplace(i, -1);
+        expected.emplace(i, -1);
+    }
+    auto pinned = map.find(150);
+    std::vector<std::pair<const int, int>> values;
+    for (int i = 0; i < 600; i += 2) {
+        values.emplace_back(i, i);
+        expected.emplace(i, i);
+    }
+    map.insert(polyndrom::sorted_unique, values.begin(), values.end());
+    EXPECT_EQ(map.size(), expected.size());
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), map.begin(), map.end()));
+    EXPECT_TRUE(polyndrom::verify_tree(map));
+    EXPECT_EQ(pinned->second, -1);
+    EXPECT_EQ((++pinned)->first, 152);
+}
+
+TEST(MapBulkBuildTest, InsertUnsortedRange) {
+    std::vector<std::pair<int, int>> values = {{5, 0}, {1, 1}, {3, 2}, {1, 3}};
+    polyndrom::acid_map<int, int> map(values.begin(), values.end());
+    std::map<int, int> expected(values.begin(), values.end());
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), map.begin(), map.end()));
+}
+TEST(MapHintTest, AppendWithHint) {
+    int n = 1 << 12;
+    polyndrom::acid_map<int, int, counting_less> map;
+    auto hint = map.end();
+    for (int i = 0; i < n; i++) {
+        counting_less::comparisons = 0;
+        hint = map.emplace_hint(hint, i, i);
+        EXPECT_LE(counting_less::comparisons, 3u);
+        EXPECT_EQ(hint->first, i);
+    }
+    for (int i = n - 1; i >= 0; i -= 2) {
+        hint = map.insert(map.end(), std::make_pair(i + n, i));
+    }
+    EXPECT_EQ(map.size(), static_cast<size_t>(n + n / 2));
+    EXPECT_TRUE(polyndrom::verify_tree(map));
+}
+
+TEST(MapHintTest, WrongAndErasedHints) {
+    polyndrom::acid_map<int, int> map;
+    std::set<int> expected;
+    int_generator key_generator(0, 5000);
+    auto hint = map.end();
+    for (int i = 0; i < 5000; i++) {
+        int key = key_generator.next_value();
+        if (i % 3 == 0 && hint != map.end()) {
+            auto erased = hint;
+            ++hint;
+            expected.erase(erased->first);
+            map.erase(erased);
+            hint = map.emplace_hint(erased, key, key);
+        } else {
+            hint = map.emplace_hint(hint, key, key);
+        }
+        EXPECT_EQ(hint->first, key);
+        expected.insert(key);
+    }
+    EXPECT_EQ(map.size(), expected.size());
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), map.begin(),
+                           [](int key, auto& value) { return key == value.first; }));
+    EXPECT_TRUE(polyndrom::verify_tree(map));
+}
+TEST(MapRangeTest, BoundsMatchStdMap) {
+    polyndrom::acid_map<int, int> map;
+    std::map<int, int> expected;
+    int_generator key_generator(0, 10000);
+    for (int i = 0; i < 2000; i++) {
+        int key = key_generator.next_value();
+        map.emplace(key, i);
+        expected.emplace(key, i);
+    }
+    auto position = [](auto it, auto end) {
+        return it == end ? -1 : it->first;
+    };
+    for (int key = -1; key <= 10001; key += 7) {
+        EXPECT_EQ(position(map.lower_bound(key), map.end()), position(expected.lower_bound(key), expected.end()));
+        EXPECT_EQ(position(map.upper_bound(key), map.end()), position(expected.upper_bound(key), expected.end()));
+        auto [first, last] = map.equal_range(key);
+        auto [expected_first, expected_last] = expected.equal_range(key);
+        EXPECT_EQ(position(first, map.end()), position(expected_first, expected.end()));
+        EXPECT_EQ(position(last, map.end()), position(expected_last, expected.end()));
+    }
+}
+
+TEST(MapRangeTest, ForEachInRange) {
+    polyndrom::acid_map<std::string, int, std::less<>> map;
+    for (int i = 0; i < 100; i++) {
+        map.emplace(std::to_string(1000 + i), i);
+    }
+    std::vector<int> visited;
+    map.for_each_in_range(std::string_view("1010"), std::string_view("1020"), [&](auto& value) {
+        visited.push_back(value.second);
+    });
+    std::vector<int> expected = {10, 11, 12, 13, 14, 15, 16, 17, 18, 19};
+    EXPECT_EQ(visited, expected);
+    visited.clear();
+    map.for_each_in_range(std::string_view("2"), std::string_view("3"), [&](auto& value) {
+        visited.push_back(value.second);
+    });
+    EXPECT_TRUE(visited.empty());
+    EXPECT_EQ(map.lower_bound(std::string_view("10985"))->second, 99);
+    EXPECT_TRUE(map.upper_bound(std::string_view("1099")) == map.end());
+}
+TEST(MapOrderStatisticTest, NthAndRank) {
+    int n = 20000;
+    polyndrom::acid_map<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+                        polyndrom::order_statistic_traits> map;
+    std::set<int> expected;
+    int_generator key_generator(0, n / 4);
+    int_generator op_generator(0, 2);
+    for (int i = 0; i < n; i++) {
+        int key = key_generator.next_value();
+        if (op_generator.next_value() == 0) {
+            EXPECT_EQ(map.erase(key), expected.erase(key));
+        } else {
+            EXPECT_EQ(map.emplace(key, key).second, expected.insert(key).second);
+        }
+        if (i % 1000 == 0) {
+            ASSERT_TRUE(polyndrom::verify_tree(map));
+        }
+    }
+    ASSERT_TRUE(polyndrom::verify_tree(map));
+    size_t index = 0;
+    for (int key : expected) {
+        EXPECT_EQ(map.nth(index)->first, key);
+        EXPECT_EQ(map.rank(key), index);
+        EXPECT_EQ(map.rank(key + 1), index + 1);
+        index++;
+    }
+    EXPECT_TRUE(map.nth(expected.size()) == map.end());
+}
+
+TEST(MapOrderStatisticTest, RandomAccessIterator) {
+    using ranked_map = polyndrom::acid_map<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+                                           polyndrom::order_statistic_traits>;
+    static_assert(std::is_same_v<std::iterator_traits<ranked_map::iterator>::iterator_category,
+                                 std::random_access_iterator_tag>);
+    ranked_map map;
+    for (int i = 0; i < 1000; i++) {
+        map.emplace(i * 3, i);
+    }
+    auto it = map.begin();
+    std::advance(it, 500);
+    EXPECT_EQ(it->second, 500);
+    EXPECT_EQ(std::distance(map.begin(), it), 500);
+    EXPECT_EQ(map.end() - it, 500);
+    EXPECT_EQ((it - 200)->second, 300);
+    EXPECT_EQ(it[10].second, 510);
+    EXPECT_TRUE(it + 500 == map.end());
+    EXPECT_TRUE(map.begin() < it && it < map.end());
+    map.erase(it);
+    EXPECT_EQ(std::distance(map.begin(), map.end()), 999);
+}
+template <class Key, size_t Width = 32>
+using wide_map = polyndrom::acid_map<Key, int, std::less<Key>, std::allocator<std::pair<const Key, int>>,
+                                     polyndrom::wide_node_traits<Width>>;
+
+template <class Map>
+void check_wide_against_std_map(int n, int range) {
+    Map map;
+    std::map<int, int> expected;
+    int_generator key_generator(0, range);
+    int_generator op_generator(0, 3);
+    for (int i = 0; i < n; i++) {
+        int key = key_generator.next_value();
+        switch (op_generator.next_value()) {
+            case 0:
+                ASSERT_EQ(map.erase(key), expected.erase(key));
+                break;
+            case 1:
+                ASSERT_EQ(map.emplace(key, i).second, expected.emplace(key, i).second);
+                break;
+            default:
+                ASSERT_EQ(map.try_emplace(key, i).second, expected.try_emplace(key, i).second);
+                break;
+        }
+        if (i % 1000 == 0) {
+            ASSERT_TRUE(polyndrom::verify_wide_tree(map));
+        }
+    }
+    ASSERT_TRUE(polyndrom::verify_wide_tree(map));
+    EXPECT_EQ(map.size(), expected.size());
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), map.begin(), map.end(),
+                           [](auto& lhs, auto& rhs) { return lhs.first == rhs.first && lhs.second == rhs.second; }));
+    EXPECT_TRUE(std::equal(expected.rbegin(), expected.rend(), std::make_reverse_iterator(map.end()),
+                           std::make_reverse_iterator(map.begin()),
+                           [](auto& lhs, auto& rhs) { return lhs.first == rhs.first; }));
+    for (int key = -1; key <= range + 1; key++) {
+        auto it = map.lower_bound(key);
+        auto expected_it = expected.lower_bound(key);
+        ASSERT_EQ(it == map.end(), expected_it == expected.end());
+        if (expected_it != expected.end()) {
+            EXPECT_EQ(it->first, expected_it->first);
+        }
+        auto [first, last] = map.equal_range(key);
+        EXPECT_EQ(static_cast<size_t>(std::distance(first, last)), expected.count(key));
+    }
+    while (!expected.empty()) {
+        int key = expected.begin()->first;
+        expected.erase(key);
+        ASSERT_EQ(map.erase(key), 1u);
+    }
+    EXPECT_TRUE(map.empty());
+    EXPECT_TRUE(polyndrom::verify_wide_tree(map));
+}
+
+TEST(MapWideNodeTest, MatchesStdMap) {
+    check_wide_against_std_map<wide_map<int, 4>>(40000, 3000);
+    check_wide_against_std_map<wide_map<int, 5>>(20000, 2000);
+    check_wide_against_std_map<wide_map<int>>(40000, 20000);
+    check_wide_against_std_map<wide_map<int, 64>>(20000, 100000);
+}
+
+template <class Key>
+void check_wide_rank() {
+    int_generator generator(-1000, 1000);
+    for (int round = 0; round < 200; round++) {
+        std::vector<Key> keys;
+        for (int i = 0; i < 40; i++) {
+            keys.push_back(static_cast<Key>(generator.next_value()));
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        size_t count = static_cast<size_t>(round) % (keys.size() + 1);
+        Key needle = keys[static_cast<size_t>(round) % keys.size()];
+        for (Key key : {needle, static_cast<Key>(needle + 1), static_cast<Key>(needle - 1)}) {
+            size_t lower = static_cast<size_t>(std::lower_bound(keys.begin(), keys.begin() + count, key) - keys.begin());
+            size_t upper = static_cast<size_t>(std::upper_bound(keys.begin(), keys.begin() + count, key) - keys.begin());
+            EXPECT_EQ((polyndrom::wide_rank<false>(keys.data(), count, key, std::less<Key>())), lower);
+            EXPECT_EQ((polyndrom::wide_rank<true>(keys.data(), count, key, std::less<Key>())), upper);
+        }
+    }
+}
+
+TEST(MapWideNodeTest, ScanMatchesBinarySearch) {
+    check_wide_rank<int32_t>();
+    check_wide_rank<uint32_t>();
+    check_wide_rank<int64_t>();
+    check_wide_rank<uint64_t>();
+    check_wide_rank<double>();
+}
+
+TEST(MapWideNodeTest, ComplexKeysAndRanges) {
+    polyndrom::acid_map<std::string, complex_object, std::less<>, std::allocator<std::pair<const std::string,
+                        complex_object>>, polyndrom::wide_node_traits<8>> map;
+    for (int i = 0; i < 5000; i++) {
+        map.try_emplace(std::to_string(i), i, std::to_string(i));
+    }
+    EXPECT_TRUE(polyndrom::verify_wide_tree(map));
+    EXPECT_EQ(map.at("1234").num_, 1234);
+    EXPECT_TRUE(map.contains(std::string_view("4999")));
+    EXPECT_THROW(map.at("x"), std::out_of_range);
+    std::vector<std::string> visited;
+    map.for_each_in_range(std::string_view("1098"), std::string_view("1099"), [&](auto& value) {
+        visited.push_back(value.first);
+    });
+    EXPECT_EQ(visited, (std::vector<std::string>{"1098"}));
+    map["x"] = complex_object(1, "x");
+    EXPECT_EQ(map.size(), 5001u);
+    for (int i = 0; i < 5000; i += 2) {
+        map.erase(std::to_string(i));
+    }
+    EXPECT_TRUE(polyndrom::verify_wide_tree(map));
+    EXPECT_EQ(map.size(), 2501u);
+    std::vector<std::pair<const std::string, complex_object>> sorted = {{"y", {}}, {"z", {}}};
+    map.insert(polyndrom::sorted_unique, sorted.begin(), sorted.end());
+    EXPECT_EQ((--map.end())->first, "z");
+}
+
+TEST(MapWideNodeTest, StaleIteratorIsNotErasedTwice) {
+    wide_map<int, 4> map;
+    for (int i = 0; i < 100; i++) {
+        map.emplace(i, i);
+    }
+    auto it = map.find(50);
+    map.erase(50);
+    map.emplace(50, -1);
+    EXPECT_EQ(map.erase(it)->first, 51);
+    EXPECT_TRUE(map.extract(it).empty());
+    EXPECT_EQ(map.at(50), -1);
+    EXPECT_EQ(map.size(), 100u);
+    EXPECT_TRUE(polyndrom::verify_wide_tree(map));
+}
+
+TEST(MapWideNodeTest, BulkBuildSplitJoinAndMerge) {
+    for (int n : {0, 1, 4, 5, 17, 1000, 5000}) {
+        std::vector<std::pair<const int, int>> sorted;
+        for (int i = 0; i < n; i++) {
+            sorted.emplace_back(i * 2, i);
+        }
+        wide_map<int, 4> map;
+        map.insert(polyndrom::sorted_unique, sorted.begin(), sorted.end());
+        ASSERT_TRUE(polyndrom::verify_wide_tree(map));
+        ASSERT_EQ(map.size(), static_cast<size_t>(n));
+        auto it = map.find(n);
+        auto upper = map.split(n);
+        EXPECT_TRUE(polyndrom::verify_wide_tree(map));
+        EXPECT_TRUE(polyndrom::verify_wide_tree(upper));
+        EXPECT_EQ(map.size() + upper.size(), static_cast<size_t>(n));
+        EXPECT_TRUE(map.empty() || (--map.end())->first < n);
+        EXPECT_TRUE(upper.empty() || upper.begin()->first >= n);
+        if (it != upper.end()) {
+            EXPECT_EQ(it->first, n);
+            EXPECT_EQ(upper.erase(it)->first, n + 2);
+            upper.emplace(n, n / 2);
+        }
+        map.join(upper);
+        EXPECT_TRUE(upper.empty());
+        EXPECT_TRUE(polyndrom::verify_wide_tree(map));
+        EXPECT_TRUE(std::equal(sorted.begin(), sorted.end(), map.begin(), map.end()));
+    }
+    wide_map<int, 4> evens;
+    wide_map<int, 4> thirds;
+    std::map<int, int> expected;
+    for (int i = 0; i < 3000; i++) {
+        if (i % 2 == 0) {
+            evens.emplace(i, 0);
+            expected.emplace(i, 0);
+        }
+        if (i % 3 == 0) {
+            thirds.emplace(i, 1);
+            expected.emplace(i, 1);
+        }
+    }
+    EXPECT_THROW(evens.join(thirds), std::invalid_argument);
+    evens.merge(thirds);
+    EXPECT_TRUE(polyndrom::verify_wide_tree(evens));
+    EXPECT_TRUE(polyndrom::verify_wide_tree(thirds));
+    EXPECT_EQ(thirds.size(), 500u);
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), evens.begin(), evens.end(),
+                           [](auto& lhs, auto& rhs) { return lhs == rhs; }));
+    EXPECT_EQ(evens.stats().rotations, 0u);
+    EXPECT_EQ(evens.inspect().height, evens.inspect().depth_histogram.size());
+    EXPECT_EQ(evens.inspect().depth_histogram.front(), 1u);
+}
+TEST(MapBatchLookupTest, MatchesFind) {
+    polyndrom::acid_map<int, int> map;
+    int_generator generator(0, 20000);
+    for (int i = 0; i < 5000; i++) {
+        int key = generator.next_value();
+        map.emplace(key, key);
+    }
+    std::vector<int> keys;
+    for (int i = 0; i < 1000; i++) {
+        keys.push_back(generator.next_value());
+    }
+    std::vector<decltype(map.begin())> found;
+    map.find_batch(keys.begin(), keys.end(), std::back_inserter(found));
+    std::vector<bool> contained(keys.size());
+    const auto& const_map = map;
+    EXPECT_EQ(const_map.contains_batch(keys.begin(), keys.end(), contained.begin()), contained.end());
+    ASSERT_EQ(found.size(), keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        EXPECT_EQ(found[i], map.find(keys[i]));
+        EXPECT_EQ(contained[i], map.contains(keys[i]));
+    }
+    polyndrom::acid_map<int, int> empty;
+    empty.find_batch(keys.begin(), keys.end(), found.begin());
+    EXPECT_TRUE(std::all_of(found.begin(), found.end(), [&](auto& it) { return it == empty.end(); }));
+}
+
+TEST(MapBatchLookupTest, HeterogeneousAndWideKeys) {
+    polyndrom::acid_map<std::string, int, std::less<>> map;
+    wide_map<int> wide;
+    for (int i = 0; i < 100; i += 2) {
+        map.emplace(std::to_string(i), i);
+        wide.emplace(i, i);
+    }
+    std::vector<std::string_view> keys = {"0", "1", "98", "99", "x"};
+    std::vector<bool> contained(keys.size());
+    map.contains_batch(keys.begin(), keys.end(), contained.begin());
+    EXPECT_EQ(contained, (std::vector<bool>{true, false, true, false, false}));
+    std::vector<int> wide_keys = {0, 1, 98, 99, 100};
+    std::vector<decltype(wide.begin())> found;
+    wide.find_batch(wide_keys.begin(), wide_keys.end(), std::back_inserter(found));
+    EXPECT_EQ(found[0]->first, 0);
+    EXPECT_EQ(found[1], wide.end());
+    EXPECT_EQ(found[2]->first, 98);
+}
+
+template <class Map>
+void check_iterators_against_std_map() {
+    using const_iterator = typename Map::const_iterator;
+    static_assert(std::is_same_v<typename std::iterator_traits<const_iterator>::reference,
+                                 const typename Map::value_type&>);
+    static_assert(std::is_convertible_v<typename Map::iterator, const_iterator>);
+    static_assert(!std::is_convertible_v<const_iterator, typename Map::iterator>);
+    Map map;
+    std::map<int, int> expected;
+    int_generator generator(0, 100000);
+    for (int i = 0; i < 10000; i++) {
+        int key = generator.next_value();
+        map.emplace(key, i);
+        expected.emplace(key, i);
+    }
+    const Map& const_map = map;
+    auto same = [](auto& lhs, auto& rhs) {
+        return lhs.first == rhs.first && lhs.second == rhs.second;
+    };
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), const_map.begin(), const_map.end(), same));
+    EXPECT_TRUE(std::equal(expected.rbegin(), expected.rend(), map.rbegin(), map.rend(), same));
+    EXPECT_TRUE(std::equal(expected.rbegin(), expected.rend(), map.crbegin(), map.crend(), same));
+    EXPECT_EQ(std::prev(map.end())->first, expected.rbegin()->first);
+    EXPECT_EQ(std::prev(map.cend())->first, expected.rbegin()->first);
+    EXPECT_TRUE(map.cbegin() == map.begin() && map.begin() == map.cbegin());
+    EXPECT_TRUE(map.rbegin().base() == map.end() && map.rend().base() == map.begin());
+    const_iterator it = map.find(expected.begin()->first);
+    EXPECT_EQ(it, map.cbegin());
+    map.erase(it);
+    expected.erase(expected.begin());
+    EXPECT_EQ(map.begin()->first, expected.begin()->first);
+    Map empty;
+    EXPECT_EQ(empty.rbegin(), empty.rend());
+    EXPECT_EQ(std::as_const(empty).begin(), empty.end());
+}
+
+TEST(MapIteratorTest, ConstAndReverseMatchStdMap) {
+    check_iterators_against_std_map<polyndrom::acid_map<int, int>>();
+    check_iterators_against_std_map<polyndrom::acid_map<int, int, std::less<int>,
+                                                        std::allocator<std::pair<const int, int>>,
+                                                        polyndrom::order_statistic_traits>>();
+    check_iterators_against_std_map<wide_map<int>>();
+}
+
+template <class Map>
+void check_const_reads() {
+    Map map;
+    for (int i = 0; i < 1000; i++) {
+        map.emplace(i * 2, i);
+    }
+    const Map& reader = map;
+    static_assert(std::is_same_v<decltype(reader.find(0)), typename Map::const_iterator>);
+    static_assert(std::is_same_v<decltype(reader.at(0)), const int&>);
+    static_assert(std::is_same_v<decltype(*reader.lower_bound(0)), const typename Map::value_type&>);
+    for (int key = -1; key <= 2001; key++) {
+        auto it = reader.find(key);
+        ASSERT_EQ(it != reader.end(), key >= 0 && key < 2000 && key % 2 == 0);
+        if (it != reader.end()) {
+            EXPECT_EQ(it->second, key / 2);
+            EXPECT_EQ(reader.at(key), key / 2);
+        } else {
+            EXPECT_THROW(reader.at(key), std::out_of_range);
+        }
+        auto lower = reader.lower_bound(key);
+        auto upper = reader.upper_bound(key);
+        auto [first, last] = reader.equal_range(key);
+        EXPECT_EQ(first, lower);
+        EXPECT_EQ(last, upper);
+        EXPECT_EQ(std::distance(lower, upper), it == reader.end() ? 0 : 1);
+    }
+    int sum = 0;
+    reader.for_each_in_range(10, 20, [&](const typename Map::value_type& value) {
+        sum += value.second;
+    });
+    EXPECT_EQ(sum, 5 + 6 + 7 + 8 + 9);
+    std::vector<int> keys = {0, 1, 1998};
+    std::vector<typename Map::const_iterator> found;
+    reader.find_batch(keys.begin(), keys.end(), std::back_inserter(found));
+    EXPECT_EQ(found[0], reader.begin());
+    EXPECT_EQ(found[1], reader.end());
+    EXPECT_EQ(found[2], std::prev(reader.end()));
+}
+
+TEST(MapConstTest, ReadApiOnConstMap) {
+    check_const_reads<polyndrom::acid_map<int, int>>();
+    check_const_reads<wide_map<int>>();
+    using ranked_map = polyndrom::acid_map<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+                                           polyndrom::order_statistic_traits>;
+    check_const_reads<ranked_map>();
+    ranked_map map;
+    for (int i = 0; i < 100; i++) {
+        map.emplace(i, i);
+    }
+    const ranked_map& reader = map;
+    EXPECT_EQ(reader.nth(42)->first, 42);
+    EXPECT_EQ(reader.nth(100), reader.end());
+}
+
+template <class Map>
+void check_value_semantics() {
+    Map map;
+    std::map<int, int> expected;
+    int_generator generator(0, 100000);
+    for (int i = 0; i < 5000; i++) {
+        int key = generator.next_value();
+        map.emplace(key, i);
+        expected.emplace(key, i);
+    }
+    auto same = [](auto& lhs, auto& rhs) {
+        return lhs.first == rhs.first && lhs.second == rhs.second;
+    };
+    Map copy(map);
+    EXPECT_EQ(copy.size(), expected.size());
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), copy.begin(), copy.end(), same));
+    copy.begin()->second = -1;
+    EXPECT_EQ(map.begin()->second, expected.begin()->second);
+    Map moved(std::move(copy));
+    EXPECT_TRUE(copy.empty());
+    EXPECT_EQ(copy.begin(), copy.end());
+    EXPECT_EQ(moved.size(), expected.size());
+    EXPECT_EQ(moved.begin()->second, -1);
+    Map other;
+    other.emplace(-5, 5);
+    other = map;
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), other.begin(), other.end(), same));
+    other = std::move(moved);
+    EXPECT_EQ(other.begin()->second, -1);
+    EXPECT_EQ(other.size(), expected.size());
+    Map small;
+    small.emplace(1, 1);
+    swap(small, other);
+    EXPECT_EQ(small.size(), expected.size());
+    EXPECT_EQ(other.size(), 1u);
+    EXPECT_EQ(other.begin()->first, 1);
+    small.swap(other);
+    EXPECT_EQ(small.size(), 1u);
+    copy = small;
+    copy.emplace(2, 2);
+    EXPECT_EQ(small.size(), 1u);
+    EXPECT_EQ(copy.size(), 2u);
+}
+
+TEST(MapValueSemanticsTest, CopyMoveAndSwap) {
+    using ranked_map = polyndrom::acid_map<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+                                           polyndrom::order_statistic_traits>;
+    check_value_semantics<polyndrom::acid_map<int, int>>();
+    check_value_semantics<ranked_map>();
+    check_value_semantics<wide_map<int, 8>>();
+    polyndrom::acid_map<int, int> map;
+    for (int i = 0; i < 10000; i++) {
+        map.emplace(i, i);
+    }
+    polyndrom::acid_map<int, int> copy(map);
+    EXPECT_TRUE(polyndrom::verify_tree(copy));
+    EXPECT_TRUE(polyndrom::verify_unpinned(copy));
+    EXPECT_EQ(polyndrom::tree_height(copy), polyndrom::tree_height(map));
+}
+
+template <class Map>
+void check_split_join(int n) {
+    Map map;
+    for (int i = 0; i < n; i++) {
+        map.emplace(i * 2, i);
+    }
+    for (int at = -1; at <= 2 * n + 1; at += std::max(1, n / 50)) {
+        Map upper = map.split(at);
+        ASSERT_TRUE(polyndrom::verify_tree(map));
+        ASSERT_TRUE(polyndrom::verify_tree(upper));
+        int expected_lower = std::clamp((at + 1) / 2, 0, n);
+        ASSERT_EQ(map.size(), static_cast<size_t>(expected_lower));
+        ASSERT_EQ(upper.size(), static_cast<size_t>(n - expected_lower));
+        ASSERT_EQ(std::distance(map.begin(), map.end()), expected_lower);
+        if (!upper.empty()) {
+            EXPECT_GE(upper.begin()->first, at);
+        }
+        if (!map.empty()) {
+            EXPECT_LT(std::prev(map.end())->first, at);
+        }
+        if (at % 3 == 0) {
+            upper.join(map);
+            map.swap(upper);
+        } else {
+            map.join(upper);
+        }
+        ASSERT_TRUE(upper.empty());
+        ASSERT_TRUE(polyndrom::verify_tree(map));
+        ASSERT_EQ(map.size(), static_cast<size_t>(n));
+    }
+    int i = 0;
+    for (auto& [key, value] : map) {
+        ASSERT_EQ(key, i * 2);
+        ASSERT_EQ(value, i);
+        i++;
+    }
+}
+
+TEST(MapSplitJoinTest, SplitAndJoinBack) {
+    using ranked_map = polyndrom::acid_map<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+                                           polyndrom::order_statistic_traits>;
+    for (int n : {0, 1, 2, 3, 10, 100, 5000}) {
+        check_split_join<polyndrom::acid_map<int, int>>(n);
+        check_split_join<ranked_map>(n);
+    }
+}
+
+TEST(MapSplitJoinTest, JoinUnevenTrees) {
+    for (int small : {1, 2, 7, 100}) {
+        polyndrom::acid_map<int, int> big;
+        polyndrom::acid_map<int, int> low;
+        polyndrom::acid_map<int, int> high;
+        for (int i = 0; i < 10000; i++) {
+            big.emplace(i, i);
+        }
+        for (int i = 0; i < small; i++) {
+            low.emplace(i - small, i);
+            high.emplace(10000 + i, i);
+        }
+        big.join(low);
+        big.join(high);
+        EXPECT_TRUE(polyndrom::verify_tree(big));
+        EXPECT_EQ(big.size(), static_cast<size_t>(10000 + 2 * small));
+        EXPECT_EQ(big.begin()->first, -small);
+        EXPECT_EQ(std::prev(big.end())->first, 10000 + small - 1);
+        low.emplace(5, 5);
+        EXPECT_THROW(big.join(low), std::invalid_argument);
+        EXPECT_EQ(low.size(), 1u);
+    }
+}
+
+TEST(MapSplitJoinTest, MergeMatchesStdMap) {
+    int_generator generator(0, 2000);
+    for (int round = 0; round < 20; round++) {
+        polyndrom::acid_map<int, int> map;
+        polyndrom::acid_map<int, int> other;
+        std::map<int, int> expected;
+        std::map<int, int> expected_other;
+        for (int i = 0; i < 500; i++) {
+            int key = generator.next_value();
+            map.emplace(key, 1);
+            expected.emplace(key, 1);
+            key = generator.next_value() + (round % 4 == 0 ? 3000 : 0);
+            other.emplace(key, 2);
+            expected_other.emplace(key, 2);
+        }
+        map.merge(other);
+        expected.merge(expected_other);
+        EXPECT_TRUE(polyndrom::verify_tree(map));
+        EXPECT_TRUE(polyndrom::verify_tree(other));
+        EXPECT_EQ(map.size(), expected.size());
+        EXPECT_EQ(other.size(), expected_other.size());
+        EXPECT_TRUE(std::equal(expected.begin(), expected.end(), map.begin(), map.end()));
+        EXPECT_TRUE(std::equal(expected_other.begin(), expected_other.end(), other.begin(), other.end()));
+    }
+}
+
+template <class Map>
+void check_node_handles() {
+    using value_type = std::pair<const int, std::string>;
+    static_assert(std::is_same_v<decltype(std::declval<typename Map::insert_return_type>().node),
+                                 typename Map::node_type>);
+    Map hot;
+    Map cold;
+    for (int i = 0; i < 1000; i++) {
+        hot.emplace(i, std::string(100, static_cast<char>('a' + i % 26)));
+    }
+    std::vector<const value_type*> addresses;
+    for (int i = 0; i < 1000; i += 2) {
+        addresses.push_back(&*hot.find(i));
+        auto handle = hot.extract(i);
+        ASSERT_FALSE(handle.empty());
+        EXPECT_EQ(handle.key(), i);
+        auto result = cold.insert(std::move(handle));
+        EXPECT_TRUE(result.inserted);
+        EXPECT_TRUE(result.node.empty());
+        EXPECT_TRUE(handle.empty());
+        EXPECT_EQ(&*result.position, addresses.back());
+    }
+    EXPECT_EQ(hot.size(), 500u);
+    EXPECT_EQ(cold.size(), 500u);
+    EXPECT_TRUE(hot.extract(0).empty());
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ(hot.contains(i), i % 2 == 1);
+        EXPECT_EQ(cold.contains(i), i % 2 == 0);
+    }
+    auto handle = cold.extract(cold.find(10));
+    handle.key() = 11;
+    auto blocked = hot.insert(std::move(handle));
+    EXPECT_FALSE(blocked.inserted);
+    EXPECT_EQ(blocked.position, hot.find(11));
+    ASSERT_FALSE(blocked.node.empty());
+    EXPECT_EQ(blocked.node.mapped(), std::string(100, 'k'));
+    blocked.node.key() = 1001;
+    auto it = hot.insert(hot.end(), std::move(blocked.node));
+    EXPECT_EQ(it->first, 1001);
+    EXPECT_EQ(&*it, addresses[5]);
+    EXPECT_EQ(std::prev(hot.end()), it);
+    auto dropped = cold.extract(20);
+    EXPECT_EQ(dropped.mapped(), std::string(100, 'u'));
+    EXPECT_EQ(cold.size(), 498u);
+}
+
+TEST(MapNodeHandleTest, MoveAndRekeyWithoutReallocating) {
+    check_node_handles<polyndrom::acid_map<int, std::string>>();
+    check_node_handles<polyndrom::acid_map<int, std::string, std::less<int>,
+                                           std::allocator<std::pair<const int, std::string>>,
+                                           polyndrom::order_statistic_traits>>();
+    check_node_handles<polyndrom::acid_map<int, std::string, std::less<int>,
+                                           std::allocator<std::pair<const int, std::string>>,
+                                           polyndrom::wide_node_traits<8>>>();
+}
+
+TEST(MapStatsTest, CountsRebalancingAndPins) {
+    polyndrom::acid_map<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+                        polyndrom::statistic_traits> map;
+    int n = 1000;
+    for (int i = 0; i < n; i++) {
+        map.emplace(i, i);
+    }
+    polyndrom::map_stats stats = map.stats();
+    EXPECT_EQ(stats.allocations, static_cast<uint64_t>(n));
+    EXPECT_EQ(stats.lookups, static_cast<uint64_t>(n));
+    EXPECT_EQ(stats.retraces, static_cast<uint64_t>(n - 1));
+    // Ascending insertions only ever need a single rotation.
+    EXPECT_GT(stats.rotations, 0u);
+    EXPECT_LE(stats.rotations, static_cast<uint64_t>(n));
+    EXPECT_LE(stats.longest_retrace, static_cast<uint64_t>(polyndrom::tree_height(map)));
+    EXPECT_GE(stats.retrace_steps, stats.retraces);
+    EXPECT_EQ(stats.pinned_iterators, 0u);
+    map.reset_stats();
+    {
+        auto first = map.find(1);
+        auto second = first;
+        EXPECT_EQ(map.stats().pinned_iterators, 2u);
+        EXPECT_EQ(map.stats().lookups, 1u);
+        EXPECT_GT(map.stats().comparisons, 0u);
+        // One comparison per level and one for equality at the end.
+        EXPECT_LE(map.stats().comparisons, static_cast<uint64_t>(polyndrom::tree_height(map)) + 1);
+        map.erase(first);
+    }
+    EXPECT_EQ(map.stats().pinned_iterators, 0u);
+    EXPECT_EQ(map.stats().allocations, 0u);
+}
+
+TEST(MapStatsTest, InspectMatchesTree) {
+    polyndrom::acid_map<int, int> map;
+    EXPECT_EQ(map.inspect().height, 0u);
+    int n = 10000;
+    int_generator key_generator(0, n * 10);
+    for (int i = 0; i < n; i++) {
+        map.emplace(key_generator.next_value(), i);
+    }
+    polyndrom::map_shape shape = map.inspect();
+    EXPECT_EQ(shape.height, static_cast<size_t>(polyndrom::tree_height(map)));
+    EXPECT_EQ(shape.depth_histogram[0], 1u);
+    size_t total = 0;
+    for (size_t depth = 0; depth < shape.depth_histogram.size(); depth++) {
+        EXPECT_LE(shape.depth_histogram[depth], size_t(1) << depth);
+        total += shape.depth_histogram[depth];
+    }
+    EXPECT_EQ(total, map.size());
+    EXPECT_EQ(map.stats().comparisons, 0u);
+}
+
+TEST(MapCursorTest, ScansWithoutPinning) {
+    using map_type = polyndrom::acid_map<int, int>;
+    static_assert(std::is_trivially_copyable_v<map_type::cursor>);
+    static_assert(std::is_convertible_v<map_type::cursor, map_type::const_cursor>);
+    static_assert(!std::is_convertible_v<map_type::const_cursor, map_type::cursor>);
+    map_type map;
+    std::map<int, int> expected;
+    int_generator key_generator(0, 100000);
+    for (int i = 0; i < 1000; i++) {
+        int key = key_generator.next_value();
+        map.emplace(key, i);
+        expected.emplace(key, i);
+    }
+    auto expected_it = expected.begin();
+    for (auto& [key, value] : map.view()) {
+        EXPECT_EQ(key, expected_it->first);
+        value = -value;
+        ++expected_it;
+    }
+    EXPECT_EQ(expected_it, expected.end());
+    std::vector<map_type::const_cursor> cursors;
+    const map_type& const_map = map;
+    for (auto it = const_map.end_cursor(); it != const_map.begin_cursor();) {
+        cursors.push_back(--it);
+    }
+    ASSERT_EQ(cursors.size(), expected.size());
+    EXPECT_EQ(cursors.front()->first, expected.rbegin()->first);
+    EXPECT_EQ(cursors.back()->second, -expected.begin()->second);
+    EXPECT_TRUE(polyndrom::verify_unpinned(map));
+    // Converting pins the element again, which then outlives its erasure.
+    map_type::const_iterator pinned = cursors.back();
+    EXPECT_FALSE(polyndrom::verify_unpinned(map));
+    map.erase(expected.begin()->first);
+    EXPECT_EQ(pinned->first, expected.begin()->first);
+    ++pinned;
+    EXPECT_EQ(pinned->first, std::next(expected.begin())->first);
+    map_type::cursor from_iterator(map.find(std::next(expected.begin())->first));
+    EXPECT_EQ(from_iterator, map.begin_cursor());
+    // Like the iterators, a cursor steps from end() to the first element.
+    map_type::cursor past_end = map.end_cursor();
+    EXPECT_EQ(++past_end, map.begin_cursor());
+}
+
+template <class Map>
+bool verify_layout(const Map& map) {
+    if constexpr (polyndrom::has_node_width<typename Map::traits_type>::value) {
+        return polyndrom::verify_wide_tree(map);
+    } else {
+        return polyndrom::verify_tree(map);
+    }
+}
+
+template <class Map, class Executor>
+void check_parallel_operations(Executor& executor) {
+    int_generator key_generator(0, 200000);
+    std::vector<std::pair<int, int>> values;
+    std::map<int, int> expected;
+    for (int i = 0; i < 50000; i++) {
+        values.emplace_back(key_generator.next_value(), i);
+        expected.emplace(values.back());
+    }
+    Map map;
+    map.parallel_insert(executor, values.begin(), values.end());
+    EXPECT_TRUE(verify_layout(map));
+    EXPECT_TRUE(std::equal(map.begin(), map.end(), expected.begin(), expected.end()));
+    std::atomic<long long> sum = 0;
+    map.parallel_for_each(executor, [&](auto& value) {
+        value.second += 1;
+        sum += value.second;
+    });
+    long long expected_sum = 0;
+    for (auto& [key, value] : expected) {
+        value += 1;
+        expected_sum += value;
+    }
+    EXPECT_EQ(sum, expected_sum);
+    Map other;
+    std::map<int, int> expected_other;
+    for (int i = 0; i < 30000; i++) {
+        auto value = std::make_pair(key_generator.next_value(), -i);
+        if (other.insert(value).second && !expected.emplace(value).second) {
+            expected_other.emplace(value);
+        }
+    }
+    auto pinned = other.begin();
+    int pinned_key = pinned->first;
+    map.parallel_merge(executor, other);
+    EXPECT_TRUE(verify_layout(map));
+    EXPECT_TRUE(verify_layout(other));
+    EXPECT_TRUE(std::equal(map.begin(), map.end(), expected.begin(), expected.end()));
+    EXPECT_TRUE(std::equal(other.begin(), other.end(), expected_other.begin(), expected_other.end()));
+    EXPECT_EQ(pinned->first, pinned_key);
+    // Inserting into a non-empty map keeps the elements already there.
+    map.parallel_insert(executor, values.begin(), values.begin() + 100);
+    EXPECT_EQ(map.size(), expected.size());
+    EXPECT_EQ(map.at(values.front().first), expected.at(values.front().first));
+}
+
+TEST(MapParallelTest, MatchesStdMap) {
+    polyndrom::work_stealing_executor executor(4);
+    EXPECT_EQ(executor.concurrency(), 4u);
+    check_parallel_operations<polyndrom::acid_map<int, int>>(executor);
+    check_parallel_operations<polyndrom::acid_map<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+                                                  polyndrom::order_statistic_traits>>(executor);
+    check_parallel_operations<wide_map<int, 16>>(executor);
+    polyndrom::sequential_executor sequential;
+    check_parallel_operations<polyndrom::acid_map<int, int>>(sequential);
+}
+
+TEST(MapParallelTest, ExecutorRethrowsAndKeepsWorking) {
+    polyndrom::work_stealing_executor executor(4);
+    polyndrom::acid_map<int, int> map;
+    std::vector<std::pair<int, int>> values;
+    for (int i = 0; i < 100000; i++) {
+        values.emplace_back(i, i);
+    }
+    map.parallel_insert(executor, values.begin(), values.end());
+    EXPECT_THROW(map.parallel_for_each(executor, [](auto& value) {
+        if (value.first == 77777) {
+            throw std::runtime_error("visited");
+        }
+    }), std::runtime_error);
+    std::atomic<size_t> visited = 0;
+    map.parallel_for_each(executor, [&](auto&) { visited++; });
+    EXPECT_EQ(visited, map.size());
+    std::vector<int> sorted(100000);
+    for (size_t i = 0; i < sorted.size(); i++) {
+        sorted[i] = static_cast<int>((i * 7919) % sorted.size());
+    }
+    polyndrom::parallel_stable_sort(executor, sorted, std::less<int>());
+    EXPECT_TRUE(std::is_sorted(sorted.begin(), sorted.end()));
 }
\ No newline at end of file
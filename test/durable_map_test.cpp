@@ -0,0 +1,159 @@
+#include "durable_map.hpp"
+#include "utils.hpp"
+
+#include "gtest/gtest.h"
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+class temporary_directory {
+public:
+    explicit temporary_directory(const std::string& name)
+        : path((std::filesystem::temp_directory_path() / (name + "." + std::to_string(::getpid()))).string()) {
+        std::filesystem::remove_all(path);
+    }
+    ~temporary_directory() {
+        std::filesystem::remove_all(path);
+    }
+    std::string path;
+};
+
+using durable_map = polyndrom::durable_acid_map<int, long>;
+
+void expect_contents(durable_map& map, const std::map<int, long>& expected) {
+    ASSERT_EQ(map.size(), expected.size());
+    auto it = expected.begin();
+    map.for_each([&](const auto& value) {
+        EXPECT_EQ(value.first, it->first);
+        EXPECT_EQ(value.second, it->second);
+        ++it;
+    });
+}
+
+void random_writes(durable_map& map, std::map<int, long>& expected, int n) {
+    int_generator key_generator(0, n / 2);
+    int_generator op_generator(0, 2);
+    for (int i = 0; i < n; i++) {
+        int key = key_generator.next_value();
+        switch (op_generator.next_value()) {
+            case 0:
+                EXPECT_EQ(map.erase(key), expected.erase(key));
+                break;
+            case 1:
+                EXPECT_EQ(map.try_emplace(key, i), expected.try_emplace(key, i).second);
+                break;
+            default:
+                EXPECT_EQ(map.insert_or_assign(key, i), expected.insert_or_assign(key, i).second);
+                break;
+        }
+    }
+}
+
+} // namespace
+
+TEST(DurableMapTest, RecoversFromLog) {
+    temporary_directory directory("acid_map_durable_log");
+    std::map<int, long> expected;
+    {
+        durable_map map(directory.path, false);
+        random_writes(map, expected, 5000);
+    }
+    durable_map map(directory.path, false);
+    expect_contents(map, expected);
+    EXPECT_EQ(map.get(-1), std::nullopt);
+}
+
+TEST(DurableMapTest, RecoversFromCheckpointAndLog) {
+    temporary_directory directory("acid_map_durable_checkpoint");
+    std::map<int, long> expected;
+    {
+        durable_map map(directory.path, false);
+        random_writes(map, expected, 5000);
+        map.checkpoint();
+        EXPECT_EQ(std::filesystem::file_size(std::filesystem::path(directory.path) / "log"), 0u);
+        random_writes(map, expected, 1000);
+    }
+    {
+        durable_map map(directory.path, false);
+        expect_contents(map, expected);
+        map.checkpoint();
+        map.checkpoint();
+    }
+    durable_map map(directory.path, false);
+    expect_contents(map, expected);
+}
+
+TEST(DurableMapTest, DropsTornRecord) {
+    temporary_directory directory("acid_map_durable_torn");
+    std::map<int, long> expected;
+    {
+        durable_map map(directory.path, false);
+        random_writes(map, expected, 1000);
+    }
+    auto log_path = std::filesystem::path(directory.path) / "log";
+    auto length = std::filesystem::file_size(log_path);
+    {
+        std::ofstream log(log_path, std::ios::binary | std::ios::app);
+        log.write("\x20\0\0\0garbage", 11);
+    }
+    {
+        durable_map map(directory.path, false);
+        expect_contents(map, expected);
+        EXPECT_EQ(std::filesystem::file_size(log_path), length);
+        EXPECT_TRUE(map.insert({-1, -1}));
+        expected.emplace(-1, -1);
+    }
+    durable_map map(directory.path, false);
+    expect_contents(map, expected);
+}
+
+TEST(DurableMapTest, TransactionsAreOneRecord) {
+    temporary_directory directory("acid_map_durable_transaction");
+    {
+        durable_map map(directory.path, false);
+        durable_map::transaction transaction(map);
+        transaction.insert({1, 1});
+        transaction.insert({2, 2});
+        transaction.insert_or_assign(1, 10);
+        transaction.erase(2);
+        transaction.try_emplace(3, 3);
+        EXPECT_FALSE(map.contains(1));
+        transaction.commit();
+        EXPECT_EQ(transaction.size(), 0u);
+        transaction.erase(1);
+        transaction.abort();
+        EXPECT_EQ(map.commits(), 1u);
+    }
+    durable_map map(directory.path, false);
+    expect_contents(map, {{1, 10}, {3, 3}});
+}
+
+TEST(DurableMapTest, GroupCommit) {
+    temporary_directory directory("acid_map_durable_group");
+    int threads_count = 8;
+    int n = 200;
+    {
+        durable_map map(directory.path);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threads_count; t++) {
+            threads.emplace_back([&, t] {
+                for (int i = 0; i < n; i++) {
+                    map.insert({t * n + i, i});
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        EXPECT_EQ(map.commits(), static_cast<uint64_t>(threads_count * n));
+        EXPECT_LE(map.syncs(), map.commits());
+    }
+    durable_map map(directory.path);
+    EXPECT_EQ(map.size(), static_cast<size_t>(threads_count * n));
+}
\ No newline at end of file
@@ -0,0 +1,131 @@
+#include "mapped_map.hpp"
+#include "wide_node_map.hpp"
+#include "utils.hpp"
+
+#include "gtest/gtest.h"
+
+#include <array>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <string>
+
+namespace {
+
+struct short_string {
+    std::array<char, 16> chars;
+};
+
+} // namespace
+
+template <>
+struct polyndrom::map_codec<std::string> {
+    using stored_type = short_string;
+    static short_string encode(const std::string& value) {
+        short_string stored{};
+        value.copy(stored.chars.data(), stored.chars.size() - 1);
+        return stored;
+    }
+    static std::string decode(const short_string& stored) {
+        return std::string(stored.chars.data());
+    }
+};
+
+namespace {
+
+class temporary_file {
+public:
+    explicit temporary_file(const std::string& name)
+        : path((std::filesystem::temp_directory_path() / (name + "." + std::to_string(::getpid()))).string()) {}
+    ~temporary_file() {
+        std::remove(path.c_str());
+    }
+    std::string path;
+};
+
+} // namespace
+
+TEST(MappedMapTest, MatchesSavedMap) {
+    temporary_file file("acid_map_mapped");
+    polyndrom::acid_map<int, long> map;
+    std::map<int, long> expected;
+    int_generator key_generator(0, 100000);
+    for (int i = 0; i < 10000; i++) {
+        int key = key_generator.next_value();
+        map.emplace(key, i);
+        expected.emplace(key, i);
+    }
+    map.save(file.path);
+    auto mapped = polyndrom::acid_map<int, long>::open_mmap(file.path);
+    ASSERT_EQ(mapped.size(), expected.size());
+    auto it = mapped.begin();
+    for (const auto& [key, value] : expected) {
+        EXPECT_EQ(it->first, key);
+        EXPECT_EQ(it->second, value);
+        ++it;
+    }
+    EXPECT_EQ(it, mapped.end());
+    for (int i = 0; i < 1000; i++) {
+        int key = key_generator.next_value();
+        auto found = mapped.find(key);
+        EXPECT_EQ(found != mapped.end(), expected.count(key) == 1);
+        auto lower = mapped.lower_bound(key);
+        auto expected_lower = expected.lower_bound(key);
+        ASSERT_EQ(lower - mapped.begin(), std::distance(expected.begin(), expected_lower));
+        auto upper = mapped.upper_bound(key);
+        ASSERT_EQ(upper - mapped.begin(), std::distance(expected.begin(), expected.upper_bound(key)));
+    }
+    EXPECT_EQ(mapped.at(expected.begin()->first), expected.begin()->second);
+    EXPECT_THROW(mapped.at(-1), std::out_of_range);
+    EXPECT_EQ(mapped.nth(5)->first, std::next(expected.begin(), 5)->first);
+    EXPECT_THROW(mapped.find_writable(expected.begin()->first), std::logic_error);
+}
+
+TEST(MappedMapTest, CopyOnWriteLeavesFileAlone) {
+    temporary_file file("acid_map_cow");
+    polyndrom::acid_map<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+                        polyndrom::wide_node_traits<8>> map;
+    for (int i = 0; i < 1000; i++) {
+        map.emplace(i, i);
+    }
+    map.save(file.path);
+    {
+        auto mapped = decltype(map)::open_mmap(file.path, true);
+        *mapped.find_writable(10) = -10;
+        EXPECT_EQ(mapped.at(10), -10);
+        EXPECT_EQ(mapped.find_writable(1000), nullptr);
+    }
+    polyndrom::mapped_acid_map<int, int> mapped(file.path);
+    EXPECT_EQ(mapped.at(10), 10);
+}
+
+TEST(MappedMapTest, CodecForStrings) {
+    temporary_file file("acid_map_codec");
+    polyndrom::acid_map<std::string, int> map;
+    polyndrom::acid_map<std::string, int> empty;
+    for (int i = 0; i < 100; i++) {
+        map.emplace("key" + std::to_string(i), i);
+    }
+    map.save(file.path);
+    polyndrom::mapped_acid_map<std::string, int> mapped(file.path);
+    EXPECT_EQ(mapped.size(), 100u);
+    EXPECT_EQ(mapped.at(std::string("key42")), 42);
+    EXPECT_FALSE(mapped.contains(std::string("key100")));
+    EXPECT_EQ(polyndrom::map_codec<std::string>::decode(mapped.begin()->first), "key0");
+    empty.save(file.path);
+    polyndrom::mapped_acid_map<std::string, int> mapped_empty(file.path);
+    EXPECT_TRUE(mapped_empty.empty());
+    EXPECT_EQ(mapped_empty.find(std::string("key0")), mapped_empty.end());
+}
+
+TEST(MappedMapTest, RejectsOtherFiles) {
+    using saved_layout = polyndrom::mapped_acid_map<int, long>;
+    using other_layout = polyndrom::mapped_acid_map<int, int>;
+    temporary_file file("acid_map_invalid");
+    EXPECT_THROW(saved_layout{file.path}, std::runtime_error);
+    polyndrom::acid_map<int, long> map;
+    map.emplace(1, 1);
+    map.save(file.path);
+    EXPECT_THROW(other_layout{file.path}, std::runtime_error);
+    EXPECT_EQ(saved_layout(file.path).size(), 1u);
+}
\ No newline at end of file
@@ -0,0 +1,194 @@
+#include "acid_map.hpp"
+#include "node_pool.hpp"
+#include "wide_node_map.hpp"
+#include "tree_verifier.hpp"
+#include "utils.hpp"
+
+#include "gtest/gtest.h"
+
+#include <map>
+#include <thread>
+
+template <class Key, class T>
+using pool_map = polyndrom::acid_map<Key, T, std::less<Key>, polyndrom::pool_allocator<std::pair<const Key, T>>>;
+
+TEST(NodePoolTest, ReusesFreedBlocks) {
+    polyndrom::node_pool pool;
+    void* first = pool.allocate(40, 8);
+    void* second = pool.allocate(40, 8);
+    EXPECT_NE(first, second);
+    pool.deallocate(first, 40, 8);
+    EXPECT_EQ(pool.allocate(40, 8), first);
+    pool.deallocate(first, 40, 8);
+    pool.deallocate(second, 40, 8);
+}
+
+TEST(NodePoolTest, BumpAllocatesNeighbours) {
+    polyndrom::node_pool pool;
+    char* previous = static_cast<char*>(pool.allocate(48, 8));
+    for (int i = 0; i < 100; i++) {
+        char* next = static_cast<char*>(pool.allocate(48, 8));
+        EXPECT_EQ(next, previous + 48);
+        previous = next;
+    }
+}
+
+TEST(NodePoolTest, ReserveAvoidsNewPages) {
+    polyndrom::node_pool pool;
+    pool.reserve(40, 8, 100000);
+    size_t reserved = pool.reserved_bytes();
+    EXPECT_GE(reserved, 100000 * 40);
+    std::vector<void*> blocks;
+    for (int i = 0; i < 100000; i++) {
+        blocks.push_back(pool.allocate(40, 8));
+    }
+    EXPECT_EQ(pool.reserved_bytes(), reserved);
+    for (void* block : blocks) {
+        pool.deallocate(block, 40, 8);
+    }
+}
+
+TEST(NodePoolTest, KeepsAlignment) {
+    polyndrom::node_pool pool;
+    for (int i = 0; i < 100; i++) {
+        void* block = pool.allocate(24, 16);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(block) % 16, 0);
+    }
+}
+
+TEST(NodePoolTest, LargeBlocksBypassPool) {
+    polyndrom::node_pool pool;
+    void* block = pool.allocate(4096, 8);
+    EXPECT_EQ(pool.reserved_bytes(), 0);
+    pool.deallocate(block, 4096, 8);
+}
+
+TEST(NodePoolTest, MapWithPoolAllocator) {
+    int n = 10000;
+    pool_map<int, int> map;
+    map.reserve(n);
+    size_t reserved = map.get_allocator().pool()->reserved_bytes();
+    for (int i = 0; i < n; i++) {
+        map.emplace(i, i);
+    }
+    EXPECT_EQ(map.get_allocator().pool()->reserved_bytes(), reserved);
+    std::vector<decltype(map.begin())> its;
+    for (int i = 0; i < n; i += 3) {
+        its.push_back(map.find(i));
+    }
+    for (int i = 0; i < n; i += 2) {
+        map.erase(i);
+    }
+    EXPECT_TRUE(polyndrom::verify_tree(map));
+    for (auto it : its) {
+        ++it;
+        if (it != map.end()) {
+            EXPECT_TRUE(map.contains(it->first));
+        }
+    }
+    EXPECT_EQ(map.size(), n / 2);
+}
+
+TEST(NodePoolTest, CopiedMapGetsItsOwnPool) {
+    polyndrom::node_pool_options options;
+    options.page_size = 4096;
+    pool_map<int, int> map(polyndrom::pool_allocator<std::pair<const int, int>>{options});
+    for (int i = 0; i < 1000; i++) {
+        map.emplace(i, i);
+    }
+    pool_map<int, int> copy(map);
+    EXPECT_NE(copy.get_allocator().pool(), map.get_allocator().pool());
+    EXPECT_EQ(copy.get_allocator().pool()->options().page_size, 4096);
+    pool_map<int, int> assigned;
+    auto pool = assigned.get_allocator().pool();
+    assigned = map;
+    EXPECT_EQ(assigned.get_allocator().pool(), pool);
+    std::thread reader([&copy] {
+        for (int i = 0; i < 1000; i += 2) {
+            copy.erase(i);
+        }
+        EXPECT_TRUE(polyndrom::verify_tree(copy));
+    });
+    for (int i = 1000; i < 2000; i++) {
+        map.emplace(i, i);
+    }
+    reader.join();
+    EXPECT_EQ(copy.size(), 500);
+    EXPECT_TRUE(std::equal(assigned.begin(), assigned.end(), map.begin(), std::next(map.begin(), 1000)));
+}
+
+TEST(NodePoolTest, MapsShareThreadCachedPool) {
+    polyndrom::node_pool_options options;
+    options.thread_cache = true;
+    options.thread_cache_size = 16;
+    polyndrom::pool_allocator<std::pair<const int, int>> allocator(options);
+    int threads = 4;
+    int n = 5000;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&allocator, n] {
+            pool_map<int, int> map(allocator);
+            for (int round = 0; round < 3; round++) {
+                for (int i = 0; i < n; i++) {
+                    map.emplace(i, i);
+                }
+                EXPECT_TRUE(polyndrom::verify_tree(map));
+                for (int i = 0; i < n; i++) {
+                    EXPECT_EQ(map.erase(i), 1);
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    pool_map<int, complex_object> map(allocator);
+    complex_object_generator generator;
+    for (int i = 0; i < n; i++) {
+        map.emplace(i, generator.next_value());
+    }
+    EXPECT_TRUE(polyndrom::verify_tree(map));
+}
+
+// Maps with pools of their own cannot share nodes, so merging copies the
+// elements over, and those with keys already present must stay behind.
+template <class Map, class Merge>
+void check_merge_across_pools(Merge merge) {
+    Map map;
+    Map other;
+    std::map<int, int> expected;
+    std::map<int, int> expected_kept;
+    for (int i = 0; i < 3000; i++) {
+        if (i % 2 == 0) {
+            map.emplace(i, i);
+            expected.emplace(i, i);
+        }
+        if (i % 3 == 0) {
+            other.emplace(i, -i);
+            if (!expected.emplace(i, -i).second) {
+                expected_kept.emplace(i, -i);
+            }
+        }
+    }
+    ASSERT_FALSE(map.get_allocator() == other.get_allocator());
+    merge(map, other);
+    EXPECT_TRUE(std::equal(map.begin(), map.end(), expected.begin(), expected.end()));
+    EXPECT_TRUE(std::equal(other.begin(), other.end(), expected_kept.begin(), expected_kept.end()));
+    EXPECT_EQ(other.size(), 500u);
+}
+
+TEST(NodePoolTest, MergeAcrossPoolsKeepsDuplicates) {
+    check_merge_across_pools<pool_map<int, int>>([](auto& map, auto& other) {
+        map.merge(other);
+    });
+    polyndrom::work_stealing_executor executor(4);
+    check_merge_across_pools<pool_map<int, int>>([&executor](auto& map, auto& other) {
+        map.parallel_merge(executor, other);
+    });
+    using wide_pool_map = polyndrom::acid_map<int, int, std::less<int>,
+                                              polyndrom::pool_allocator<std::pair<const int, int>>,
+                                              polyndrom::wide_node_traits<8>>;
+    check_merge_across_pools<wide_pool_map>([](auto& map, auto& other) {
+        map.merge(other);
+    });
+}
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include "node_pool.hpp"
+#include "sharded_acid_map.hpp"
+#include "utils.hpp"
+
+#include "gtest/gtest.h"
+
+#include <map>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Throws on copy once the copies allowed are used up, unlimited if negative.
+struct fragile_value {
+    explicit fragile_value(int value) : value(value) {}
+    fragile_value(const fragile_value& other) : value(other.value) {
+        if (copies_left == 0) {
+            throw std::runtime_error("copy");
+        }
+        copies_left--;
+    }
+    static inline int copies_left = -1;
+    int value;
+};
+
+}
+
+TEST(ShardedMapTest, MatchesStdMap) {
+    polyndrom::sharded_acid_map<int, int> map({250, 500, 750});
+    std::map<int, int> expected;
+    int_generator key_generator(0, 1000);
+    int_generator op_generator(0, 4);
+    for (int i = 0; i < 20000; i++) {
+        int key = key_generator.next_value();
+        switch (op_generator.next_value()) {
+            case 0:
+                EXPECT_EQ(map.erase(key), expected.erase(key));
+                break;
+            case 1:
+                EXPECT_EQ(map.try_emplace(key, i), expected.try_emplace(key, i).second);
+                break;
+            case 2:
+                EXPECT_EQ(map.insert_or_assign(key, i), expected.insert_or_assign(key, i).second);
+                break;
+            case 3:
+                EXPECT_EQ(map.get(key).has_value(), expected.count(key) == 1);
+                break;
+            default:
+                if (i % 7 == 0) {
+                    map.split(key);
+                } else if (i % 11 == 0 && map.shard_count() > 1) {
+                    map.merge(static_cast<size_t>(key) % (map.shard_count() - 1));
+                }
+                break;
+        }
+    }
+    EXPECT_EQ(map.size(), expected.size());
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), map.begin(), map.end()));
+    std::vector<int> visited;
+    map.for_each_in_range(100, 900, [&](auto& value) {
+        visited.push_back(value.first);
+    });
+    std::vector<int> expected_visited;
+    for (auto it = expected.lower_bound(100); it != expected.lower_bound(900); ++it) {
+        expected_visited.push_back(it->first);
+    }
+    EXPECT_EQ(visited, expected_visited);
+}
+
+TEST(ShardedMapTest, IteratesAcrossEmptyShards) {
+    polyndrom::sharded_acid_map<int, int> map({10, 20, 30, 40});
+    EXPECT_EQ(map.begin(), map.end());
+    map.try_emplace(25, 0);
+    map.try_emplace(5, 0);
+    map.try_emplace(45, 0);
+    std::vector<int> keys;
+    for (auto& [key, value] : map) {
+        keys.push_back(key);
+    }
+    EXPECT_EQ(keys, (std::vector<int>{5, 25, 45}));
+    EXPECT_FALSE(map.split(20));
+    EXPECT_TRUE(map.split(25));
+    EXPECT_EQ(map.shard_count(), 6u);
+    EXPECT_EQ(map.shard_size(3), 1u);
+    map.merge(0);
+    map.merge(0);
+    EXPECT_THROW(map.merge(3), std::out_of_range);
+    EXPECT_THROW(map.merge(7), std::out_of_range);
+    EXPECT_EQ(map.shard_count(), 4u);
+    EXPECT_EQ(map.shard_size(0), 1u);
+    EXPECT_EQ(map.shard_size(1), 1u);
+    EXPECT_TRUE(map.contains(25));
+    EXPECT_FALSE(map.split_shard(1));
+}
+
+TEST(ShardedMapTest, ConcurrentWriters) {
+    int writers = 16;
+    int per_writer = 2000;
+    polyndrom::sharded_acid_map<int, int> map;
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writers; w++) {
+        threads.emplace_back([&, w] {
+            for (int i = w * per_writer; i < (w + 1) * per_writer; i++) {
+                EXPECT_TRUE(map.try_emplace(i, w));
+                if (i % 3 == 0) {
+                    EXPECT_EQ(map.erase(i), 1u);
+                }
+            }
+        });
+    }
+    // Splits the hottest shard while the writers are running.
+    for (int round = 0; round < 8; round++) {
+        size_t hottest = 0;
+        for (size_t index = 0; index < map.shard_count(); index++) {
+            if (map.shard_operations(index) > map.shard_operations(hottest)) {
+                hottest = index;
+            }
+        }
+        map.split_shard(hottest);
+        std::this_thread::yield();
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    int expected = 0;
+    size_t count = 0;
+    map.for_each([&](auto& value) {
+        if (expected % 3 == 0) {
+            expected++;
+        }
+        EXPECT_EQ(value.first, expected);
+        EXPECT_EQ(value.second, expected / per_writer);
+        expected++;
+        count++;
+    });
+    EXPECT_EQ(count, static_cast<size_t>(writers * per_writer * 2 / 3));
+    EXPECT_EQ(map.size(), count);
+}
+
+TEST(ShardedMapTest, MergeAcrossPoolsKeepsShardsOnThrow) {
+    using value_type = std::pair<const int, fragile_value>;
+    polyndrom::sharded_acid_map<int, fragile_value, std::less<int>, polyndrom::pool_allocator<value_type>> map({100});
+    for (int i = 0; i < 200; i++) {
+        map.try_emplace(i, i);
+    }
+    fragile_value::copies_left = 50;
+    EXPECT_THROW(map.merge(0), std::runtime_error);
+    fragile_value::copies_left = -1;
+    ASSERT_EQ(map.shard_count(), 2u);
+    EXPECT_EQ(map.shard_size(0), 100u);
+    EXPECT_EQ(map.shard_size(1), 100u);
+    for (int i = 0; i < 200; i++) {
+        EXPECT_EQ(map.get(i)->value, i);
+    }
+    map.merge(0);
+    EXPECT_EQ(map.shard_count(), 1u);
+    int expected = 0;
+    for (auto& [key, value] : map) {
+        EXPECT_EQ(key, expected);
+        EXPECT_EQ(value.value, expected);
+        expected++;
+    }
+    EXPECT_EQ(expected, 200);
+}
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "acid_map.hpp"
+#include "concurrent_map.hpp"
+#include "wide_node_map.hpp"
 
 #include <iostream>
 
@@ -9,14 +11,36 @@ namespace polyndrom {
 template <class Tree>
 bool verify_tree(const Tree& tree, std::ostream& fails_ostream = std::cout);
 
+template <class Tree>
+bool verify_unpinned(const Tree& tree, std::ostream& fails_ostream = std::cout);
+
+template <class Tree>
+int tree_height(const Tree& tree);
+
 template <class Tree>
 class tree_verifier {
 public:
-    using node_ptr = typename Tree::node_ptr;
+    using node_ptr = typename Tree::tree_node*;
     tree_verifier(const Tree& tree, std::ostream& fails_ostream) : tree(tree), fails_ostream(fails_ostream) {}
     bool verify() {
         return verify_node(tree.root);
     }
+    int height() {
+        return deep_height(tree.root) + 1;
+    }
+    bool verify_unpinned() {
+        return verify_unpinned_node(tree.root);
+    }
+    bool verify_unpinned_node(node_ptr node) {
+        if (node == nullptr) {
+            return true;
+        }
+        if (node->ref_count != 1) {
+            fails_ostream << "pinned node: " << node->value.first << " " << node->ref_count << std::endl;
+            return false;
+        }
+        return verify_unpinned_node(node->left) && verify_unpinned_node(node->right);
+    }
     int deep_height(node_ptr node) {
         if (node == nullptr) {
             return -1;
@@ -60,6 +84,19 @@ public:
         }
         int lheight = deep_height(node->left);
         int rheight = deep_height(node->right);
+        if (node->height != std::max(lheight, rheight) + 2) {
+            fails_ostream << "node stored height " << node->value.first << " " << int(node->height) << " "
+                          << std::max(lheight, rheight) + 2 << std::endl;
+            return false;
+        }
+        if constexpr (Tree::traits_type::order_statistics) {
+            size_t expected_size = Tree::tree_node::size(left) + Tree::tree_node::size(right) + 1;
+            if (node->subtree_size != expected_size) {
+                fails_ostream << "node stored size " << node->value.first << " " << node->subtree_size << " "
+                              << expected_size << std::endl;
+                return false;
+            }
+        }
         int bf = lheight - rheight;
         if (bf > 1 || bf < -1) {
             fails_ostream << "node lh rh " << node->value.first << " " << lheight << " " << rheight << std::endl;
@@ -77,4 +114,177 @@ bool verify_tree(const Tree& tree, std::ostream& fails_ostream) {
     return verifier.verify();
 }
 
+template <class Tree>
+bool verify_unpinned(const Tree& tree, std::ostream& fails_ostream) {
+    tree_verifier verifier(tree, fails_ostream);
+    return verifier.verify_unpinned();
+}
+
+template <class Tree>
+int tree_height(const Tree& tree) {
+    tree_verifier verifier(tree, std::cout);
+    return verifier.height();
+}
+
+template <class Map>
+class version_tree_verifier {
+public:
+    using node_type = typename Map::node_type;
+    version_tree_verifier(const Map& map, std::ostream& fails_ostream) : map(map), fails_ostream(fails_ostream) {}
+    // Every stripe of the current table holds a valid tree within its bounds.
+    bool verify() {
+        auto* table = map.table.load();
+        if (table->bounds.size() + 1 != table->stripes.size()) {
+            fails_ostream << "stripe bounds " << table->bounds.size() << " " << table->stripes.size() << std::endl;
+            return false;
+        }
+        for (size_t i = 0; i < table->stripes.size(); i++) {
+            const node_type* root = table->stripes[i]->head.load()->root;
+            if (table->stripes[i]->retired || !verify_node(root)) {
+                fails_ostream << "stripe " << i << std::endl;
+                return false;
+            }
+            if (root == nullptr) {
+                continue;
+            }
+            const node_type* min = root;
+            const node_type* max = root;
+            for (; min->left != nullptr; min = min->left) {
+            }
+            for (; max->right != nullptr; max = max->right) {
+            }
+            if ((i > 0 && map.is_less(min->key(), table->bounds[i - 1])) ||
+                (i + 1 < table->stripes.size() && !map.is_less(max->key(), table->bounds[i]))) {
+                fails_ostream << "stripe " << i << " out of bounds" << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+    size_t stripes() {
+        return map.table.load()->stripes.size();
+    }
+    bool verify_node(const node_type* node) {
+        if (node == nullptr) {
+            return true;
+        }
+        int lheight = node_type::height(node->left);
+        int rheight = node_type::height(node->right);
+        if (node->subtree_height != std::max(lheight, rheight) + 1 || lheight - rheight > 1 || rheight - lheight > 1) {
+            fails_ostream << "node heights " << node->value.first << " " << lheight << " " << rheight << std::endl;
+            return false;
+        }
+        if (node->subtree_size != node_type::size(node->left) + node_type::size(node->right) + 1) {
+            fails_ostream << "node stored size " << node->value.first << " " << node->subtree_size << std::endl;
+            return false;
+        }
+        if ((node->left != nullptr && !map.is_less(node->left->key(), node->key())) ||
+            (node->right != nullptr && !map.is_less(node->key(), node->right->key()))) {
+            fails_ostream << "node order " << node->value.first << std::endl;
+            return false;
+        }
+        if (node->ref_count.load() == 0) {
+            fails_ostream << "node alive without references " << node->value.first << std::endl;
+            return false;
+        }
+        return verify_node(node->left) && verify_node(node->right);
+    }
+    const Map& map;
+    std::ostream& fails_ostream;
+};
+
+template <class Map>
+bool verify_version_tree(const Map& map, std::ostream& fails_ostream = std::cout) {
+    version_tree_verifier<Map> verifier(map, fails_ostream);
+    return verifier.verify();
+}
+
+template <class Map>
+size_t version_stripes(const Map& map) {
+    version_tree_verifier<Map> verifier(map, std::cout);
+    return verifier.stripes();
+}
+
+template <class Map>
+class wide_tree_verifier {
+public:
+    using key_type = typename Map::key_type;
+    using leaf_type = typename Map::leaf_type;
+    using inner_type = typename Map::inner_type;
+    wide_tree_verifier(const Map& map, std::ostream& fails_ostream) : map(map), fails_ostream(fails_ostream) {}
+    bool verify() {
+        if (map.root == nullptr) {
+            return map.height == 0 && map.map_size == 0 && map.first_leaf == nullptr && map.last_leaf == nullptr;
+        }
+        if (!verify_node(map.root, map.height, nullptr, nullptr)) {
+            return false;
+        }
+        if (previous != map.last_leaf || elements != map.map_size) {
+            fails_ostream << "leaf chain or size " << elements << " " << map.map_size << std::endl;
+            return false;
+        }
+        return true;
+    }
+    bool verify_node(const wide_node_base* node, size_t level, const key_type* lower, const key_type* upper) {
+        size_t width = Map::traits_type::node_width;
+        bool is_root = node == map.root;
+        if (node->count > width || node->count == 0 || (!is_root && node->count < Map::min_count) ||
+            (is_root && level > 1 && node->count < 2)) {
+            fails_ostream << "node count " << node->count << " at level " << level << std::endl;
+            return false;
+        }
+        if (level == 1) {
+            auto* leaf = static_cast<const leaf_type*>(node);
+            if (leaf->prev != previous || (previous == nullptr ? map.first_leaf : previous->next) != leaf) {
+                fails_ostream << "leaf links" << std::endl;
+                return false;
+            }
+            for (size_t i = 0; i < leaf->count; i++) {
+                auto* element = leaf->elements[i];
+                if ((i > 0 && !map.is_less(leaf->keys[i - 1], leaf->keys[i])) ||
+                    (lower != nullptr && map.is_less(leaf->keys[i], *lower)) ||
+                    (upper != nullptr && !map.is_less(leaf->keys[i], *upper))) {
+                    fails_ostream << "leaf order " << leaf->keys[i] << std::endl;
+                    return false;
+                }
+                if (element->leaf != leaf || element->is_deleted || element->ref_count == 0 ||
+                    map.is_less(element->key(), leaf->keys[i]) || map.is_less(leaf->keys[i], element->key())) {
+                    fails_ostream << "element " << leaf->keys[i] << std::endl;
+                    return false;
+                }
+            }
+            previous = leaf;
+            elements += leaf->count;
+            return true;
+        }
+        auto* inner = static_cast<const inner_type*>(node);
+        for (size_t i = 0; i + 1 < inner->count; i++) {
+            if ((i > 0 && !map.is_less(inner->keys[i - 1], inner->keys[i])) ||
+                (lower != nullptr && map.is_less(inner->keys[i], *lower)) ||
+                (upper != nullptr && !map.is_less(inner->keys[i], *upper))) {
+                fails_ostream << "separator order " << inner->keys[i] << std::endl;
+                return false;
+            }
+        }
+        for (size_t i = 0; i < inner->count; i++) {
+            const key_type* child_lower = i == 0 ? lower : &inner->keys[i - 1];
+            const key_type* child_upper = i + 1 < inner->count ? &inner->keys[i] : upper;
+            if (!verify_node(inner->children[i], level - 1, child_lower, child_upper)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    const Map& map;
+    std::ostream& fails_ostream;
+    const leaf_type* previous = nullptr;
+    size_t elements = 0;
+};
+
+template <class Map>
+bool verify_wide_tree(const Map& map, std::ostream& fails_ostream = std::cout) {
+    wide_tree_verifier<typename Map::wide_node_map> verifier(map, fails_ostream);
+    return verifier.verify();
+}
+
 }
\ No newline at end of file
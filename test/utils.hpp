@@ -4,6 +4,7 @@
 #include <string>
 #include <algorithm>
 #include <ostream>
+#include <tuple>
 
 class complex_object {
 public: